@@ -8,7 +8,11 @@
 
 void print_usage(int end)
 {
-    fprintf(stderr, "Usage: ottd_preview file [-v] [-m nw|ne|iso] [-d output.txt] [-p output.png]\n");
+    fprintf(stderr, "Usage: ottd_preview file [-v] [-m nw|ne|iso] [-t seconds [-c]] [-i] [-k] [-r] [-l] [-s tiles] [-x x,y,w,h [-z zoom]] [-n] [-N networks.png] [-j threads] [-H] [-T trace.json] [-M MiB [-S dir]] [-d output.txt] [-p [mode:]output.png[:size]]...\n");
+    fprintf(stderr, "       ottd_preview --probe file...\n");
+    fprintf(stderr, "       ottd_preview --catalog index dir...\n");
+    fprintf(stderr, "       ottd_preview --query expr index\n");
+    fprintf(stderr, "       ottd_preview --anatomy [--json] file...\n");
     if (end) exit(1);
 }
 
@@ -18,19 +22,300 @@ void print_help(void)
     printf("Generate a preview of an OpenTTD save/scenario\n");
     printf("Options:\n");
     printf(" -v|--verbose\n");
-    printf(" -p|--png <output>  write map image\n");
+    printf(" -p|--png <output>  write map image, repeat for more images of one load. nw:, ne: or iso:\n");
+    printf("                    before the path sets its orientation, :n after it shrinks it to n pixels a side\n");
     printf(" -m|--map           map orientation (nw,ne,iso)\n");
     printf(" -d|--data <output> write map info (company names and colors, plain text)\n");
+    printf(" -t|--timeout <s>   give up after this many seconds\n");
+    printf(" -c|--coarse        on timeout, finish the image coarsely instead of failing\n");
+    printf(" -i|--index         keep a seek index next to the save (file.ottdidx) to skip decoding on later loads\n");
+    printf(" -k|--cache         keep the decoded map next to the save (file.ottdmap) and reuse it on later runs\n");
+    printf(" -r|--rle           keep the map run-length encoded, for huge maps in little memory\n");
+    printf(" -l|--hillshade     colour land by height and shade the map by its slopes\n");
+    printf(" -s|--thumbnail <n> load big maps shrunk to at most n tiles a side, without the full-size map\n");
+    printf(" -x|--crop <x,y,w,h> only draw these tiles, without rendering the rest of the map\n");
+    printf(" -z|--zoom <n>      draw cropped tiles n times larger, or -n times smaller\n");
+    printf(" -n|--networks      print the connected rail and road networks of each company\n");
+    printf(" -N|--network-map <output> draw each network in its own colour to a png, in the -m orientation\n");
+    printf(" -j|--threads <n>   render with n threads, default one per core\n");
+    printf(" -H|--perf          print time and hardware counters per stage of loading and rendering\n");
+    printf(" -T|--trace <output> write a Chrome/Perfetto trace of loading and rendering\n");
+    printf(" -M|--budget <MiB>  refuse saves that would need more memory than this\n");
+    printf(" -S|--scratch <dir> keep maps over the budget in a scratch file in dir instead of refusing them\n");
+    printf(" -P|--probe         print version, map size, years and companies of each file, tab-separated\n");
+    printf(" -C|--catalog       create or update an index of the saves in the given directories\n");
+    printf(" -Q|--query <expr>  list saves in an index matching expr, like \"map>=2048,year>2000\"\n");
+    printf(" -A|--anatomy       print where the bytes and load time of the given saves go, by chunk\n");
+    printf(" -J|--json          print the anatomy as json\n");
     printf(" -h|--help          show this help\n");
     exit(1);
 }
 
+void print_log(void *ctx, int level, const char *message)
+{
+    fputs(message, (level == OTTD_LOG_INFO)? stdout : stderr);
+}
+
+int write_data(const ottd_t *game, const char *data_output)
+{
+    FILE *fp = fopen(data_output, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ottd_preview: %s: %s\n", data_output, strerror(errno));
+        return -1;
+    }
+    for(int i=0; i < 15; i++) {
+        const ottd_company_t *cmp= ottd_company(game, i);
+        if (!cmp->active) continue;
+        png_color cc = ottd_color[ottd_company_color(cmp->color)];
+        fprintf(fp, "Company %d #%02X%02X%02X %s\n", i+1, cc.red,cc.green,cc.blue, cmp->name);
+    }
+    const ottd_territory_t *territory = ottd_territory(game);
+    for(int i=0; territory && i < 15; i++) {
+        if (!ottd_company(game, i)->active) continue;
+        const uint64_t *tiles = territory->tiles[i];
+        uint64_t total = 0;
+        for(int t=0; t < 16; t++) total += tiles[t];
+        fprintf(fp, "Territory %d tiles %llu rail %llu road %llu station %llu", i+1, (unsigned long long)total,
+            (unsigned long long)tiles[MP_RAILWAY], (unsigned long long)tiles[MP_ROAD], (unsigned long long)tiles[MP_STATION]);
+        if (total) {
+            fprintf(fp, " bounds %u,%u %u,%u", territory->bounds[i].x0, territory->bounds[i].y0,
+                territory->bounds[i].x1, territory->bounds[i].y1);
+        }
+        fprintf(fp, "\n");
+    }
+    fprintf(fp, "# data end\n");
+    return fclose(fp);
+}
+
+// [mode:]path[:size], mode -1 when it's left to -m
+int parse_output(const char *arg, ottd_output_t *out)
+{
+    static const char *modes[] = {"nw:", "ne:", "iso:"};
+    static const int mode_values[] = {OTTD_MAP_NW, OTTD_MAP_NE, OTTD_MAP_ISO};
+    memset(out, 0, sizeof *out);
+    out->mode = -1;
+    for(int i=0; i < 3; i++) {
+        if (strncasecmp(arg, modes[i], strlen(modes[i])) == 0) {
+            out->mode = mode_values[i];
+            arg += strlen(modes[i]);
+        }
+    }
+    char *path = strdup(arg);
+    char *size = strrchr(path, ':');
+    if (size && size[1] && strspn(size + 1, "0123456789") == strlen(size + 1)) {
+        out->size = atoi(size + 1);
+        *size = '\0';
+    }
+    out->path = path;
+    return *path? 0 : -1;
+}
+
+// prints each company's networks, and draws them cycling through the company colours when map_path is set
+int print_networks(ottd_t *game, int print, const char *map_path, int mode, const ottd_options_t *options)
+{
+    ottd_networks_t nets;
+    ottd_error_t err;
+    if (ottd_find_networks(game, &nets, map_path != NULL, options, &err)) {
+        fprintf(stderr, "ottd_preview: %s\n", err.message);
+        return -1;
+    }
+    for(uint32_t n=0, k=0; print && n < nets.count; n++) {
+        const ottd_network_t *net = &nets.network[n];
+        if (n == 0 || net->owner != nets.network[n-1].owner) {
+            printf("Networks %d count %u\n", net->owner+1, nets.companies[net->owner]);
+            k = 0;
+        }
+        printf("Network %d %u tiles %llu bounds %u,%u %u,%u\n", net->owner+1, ++k, (unsigned long long)net->tiles, net->x0, net->y0, net->x1, net->y1);
+    }
+    int ret = 0;
+    if (map_path) {
+        size_t tiles = (size_t)nets.width * nets.height;
+        uint8_t *color = malloc(tiles);
+        if (color == NULL) {
+            fprintf(stderr, "ottd_preview: %s: %s\n", map_path, strerror(ENOMEM));
+            ret = -1;
+        } else {
+            for(size_t i=0; i < tiles; i++) color[i] = nets.labels[i]? ottd_company_color(nets.labels[i] % 16) : 0;
+            ottd_set_colors(game, color);
+            if (ottd_write_png(game, map_path, mode, options, &err)) {
+                fprintf(stderr, "ottd_preview: %s\n", err.message);
+                ret = -1;
+            }
+            ottd_set_colors(game, NULL);
+            free(color);
+        }
+    }
+    ottd_networks_free(&nets);
+    return ret;
+}
+
+int probe_files(int count, char * const *paths, const ottd_options_t *options)
+{
+    int status = 0;
+    for(int i=0; i < count; i++) {
+        ottd_info_t info;
+        ottd_error_t err;
+        if (ottd_probe(paths[i], &info, options, &err)) {
+            fprintf(stderr, "ottd_preview: %s: %s\n", paths[i], err.message);
+            status = 1;
+            continue;
+        }
+        printf("%s\t%c%c%c%c\t%d\t%ux%u\t%d-%d", paths[i], (info.format >> 24) & 0xFF, (info.format >> 16) & 0xFF, (info.format >> 8) & 0xFF, info.format & 0xFF,
+            info.version, info.mapSize.x, info.mapSize.y, info.startYear, info.curDate.year);
+        for(int c=0; c < 15; c++) {
+            if (!info.company[c].active) continue;
+            png_color cc = ottd_color[ottd_company_color(info.company[c].color)];
+            printf("\tCompany %d #%02X%02X%02X %s", c+1, cc.red, cc.green, cc.blue, info.company[c].name);
+        }
+        printf("\n");
+    }
+    return status;
+}
+
+static const char *chunk_type_name(int type)
+{
+    static const char *names[] = {"riff", "array", "sparse", "table", "sparse_table"};
+    return (type >= 0 && type < 5)? names[type] : "unknown";
+}
+
+static void chunk_tag(uint32_t tag, char *str)
+{
+    for(int i=0; i < 4; i++) {
+        char c = (tag >> (24 - 8 * i)) & 0xFF;
+        str[i] = (c >= 0x20 && c < 0x7F && c != '"' && c != '\\')? c : '?';
+    }
+    str[4] = '\0';
+}
+
+static int compare_chunk_bytes(const void *a, const void *b)
+{
+    const ottd_anatomy_chunk_t *ca = a, *cb = b;
+    if (ca->bytes != cb->bytes) return (ca->bytes < cb->bytes)? 1 : -1;
+    return (ca->tag > cb->tag) - (ca->tag < cb->tag);
+}
+
+static double percent(uint64_t part, uint64_t total)
+{
+    return total? 100.0 * part / total : 0;
+}
+
+int print_anatomy(int count, char * const *paths, const ottd_options_t *options, int json)
+{
+    int status = 0;
+    ottd_anatomy_t anatomy = { 0 };
+    for(int i=0; i < count; i++) {
+        ottd_error_t err;
+        if (ottd_anatomy_add(&anatomy, paths[i], options, &err)) {
+            fprintf(stderr, "ottd_preview: %s: %s\n", paths[i], err.message);
+            status = 1;
+        }
+    }
+    
+    // chunks that were seen, largest first
+    int n = 0;
+    for(int i=0; i < anatomy.nchunks; i++) {
+        if (anatomy.chunks[i].count) anatomy.chunks[n++] = anatomy.chunks[i];
+    }
+    qsort(anatomy.chunks, n, sizeof *anatomy.chunks, compare_chunk_bytes);
+    
+    uint64_t compressed = 0, time_ns = 0;
+    for(int i=0; i < n; i++) {
+        compressed += anatomy.chunks[i].compressed;
+        time_ns += anatomy.chunks[i].time_ns;
+    }
+    char tag[5];
+    if (json) {
+        printf("{\"files\":%llu,\"file_bytes\":%llu,\"bytes\":%llu,\"time_ns\":%llu,\"chunks\":[",
+            (unsigned long long)anatomy.files, (unsigned long long)anatomy.file_bytes,
+            (unsigned long long)anatomy.bytes, (unsigned long long)anatomy.time_ns);
+        for(int i=0; i < n; i++) {
+            const ottd_anatomy_chunk_t *ch = &anatomy.chunks[i];
+            chunk_tag(ch->tag, tag);
+            printf("%s\n{\"tag\":\"%s\",\"type\":\"%s\",\"count\":%llu,\"elements\":%llu,\"bytes\":%llu,\"compressed\":%llu,\"time_ns\":%llu}",
+                i? "," : "", tag, chunk_type_name(ch->type), (unsigned long long)ch->count, (unsigned long long)ch->elements,
+                (unsigned long long)ch->bytes, (unsigned long long)ch->compressed, (unsigned long long)ch->time_ns);
+        }
+        printf("]}\n");
+    } else {
+        printf("%-4s  %-12s %6s %10s %12s %6s %12s %6s %10s %6s\n", "tag", "type", "count", "elements", "bytes", "%", "compressed", "%", "time ms", "%");
+        for(int i=0; i < n; i++) {
+            const ottd_anatomy_chunk_t *ch = &anatomy.chunks[i];
+            chunk_tag(ch->tag, tag);
+            printf("%-4s  %-12s %6llu %10llu %12llu %6.2f %12llu %6.2f %10.3f %6.2f\n", tag, chunk_type_name(ch->type),
+                (unsigned long long)ch->count, (unsigned long long)ch->elements,
+                (unsigned long long)ch->bytes, percent(ch->bytes, anatomy.bytes),
+                (unsigned long long)ch->compressed, percent(ch->compressed, compressed),
+                ch->time_ns / 1e6, percent(ch->time_ns, time_ns));
+        }
+        printf("%-4s  %-12s %6llu %10s %12llu %6s %12llu %6s %10.3f %6s\n", "all", "", (unsigned long long)anatomy.files, "",
+            (unsigned long long)anatomy.bytes, "", (unsigned long long)anatomy.file_bytes, "", anatomy.time_ns / 1e6, "");
+    }
+    ottd_anatomy_free(&anatomy);
+    return status;
+}
+
+void print_perf(const ottd_perf_t *perf)
+{
+    static const char *counters[] = {"cycles", "instructions", "cache misses", "branch misses"};
+    printf("%-16s %10s", "stage", "time ms");
+    for(int c=0; c < OTTD_PERF_COUNTERS; c++) printf(" %14s", counters[c]);
+    printf(" %6s\n", "IPC");
+    for(int s=0; s < OTTD_PERF_STAGES; s++) {
+        printf("%-16s %10.3f", ottd_perf_stage_name(s), perf->stage[s].time_ns / 1e6);
+        for(int c=0; c < OTTD_PERF_COUNTERS; c++) {
+            if (perf->available & (1 << c)) printf(" %14llu", (unsigned long long)perf->stage[s].count[c]);
+            else printf(" %14s", "-");
+        }
+        uint64_t cycles = perf->stage[s].count[OTTD_PERF_CYCLES];
+        if (cycles && (perf->available & (1 << OTTD_PERF_INSTRUCTIONS))) printf(" %6.2f\n", (double)perf->stage[s].count[OTTD_PERF_INSTRUCTIONS] / cycles);
+        else printf(" %6s\n", "-");
+    }
+    if (perf->available == 0) fprintf(stderr, "ottd_preview: hardware counters not available, check kernel.perf_event_paranoid\n");
+}
+
+int query_catalog(const char *expr, const char *index_path)
+{
+    ottd_query_t query;
+    ottd_error_t err;
+    if (ottd_query_parse(&query, expr, &err)) {
+        fprintf(stderr, "ottd_preview: %s\n", err.message);
+        return 1;
+    }
+    ottd_catalog_t *cat = ottd_catalog_open(index_path, &err);
+    if (cat == NULL) {
+        fprintf(stderr, "ottd_preview: %s\n", err.message);
+        return 1;
+    }
+    for(size_t i=0; i < ottd_catalog_count(cat); i++) {
+        const ottd_catalog_record_t *rec = ottd_catalog_record(cat, i);
+        if (!ottd_query_match(&query, rec)) continue;
+        printf("%s\t%c%c%c%c\t%d\t%ux%u\t%d-%d", ottd_catalog_string(cat, rec->path), (rec->format >> 24) & 0xFF, (rec->format >> 16) & 0xFF, (rec->format >> 8) & 0xFF, rec->format & 0xFF,
+            rec->version, rec->mapSize.x, rec->mapSize.y, rec->startYear, rec->curDate.year);
+        for(int c=0; c < 15; c++) {
+            if (!(rec->companies & (1 << c))) continue;
+            png_color cc = ottd_color[ottd_company_color(rec->company[c].color)];
+            printf("\tCompany %d #%02X%02X%02X %s", c+1, cc.red, cc.green, cc.blue, ottd_catalog_string(cat, rec->company[c].name));
+        }
+        printf("\n");
+    }
+    ottd_catalog_close(cat);
+    return 0;
+}
+
 int main (int argc, char * const *argv)
 {
-    char *png_output = NULL;
+    ottd_output_t outputs[16];
+    int noutputs = 0;
     char *data_output = NULL;
     char *file_path = NULL;
-    int verbose = 0, map_mode = 0;
+    char *query = NULL;
+    char *trace_output = NULL;
+    char *scratch_dir = NULL;
+    char *network_map = NULL;
+    ottd_viewport_t crop = { 0 };
+    int use_crop = 0;
+    int verbose = 0, networks = 0, map_mode = 0, threads = 0, thumbnail = 0, status = 0, flags = 0, probe = 0, catalog = 0, anatomy = 0, json = 0, use_index = 0, use_cache = 0, use_perf = 0;
+    double timeout = 0, budget = 0;
     
     // parse args
     int opt;
@@ -40,15 +325,36 @@ int main (int argc, char * const *argv)
         {"data", required_argument, NULL, 'd'},
         {"help", required_argument, NULL, 'h'},
         {"map", required_argument, NULL, 'm'},
+        {"timeout", required_argument, NULL, 't'},
+        {"coarse", no_argument, NULL, 'c'},
+        {"index", no_argument, NULL, 'i'},
+        {"cache", no_argument, NULL, 'k'},
+        {"rle", no_argument, NULL, 'r'},
+        {"hillshade", no_argument, NULL, 'l'},
+        {"thumbnail", required_argument, NULL, 's'},
+        {"crop", required_argument, NULL, 'x'},
+        {"zoom", required_argument, NULL, 'z'},
+        {"networks", no_argument, NULL, 'n'},
+        {"network-map", required_argument, NULL, 'N'},
+        {"threads", required_argument, NULL, 'j'},
+        {"perf", no_argument, NULL, 'H'},
+        {"trace", required_argument, NULL, 'T'},
+        {"budget", required_argument, NULL, 'M'},
+        {"scratch", required_argument, NULL, 'S'},
+        {"probe", no_argument, NULL, 'P'},
+        {"catalog", no_argument, NULL, 'C'},
+        {"query", required_argument, NULL, 'Q'},
+        {"anatomy", no_argument, NULL, 'A'},
+        {"json", no_argument, NULL, 'J'},
         {0, 0, 0, 0}
     };
-    while((opt = getopt_long(argc, argv, "vp:d:m:h?", opts, NULL)) != -1) {
+    while((opt = getopt_long(argc, argv, "vp:d:m:t:cikrls:x:z:nN:j:HT:M:S:PCQ:AJh?", opts, NULL)) != -1) {
         switch(opt) {
             case 'v':
                 verbose = 1;
                 break;
             case 'p':
-                png_output = strdup(optarg);
+                if (noutputs == sizeof outputs / sizeof *outputs || parse_output(optarg, &outputs[noutputs++])) print_help();
                 break;
             case 'd':
                 data_output = strdup(optarg);
@@ -60,54 +366,191 @@ int main (int argc, char * const *argv)
                 else if (strcasecmp(optarg, "iso") == 0) map_mode = OTTD_MAP_ISO;
                 else print_help();
                 break;
+            case 't':
+                timeout = atof(optarg);
+                break;
+            case 'c':
+                flags |= OTTD_F_COARSE_FALLBACK;
+                break;
+            case 'i':
+                use_index = 1;
+                break;
+            case 'k':
+                use_cache = 1;
+                break;
+            case 'r':
+                flags |= OTTD_F_RLE_MAP;
+                break;
+            case 'l':
+                flags |= OTTD_F_HILLSHADE;
+                break;
+            case 's':
+                thumbnail = atoi(optarg);
+                break;
+            case 'x':
+                if (sscanf(optarg, "%u,%u,%u,%u", &crop.x, &crop.y, &crop.w, &crop.h) != 4) print_help();
+                use_crop = 1;
+                break;
+            case 'z':
+                crop.zoom = atoi(optarg);
+                break;
+            case 'n':
+                networks = 1;
+                break;
+            case 'N':
+                network_map = optarg;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'H':
+                use_perf = 1;
+                break;
+            case 'T':
+                trace_output = optarg;
+                break;
+            case 'M':
+                budget = atof(optarg);
+                break;
+            case 'S':
+                scratch_dir = optarg;
+                break;
+            case 'P':
+                probe = 1;
+                break;
+            case 'C':
+                catalog = 1;
+                break;
+            case 'Q':
+                query = optarg;
+                break;
+            case 'A':
+                anatomy = 1;
+                break;
+            case 'J':
+                json = 1;
+                break;
             case '?':
             case 'h':
                 print_help();
         }
     }
-    if (argc - optind != 1) print_usage(1);
+    ottd_options_t options = { .verbose = verbose, .log = print_log, .flags = flags, .threads = threads, .thumbnail = (thumbnail > 0)? thumbnail : 0, .scratch_dir = scratch_dir };
+    if (timeout > 0) options.deadline = ottd_clock_ms() + (uint64_t)(timeout * 1000);
+    ottd_memory_t memory = { .budget = (uint64_t)(budget * 1024 * 1024) };
+    options.memory = &memory;
+    if (trace_output && (options.trace = ottd_trace_create(0)) == NULL) {
+        fprintf(stderr, "ottd_preview: %s: %s\n", trace_output, strerror(ENOMEM));
+        return 1;
+    }
+    if (probe) {
+        if (argc == optind) print_usage(1);
+        status = probe_files(argc - optind, argv + optind, &options);
+        goto done;
+    }
+    if (anatomy) {
+        if (argc == optind) print_usage(1);
+        status = print_anatomy(argc - optind, argv + optind, &options, json);
+        goto done;
+    }
+    if (catalog) {
+        if (argc - optind < 2) print_usage(1);
+        ottd_error_t err;
+        if (ottd_catalog_update(argv[optind], (const char * const *)argv + optind + 1, argc - optind - 1, &options, &err)) {
+            fprintf(stderr, "ottd_preview: %s\n", err.message);
+            status = 1;
+        }
+        goto done;
+    }
+    if (query) {
+        if (argc - optind != 1) print_usage(1);
+        return query_catalog(query, argv[optind]);
+    }
+    if (argc - optind != 1 || (use_crop && noutputs != 1)) print_usage(1);
     file_path = argv[optind];
+    char *index_path = NULL;
+    if (use_index && asprintf(&index_path, "%s.ottdidx", file_path) < 0) index_path = NULL;
+    options.seek_index = index_path;
+    char *cache_path = NULL;
+    if (use_cache && asprintf(&cache_path, "%s.ottdmap", file_path) < 0) cache_path = NULL;
+    options.map_cache = cache_path;
+    ottd_perf_t perf = { 0 };
+    if (use_perf) options.perf = &perf;
     
     // load game
-    ottd_t *game = ottd_load(file_path, verbose);
-    if (game == NULL) fprintf(stderr, "ottd_preview: %s\n", strerror(errno));
+    ottd_error_t err;
+    ottd_t *game = ottd_open(file_path, &options, &err);
+    if (game == NULL) {
+        fprintf(stderr, "ottd_preview: %s\n", err.message);
+        status = 1;
+    }
     
     // save data
-    if (game && data_output) {
-        FILE *fp = fopen(data_output, "w");
-        for(int i=0; i < 15; i++) {
-            ottd_company_t *cmp= &game->company[i];
-            if (!cmp->active) continue;
-            png_color cc = ottd_color[ottd_company_color(cmp->color)];
-            fprintf(fp, "Company %d #%02X%02X%02X %s\n", i+1, cc.red,cc.green,cc.blue, cmp->name);
-        }
-        fprintf(fp, "# data end\n");
-        fclose(fp);
-    }
+    if (game && data_output && write_data(game, data_output)) status = 1;
+    
+    // networks
+    if (game && (networks || network_map) && print_networks(game, networks, network_map, map_mode, &options)) status = 1;
     
     // save png
-    if (game && png_output) {
-        char *modestr[] = {"nw", "ne", "iso"};
-        if (verbose) printf("writing png to %s (%s)\n", png_output, modestr[map_mode]);
-        ottd_write_png(game, png_output, map_mode);
+    const char *modestr[] = {"nw", "ne", "iso"};
+    for(int i=0; i < noutputs; i++) {
+        if (outputs[i].mode < 0) outputs[i].mode = map_mode;
+        if (game && verbose) printf("writing png to %s (%s)\n", outputs[i].path, modestr[outputs[i].mode]);
+    }
+    if (game && use_crop) {
+        crop.mode = outputs[0].mode;
+        if (ottd_write_png_viewport(game, outputs[0].path, &crop, &options, &err)) {
+            fprintf(stderr, "ottd_preview: %s\n", err.message);
+            status = 1;
+        }
+    } else if (game && noutputs && ottd_write_pngs(game, outputs, noutputs, &options, &err)) {
+        int failed = 0;
+        for(int i=0; i < noutputs; i++) {
+            if (outputs[i].err.code == OTTD_OK) continue;
+            fprintf(stderr, "ottd_preview: %s\n", outputs[i].err.message);
+            failed++;
+        }
+        if (failed == 0) fprintf(stderr, "ottd_preview: %s\n", err.message);
+        status = 1;
     }
     
-    if (verbose) {
+    if (game && verbose) {
         char yearsText[32];
-        printf("Savegame Version: %d\n", game->version);
-        snprintf(yearsText, sizeof yearsText, "%d-%d", game->startYear, game->curDate.year);
+        printf("Savegame Version: %d\n", ottd_version(game));
+        snprintf(yearsText, sizeof yearsText, "%d-%d", ottd_start_year(game), ottd_current_date(game).year);
         printf("Years: %s\n", yearsText);
         for(int i=0; i < 15; i++) {
-            ottd_company_t *cmp= &game->company[i];
+            const ottd_company_t *cmp= ottd_company(game, i);
             if (!cmp->active) continue;
             printf("Company %d: %s\n", i+1, cmp->name);
         }
     }
+    if (verbose) {
+        printf("Peak memory: %llu", (unsigned long long)memory.peak);
+        for(int i=0; i < OTTD_MEM_STAGES; i++) printf(", %s %llu", ottd_mem_stage_name(i), (unsigned long long)memory.stage[i].peak);
+        printf("\n");
+    }
+    
+    if (use_perf) {
+        print_perf(&perf);
+        ottd_perf_close(&perf);
+    }
     
     // free the memory
     ottd_free(game);
-    free(png_output);
+    for(int i=0; i < noutputs; i++) free((char*)outputs[i].path);
     free(data_output);
+    free(index_path);
+    free(cache_path);
     
-    return 0;
+done:
+    if (options.trace) {
+        ottd_error_t err;
+        if (ottd_trace_write(options.trace, trace_output, &err)) {
+            fprintf(stderr, "ottd_preview: %s\n", err.message);
+            status = 1;
+        }
+        ottd_trace_free(options.trace);
+    }
+    return status;
 }
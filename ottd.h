@@ -99,16 +99,20 @@ typedef struct YearMonthDay {
     uint8_t day;    ///< Day (1..31)
 } YearMonthDay;
 
-typedef struct {
-    uint16_t version;
+// tiles by owner and type, counted while the map is loaded
+#define OTTD_TERRITORY_OWNERS (OWNER_WATER + 1) // companies 0-14, towns, nobody and water
+typedef struct ottd_territory {
+    uint64_t tiles[OTTD_TERRITORY_OWNERS][16];  // by owner and enum TileType
     struct {
-        uint32_t x,y;
-    } mapSize;
-    ottd_company_t company[15];
-    int32_t startYear;
-    YearMonthDay curDate;
-    ottd_tile_t **tile;
-} ottd_t;
+        uint32_t x0, y0, x1, y1;                // inclusive
+    } bounds[15];                               // of each company's tiles, x0 > x1 when it has none
+} ottd_territory_t;
+
+// a loaded save, read through the accessors below. the map is kept as the raw savegame
+// planes, one byte per tile, row-major, or run-length encoded when loaded with
+// OTTD_F_RLE_MAP, when ottd_map_types and ottd_map_owners are NULL. a thumbnail load keeps
+// one tile per scale x scale cell, and ottd_map_size is the size in cells
+typedef struct ottd ottd_t;
 
 // map mode for writing png
 enum MapMode {
@@ -117,8 +121,265 @@ enum MapMode {
     OTTD_MAP_ISO    // isometric view, like openttd smallmap
 };
 
-ottd_t* ottd_load(const char *path, int verbose);
+// library api version, bumped when public structures change
+#define OTTD_API_VERSION 13
+
+// error codes
+enum ottd_status {
+    OTTD_OK = 0,
+    OTTD_E_ARG,         // invalid argument
+    OTTD_E_IO,          // could not open, read or write a file
+    OTTD_E_FORMAT,      // not a savegame, or unsupported compression
+    OTTD_E_DECOMPRESS,  // decompressor failure or corrupt compressed block
+    OTTD_E_CORRUPT,     // inconsistent chunk data
+    OTTD_E_NOMEM,       // out of memory
+    OTTD_E_ENCODE,      // image encoder failure
+    OTTD_E_CANCELLED,   // cancelled by the caller
+    OTTD_E_TIMEOUT,     // deadline expired
+    OTTD_E_BUDGET,      // would go over the memory budget
+};
+
+typedef struct ottd_error {
+    int     code;           // enum ottd_status
+    char    message[128];
+} ottd_error_t;
+
+// log levels
+enum ottd_log_level {
+    OTTD_LOG_INFO,
+    OTTD_LOG_ERROR,
+};
+
+// progress stages
+enum ottd_stage {
+    OTTD_STAGE_DECOMPRESS,  // done is decompressed bytes, total unknown (0)
+    OTTD_STAGE_LOAD,        // done/total are bytes of the savegame file consumed
+    OTTD_STAGE_RENDER,      // done/total are image rows
+    OTTD_STAGE_ANALYSIS,    // ottd_find_networks: done/total are bands labelled, then map rows numbered
+};
+
+// option flags
+enum ottd_flags {
+    OTTD_F_COARSE_FALLBACK = 1 << 0, // when the deadline expires while rendering, finish with a coarse image instead of failing
+    OTTD_F_RLE_MAP = 1 << 1, // keep the map planes run-length encoded, for huge maps of water and empty land
+    OTTD_F_HILLSHADE = 1 << 2, // colour land by height and shade every tile by its slope
+    OTTD_F_VERIFY_CACHE = 1 << 3, // check the map planes of a map cache against their checksums when opening it
+};
+
+typedef void (*ottd_log_fn)(void *ctx, int level, const char *message);
+typedef int (*ottd_write_fn)(void *ctx, const void *data, size_t len);
+typedef int (*ottd_progress_fn)(void *ctx, int stage, uint64_t done, uint64_t total); // return non-zero to cancel
+
+typedef struct ottd_trace ottd_trace_t;
+typedef struct ottd_memory ottd_memory_t;
+
+// options for loading and rendering, zero-initialise for defaults
+typedef struct ottd_options {
+    int         verbose;    // emit progress messages
+    ottd_log_fn log;        // message sink, defaults to stdout/stderr
+    void        *log_ctx;
+    int         flags;      // enum ottd_flags
+    
+    // checked once per decompressed block, chunk and rendered row
+    const volatile int *cancel; // cancel when this becomes non-zero
+    uint64_t    deadline;       // ottd_clock_ms() value to give up at, 0 for none
+    ottd_progress_fn progress;
+    void        *progress_ctx;
+    
+    // sidecar seek index for the save, used when current and rebuilt by full loads otherwise
+    const char  *seek_index;
+    // sidecar map cache, ottd_open maps it instead of decoding the save when current, and writes it otherwise
+    const char  *map_cache;
+    // hardware counters and time per stage are added to this, see ottd_perf_t
+    struct ottd_perf *perf;
+    // spans of this call are recorded here, see ottd_trace_create
+    ottd_trace_t *trace;
+    // memory of this call is charged here and checked against its budget
+    ottd_memory_t *memory;
+    // rendering threads, including the caller's, 0 for one per core
+    int         threads;
+    // load a map whose longer side is over this many tiles as a thumbnail of at most
+    // this many, streaming MAPT and MAPO without the full-size planes. 0 for full size
+    uint32_t    thumbnail;
+    // directory for a scratch file holding the map planes when they don't fit the memory
+    // budget or the heap, NULL to fail instead
+    const char  *scratch_dir;
+} ottd_options_t;
+
+// savegame metadata, filled by ottd_probe without loading the map
+typedef struct ottd_info {
+    uint32_t format;        // 'OTTD' (lzo), 'OTTN' (none), 'OTTZ' (zlib) or 'OTTX' (lzma)
+    uint16_t version;
+    struct {
+        uint32_t x,y;
+    } mapSize;
+    int32_t startYear;
+    YearMonthDay curDate;
+    struct {
+        bool    active;
+        uint8_t color;
+        char    name[64];   // truncated
+    } company[15];
+} ottd_info_t;
+
+// loading, opts and err may be NULL
+ottd_t* ottd_open(const char *path, const ottd_options_t *opts, ottd_error_t *err);
+int ottd_probe(const char *path, ottd_info_t *info, const ottd_options_t *opts, ottd_error_t *err);
+ottd_t* ottd_load(const char *path, int verbose); // sets errno on failure
 void ottd_free(ottd_t* ottd);
+int ottd_get_tile(const ottd_t *game, uint32_t x, uint32_t y, ottd_tile_t *tile);
+
+// what a load read, valid until ottd_free
+uint16_t ottd_version(const ottd_t *game);
+void ottd_map_size(const ottd_t *game, uint32_t *width, uint32_t *height);
+uint32_t ottd_map_scale(const ottd_t *game); // tiles a side per cell of a thumbnail load, 0 for full size
+int32_t ottd_start_year(const ottd_t *game);
+YearMonthDay ottd_current_date(const ottd_t *game);
+const ottd_company_t* ottd_company(const ottd_t *game, int c); // 0-14, else NULL. only active ones hold data
+const uint8_t* ottd_map_types(const ottd_t *game);  // MAPT: type << 4 | height
+const uint8_t* ottd_map_owners(const ottd_t *game); // MAPO: owner
+const ottd_territory_t* ottd_territory(const ottd_t *game); // NULL for thumbnail loads
+// renders draw color, a palette index per tile, instead of the planes until it's set back
+// to NULL. the caller keeps it, and mustn't change it while a render runs
+void ottd_set_colors(ottd_t *game, uint8_t *color);
+
+// map cache: dimensions, dates, companies and the MAPT/MAPO planes in a page-aligned,
+// checksummed file that is mapped instead of read, save_path may be NULL to skip the freshness check
+ottd_t* ottd_open_map_cache(const char *cache_path, const char *save_path, const ottd_options_t *opts, ottd_error_t *err);
+int ottd_write_map_cache(const ottd_t *game, const char *cache_path, const char *save_path, const ottd_options_t *opts, ottd_error_t *err);
+const char* ottd_strerror(int code);
+uint64_t ottd_clock_ms(void); // monotonic clock for deadlines
+
+// anatomy: what each chunk tag costs, accumulated over any number of saves
+typedef struct ottd_anatomy_chunk {
+    uint32_t tag;
+    uint8_t  type;          // as last seen: 0 riff, 1 array, 2 sparse array, 3 table, 4 sparse table
+    uint32_t count;         // occurrences, 0 for known chunks not seen yet
+    uint64_t elements;      // non-empty array and table elements
+    uint64_t bytes;         // decompressed, with chunk headers
+    uint64_t compressed;    // share of each compressed block, by the decompressed bytes it holds
+    uint64_t time_ns;       // reading or skipping the chunk, decompression included
+} ottd_anatomy_chunk_t;
+
+typedef struct ottd_anatomy {
+    uint32_t files;
+    uint64_t file_bytes;    // on disk
+    uint64_t bytes;         // decompressed
+    uint64_t time_ns;
+    int      nchunks;
+    ottd_anatomy_chunk_t *chunks;
+} ottd_anatomy_t;
+
+// loads a save walking every chunk and adds it to anatomy, which starts zero-initialised.
+// nothing is added for a save that fails to load
+int ottd_anatomy_add(ottd_anatomy_t *anatomy, const char *path, const ottd_options_t *opts, ottd_error_t *err);
+void ottd_anatomy_free(ottd_anatomy_t *anatomy);
+
+// stage counters: time, and where perf_event_open is permitted cycles, instructions, cache
+// and branch misses of the calling thread, accumulated over every call given the same ottd_perf_t
+enum ottd_perf_stage {
+    OTTD_PERF_DECOMPRESS,   // decoding compressed blocks
+    OTTD_PERF_PARSE,        // chunk headers, metadata chunks and skipping
+    OTTD_PERF_MAP,          // MAPT and MAPO into the map planes
+    OTTD_PERF_COLOR,        // tiles to palette indexes
+    OTTD_PERF_ENCODE,       // png compression and output
+    OTTD_PERF_NETWORK,      // ottd_find_networks
+    OTTD_PERF_STAGES
+};
+
+enum ottd_perf_counter {
+    OTTD_PERF_CYCLES,
+    OTTD_PERF_INSTRUCTIONS,
+    OTTD_PERF_CACHE_MISSES,
+    OTTD_PERF_BRANCH_MISSES,
+    OTTD_PERF_COUNTERS
+};
+
+typedef struct ottd_perf {
+    int      available;     // bit per counter that could be opened, set by the first call
+    struct {
+        uint64_t time_ns;
+        uint64_t count[OTTD_PERF_COUNTERS];
+    } stage[OTTD_PERF_STAGES];
+    
+    // private, zero-initialise
+    int      opened, group, current;
+    int      fd[OTTD_PERF_COUNTERS];
+    uint64_t last[OTTD_PERF_COUNTERS], last_ns;
+} ottd_perf_t;
+
+void ottd_perf_close(ottd_perf_t *perf); // releases the counters, the totals stay
+const char* ottd_perf_stage_name(int stage);
+
+// memory accounting: current and peak bytes per stage, shared by any number of calls and threads.
+// with a budget, map planes, decompression buffers and the lzma dictionary are checked before
+// they're allocated, and a load that would go over fails early with OTTD_E_BUDGET
+enum ottd_mem_stage {
+    OTTD_MEM_DECOMPRESS,    // stream buffers and decoder state
+    OTTD_MEM_MAP,           // map planes, until ottd_free
+    OTTD_MEM_RENDER,        // strip buffers and png encoder
+    OTTD_MEM_ANALYSIS,      // network labels, until ottd_networks_free
+    OTTD_MEM_STAGES
+};
+
+struct ottd_memory {
+    uint64_t budget;        // bytes, 0 for no limit
+    uint64_t current, peak;
+    struct {
+        uint64_t current, peak;
+    } stage[OTTD_MEM_STAGES];
+};
+
+const char* ottd_mem_stage_name(int stage);
+
+// trace: spans of file loads, decompressed blocks, chunks, render strips and png output,
+// kept in a ring buffer per recording thread and written as Chrome/Perfetto trace-event json.
+// a trace can be shared by any number of threads, but must not be written or freed while they record
+ottd_trace_t* ottd_trace_create(size_t events_per_thread); // 0 for the default, older events are dropped when it fills
+int ottd_trace_write(ottd_trace_t *trace, const char *path, ottd_error_t *err);
+void ottd_trace_free(ottd_trace_t *trace);
+
+// catalog: an index file of probed savegames, memory-mapped for queries
+typedef struct ottd_catalog ottd_catalog_t;
+typedef struct ottd_catalog_record {
+    uint64_t size;          // file size and modification time, to detect changes
+    int64_t  mtime;         // nanoseconds
+    uint64_t hash;          // 64-bit FNV-1a of the file contents
+    uint32_t path;          // string table offsets, see ottd_catalog_string
+    uint32_t format;
+    uint16_t version;
+    uint16_t companies;     // bitmask of active companies
+    struct {
+        uint32_t x,y;
+    } mapSize;
+    int32_t startYear;
+    YearMonthDay curDate;
+    struct {
+        uint32_t name;
+        uint8_t  color;
+    } company[15];
+} ottd_catalog_record_t;
+
+// query: comma-separated conditions like "map>=2048,year>2000"
+// fields: version width height map (smaller side) tiles start year companies bytes
+// operators: < <= > >= = !=
+typedef struct ottd_query {
+    int count;
+    struct {
+        int field, op;
+        int64_t value;
+    } cond[16];
+} ottd_query_t;
+
+int ottd_catalog_update(const char *index_path, const char * const *dirs, int ndirs, const ottd_options_t *opts, ottd_error_t *err);
+ottd_catalog_t* ottd_catalog_open(const char *index_path, ottd_error_t *err);
+void ottd_catalog_close(ottd_catalog_t *cat);
+size_t ottd_catalog_count(const ottd_catalog_t *cat);
+const ottd_catalog_record_t* ottd_catalog_record(const ottd_catalog_t *cat, size_t i);
+const ottd_catalog_record_t* ottd_catalog_find(const ottd_catalog_t *cat, const char *path);
+const char* ottd_catalog_string(const ottd_catalog_t *cat, uint32_t offset);
+int ottd_query_parse(ottd_query_t *query, const char *expr, ottd_error_t *err);
+bool ottd_query_match(const ottd_query_t *query, const ottd_catalog_record_t *rec);
 
 // colors everywhere
 
@@ -132,11 +393,81 @@ enum SmallMapColour {
     SM_COLOUR_OBJECT    = 92
 };
 
-extern png_color ottd_color[256];
+extern const png_color ottd_color[256];
 uint8_t ottd_tile_color(const ottd_t *game, const ottd_tile_t *tile);
+uint8_t ottd_plane_color(const ottd_t *game, uint8_t mapt, uint8_t mapo);
 int ottd_company_color(int c);
+
+// rendering into caller buffers, rows stride bytes apart. ottd_render_rows and
+// ottd_render_image write OTTD_PIXEL_INDEXED
+enum ottd_pixel_format {
+    OTTD_PIXEL_INDEXED,     // one ottd_color index per pixel
+    OTTD_PIXEL_RGBA,        // red, green, blue, alpha bytes, alpha always 0xFF
+};
+
+int ottd_image_size(const ottd_t *game, int mode, int *width, int *height);
+int ottd_pixel_size(int format);
+int ottd_render_rows(const ottd_t *game, int mode, int y, int rows, uint8_t *buf, size_t stride);
+int ottd_render_image(const ottd_t *game, int mode, uint8_t *buf, size_t stride, const ottd_options_t *opts, ottd_error_t *err);
+int ottd_render_pixels(const ottd_t *game, int mode, int format, uint8_t *buf, size_t stride, const ottd_options_t *opts, ottd_error_t *err);
+
+// a rendered image in its own buffer, filled by bands of rows on a thread per core (see threads in ottd_options_t)
+typedef struct ottd_view {
+    int     mode, format;
+    int     width, height;
+    size_t  stride;
+    uint8_t *pixels;
+    ottd_memory_t *memory;  // charged for pixels, or NULL
+} ottd_view_t;
+
+int ottd_render(const ottd_t *game, int mode, int format, ottd_view_t *view, const ottd_options_t *opts, ottd_error_t *err);
+void ottd_view_free(ottd_view_t *view);
+
+// a rectangle of map tiles in one orientation, drawn without rendering the rest of the map.
+// nw and ne show exactly those tiles, iso the rows and columns their diamond spans
+typedef struct ottd_viewport {
+    int      mode;          // enum MapMode
+    uint32_t x, y, w, h;    // tiles, clipped to the map
+    int      zoom;          // n > 1 draws pixels as n x n blocks, n < -1 keeps every -n-th pixel, else 1:1
+} ottd_viewport_t;
+
+int ottd_viewport_size(const ottd_t *game, const ottd_viewport_t *vp, int *width, int *height);
+int ottd_render_viewport(const ottd_t *game, const ottd_viewport_t *vp, int format, uint8_t *buf, size_t stride, const ottd_options_t *opts, ottd_error_t *err);
+
+// networks: a company's rail, road, station, tunnel and bridge tiles that touch along an
+// edge. tunnels and bridges don't join their two ends, only the tiles next to each of them
+typedef struct ottd_network {
+    int      owner;         // company
+    uint32_t id;            // label of its tiles, its index + 1
+    uint64_t tiles;
+    uint32_t x0, y0, x1, y1; // bounding box, inclusive
+} ottd_network_t;
+
+typedef struct ottd_networks {
+    uint32_t count;
+    ottd_network_t *network; // by company, largest first
+    uint32_t companies[15]; // networks of each company
+    uint32_t width, height;
+    uint32_t *labels;       // network id of each tile, 0 for none, row-major. NULL unless asked for
+    struct ottd_memory *memory; // the labels are charged to this, or NULL
+} ottd_networks_t;
+
+// labels is non-zero to keep the label of every tile
+int ottd_find_networks(const ottd_t *game, ottd_networks_t *nets, int labels, const ottd_options_t *opts, ottd_error_t *err);
+void ottd_networks_free(ottd_networks_t *nets);
 #ifdef HAVE_LIBPNG
-int ottd_write_png(const ottd_t *game, const char *png_path, int mode);
+int ottd_write_png(const ottd_t *game, const char *png_path, int mode, const ottd_options_t *opts, ottd_error_t *err);
+int ottd_write_png_fn(const ottd_t *game, int mode, ottd_write_fn write, void *ctx, const ottd_options_t *opts, ottd_error_t *err);
+// one image of ottd_write_pngs
+typedef struct ottd_output {
+    int         mode;       // enum MapMode
+    const char  *path;
+    int         size;       // longest side in pixels, larger images are shrunk by sampling. 0 for full size
+    ottd_error_t err;       // of this image
+} ottd_output_t;
+
+int ottd_write_pngs(const ottd_t *game, ottd_output_t *outputs, int count, const ottd_options_t *opts, ottd_error_t *err);
+int ottd_write_png_viewport(const ottd_t *game, const char *png_path, const ottd_viewport_t *vp, const ottd_options_t *opts, ottd_error_t *err);
 #endif
 
 // date functions
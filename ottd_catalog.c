@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "ottd_internal.h"
+
+// index file layout: header, sorted records, string table
+// everything is in host byte order, OTTD_CATALOG_MAGIC doubles as a byte order mark
+
+#define OTTD_CATALOG_MAGIC      'OTCI'
+#define OTTD_CATALOG_VERSION    1
+
+typedef struct ottd_catalog_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t count;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+} ottd_catalog_header_t;
+
+struct ottd_catalog {
+    void        *map;
+    size_t      map_size;
+    const ottd_catalog_header_t *header;
+    const ottd_catalog_record_t *records;
+    const char  *strings;
+};
+
+#pragma mark - Reading
+
+ottd_catalog_t* ottd_catalog_open(const char *path, ottd_error_t *err)
+{
+    ottd_ctx_t ctx_, *ctx = &ctx_;
+    ottd_ctx_init(ctx, NULL, err);
+    struct stat st;
+    ottd_catalog_t *cat = NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        ottd_error(ctx, OTTD_E_IO, "%s: %s", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) || st.st_size < sizeof(ottd_catalog_header_t)) {
+        ottd_error(ctx, OTTD_E_FORMAT, "%s: not a catalog", path);
+        goto fail;
+    }
+
+    cat = calloc(1, sizeof *cat);
+    if (cat == NULL) {
+        ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+        goto fail;
+    }
+    cat->map_size = st.st_size;
+    cat->map = mmap(NULL, cat->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (cat->map == MAP_FAILED) {
+        cat->map = NULL;
+        ottd_error(ctx, OTTD_E_IO, "%s: mmap: %s", path, strerror(errno));
+        goto fail;
+    }
+    close(fd); fd = -1;
+
+    // validate
+    const ottd_catalog_header_t *h = cat->map;
+    if (h->magic != OTTD_CATALOG_MAGIC || h->version != OTTD_CATALOG_VERSION || h->record_size != sizeof(ottd_catalog_record_t) ||
+        sizeof *h + (uint64_t)h->count * h->record_size > h->strings_offset ||
+        h->strings_offset + h->strings_size > cat->map_size) {
+        ottd_error(ctx, OTTD_E_FORMAT, "%s: not a catalog or wrong version", path);
+        goto fail;
+    }
+    cat->header = h;
+    cat->records = (const ottd_catalog_record_t*)(h + 1);
+    cat->strings = (const char*)cat->map + h->strings_offset;
+    return cat;
+
+fail:
+    if (fd >= 0) close(fd);
+    ottd_catalog_close(cat);
+    return NULL;
+}
+
+void ottd_catalog_close(ottd_catalog_t *cat)
+{
+    if (cat == NULL) return;
+    if (cat->map) munmap(cat->map, cat->map_size);
+    free(cat);
+}
+
+size_t ottd_catalog_count(const ottd_catalog_t *cat)
+{
+    return cat->header->count;
+}
+
+const ottd_catalog_record_t* ottd_catalog_record(const ottd_catalog_t *cat, size_t i)
+{
+    if (i >= cat->header->count) return NULL;
+    return &cat->records[i];
+}
+
+const char* ottd_catalog_string(const ottd_catalog_t *cat, uint32_t offset)
+{
+    if (offset >= cat->header->strings_size) return "";
+    return cat->strings + offset;
+}
+
+static int ottd_catalog_record_cmp(const void *key, const void *val)
+{
+    const ottd_catalog_t *cat = ((const void**)key)[0];
+    const char *path = ((const void**)key)[1];
+    return strcmp(path, ottd_catalog_string(cat, ((const ottd_catalog_record_t*)val)->path));
+}
+
+const ottd_catalog_record_t* ottd_catalog_find(const ottd_catalog_t *cat, const char *path)
+{
+    const void *key[2] = { cat, path };
+    return bsearch(key, cat->records, cat->header->count, sizeof(ottd_catalog_record_t), ottd_catalog_record_cmp);
+}
+
+#pragma mark - Queries
+
+enum {
+    Q_VERSION, Q_WIDTH, Q_HEIGHT, Q_MAP, Q_TILES, Q_START, Q_YEAR, Q_COMPANIES, Q_BYTES,
+};
+
+static const char *ottd_query_fields[] = {
+    [Q_VERSION] = "version", [Q_WIDTH] = "width", [Q_HEIGHT] = "height", [Q_MAP] = "map", [Q_TILES] = "tiles",
+    [Q_START] = "start", [Q_YEAR] = "year", [Q_COMPANIES] = "companies", [Q_BYTES] = "bytes",
+};
+
+enum { Q_LT, Q_LE, Q_GT, Q_GE, Q_EQ, Q_NE };
+
+static int64_t ottd_query_value(const ottd_catalog_record_t *rec, int field)
+{
+    switch(field) {
+        case Q_VERSION:     return rec->version;
+        case Q_WIDTH:       return rec->mapSize.x;
+        case Q_HEIGHT:      return rec->mapSize.y;
+        case Q_MAP:         return (rec->mapSize.x < rec->mapSize.y)? rec->mapSize.x : rec->mapSize.y;
+        case Q_TILES:       return (int64_t)rec->mapSize.x * rec->mapSize.y;
+        case Q_START:       return rec->startYear;
+        case Q_YEAR:        return rec->curDate.year;
+        case Q_COMPANIES:   return __builtin_popcount(rec->companies);
+        case Q_BYTES:       return rec->size;
+    }
+    return 0;
+}
+
+int ottd_query_parse(ottd_query_t *query, const char *expr, ottd_error_t *err)
+{
+    ottd_ctx_t ctx_, *ctx = &ctx_;
+    ottd_ctx_init(ctx, NULL, err);
+    query->count = 0;
+
+    const char *p = expr;
+    while(*p) {
+        while(*p == ' ' || *p == ',') p++;
+        if (*p == '\0') break;
+        if (query->count == lengthof(query->cond)) return ottd_error(ctx, OTTD_E_ARG, "too many conditions");
+
+        // field
+        size_t flen = strcspn(p, "<>=!, ");
+        int field = -1;
+        for(int i=0; i < lengthof(ottd_query_fields); i++) {
+            if (strlen(ottd_query_fields[i]) == flen && strncasecmp(p, ottd_query_fields[i], flen) == 0) field = i;
+        }
+        if (field < 0) return ottd_error(ctx, OTTD_E_ARG, "unknown field: %.*s", (int)flen, p);
+        p += flen;
+        while(*p == ' ') p++;
+
+        // operator
+        int op;
+        if (strncmp(p, "<=", 2) == 0) { op = Q_LE; p += 2; }
+        else if (strncmp(p, ">=", 2) == 0) { op = Q_GE; p += 2; }
+        else if (strncmp(p, "!=", 2) == 0) { op = Q_NE; p += 2; }
+        else if (strncmp(p, "==", 2) == 0) { op = Q_EQ; p += 2; }
+        else if (*p == '<') { op = Q_LT; p++; }
+        else if (*p == '>') { op = Q_GT; p++; }
+        else if (*p == '=') { op = Q_EQ; p++; }
+        else return ottd_error(ctx, OTTD_E_ARG, "expected operator after %s", ottd_query_fields[field]);
+
+        // value
+        char *end;
+        long long value = strtoll(p, &end, 10);
+        if (end == p) return ottd_error(ctx, OTTD_E_ARG, "expected number after %s", ottd_query_fields[field]);
+        p = end;
+
+        query->cond[query->count].field = field;
+        query->cond[query->count].op = op;
+        query->cond[query->count].value = value;
+        query->count++;
+    }
+    return 0;
+}
+
+bool ottd_query_match(const ottd_query_t *query, const ottd_catalog_record_t *rec)
+{
+    for(int i=0; i < query->count; i++) {
+        int64_t v = ottd_query_value(rec, query->cond[i].field), q = query->cond[i].value;
+        bool ok;
+        switch(query->cond[i].op) {
+            case Q_LT: ok = v < q; break;
+            case Q_LE: ok = v <= q; break;
+            case Q_GT: ok = v > q; break;
+            case Q_GE: ok = v >= q; break;
+            case Q_EQ: ok = v == q; break;
+            default:   ok = v != q; break;
+        }
+        if (!ok) return false;
+    }
+    return true;
+}
+
+#pragma mark - Building
+
+typedef struct ottd_catalog_builder {
+    ottd_catalog_record_t *records;
+    size_t count, alloc;
+    char *strings;
+    size_t strings_size, strings_alloc;
+    const ottd_catalog_t *old;
+    const ottd_options_t *opts;
+    unsigned probed, reused, failed;
+    int nomem;
+} ottd_catalog_builder_t;
+
+static uint32_t ottd_catalog_intern(ottd_catalog_builder_t *b, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    if (b->strings_size + len > b->strings_alloc) {
+        size_t alloc = b->strings_alloc? b->strings_alloc * 2 : 64 * 1024;
+        while(alloc < b->strings_size + len) alloc *= 2;
+        char *strings = realloc(b->strings, alloc);
+        if (strings == NULL) {
+            b->nomem = 1;
+            return 0;
+        }
+        b->strings = strings;
+        b->strings_alloc = alloc;
+    }
+    memcpy(b->strings + b->strings_size, str, len);
+    b->strings_size += len;
+    return (uint32_t)(b->strings_size - len);
+}
+
+// 64-bit FNV-1a of the whole file
+static int ottd_catalog_hash(const char *path, uint64_t *hash)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return -1;
+    uint8_t buf[64 * 1024];
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t br;
+    while((br = fread(buf, 1, sizeof buf, fp)) > 0) {
+        for(size_t i=0; i < br; i++) h = (h ^ buf[i]) * 0x100000001b3ULL;
+    }
+    int ret = ferror(fp)? -1 : 0;
+    fclose(fp);
+    *hash = h;
+    return ret;
+}
+
+static int ottd_catalog_add(ottd_catalog_builder_t *b, const char *path, const struct stat *st)
+{
+    ottd_catalog_record_t rec;
+    const ottd_catalog_record_t *old = b->old? ottd_catalog_find(b->old, path) : NULL;
+
+    if (b->count == b->alloc) {
+        size_t alloc = b->alloc? b->alloc * 2 : 1024;
+        ottd_catalog_record_t *records = realloc(b->records, alloc * sizeof *records);
+        if (records == NULL) return -1;
+        b->records = records;
+        b->alloc = alloc;
+    }
+
+    if (old && old->size == st->st_size && old->mtime == ottd_mtime_ns(st)) {
+        // unchanged, copy the record and its strings
+        rec = *old;
+        rec.path = ottd_catalog_intern(b, path);
+        for(int i=0; i < 15; i++) {
+            if (rec.companies & (1 << i)) rec.company[i].name = ottd_catalog_intern(b, ottd_catalog_string(b->old, old->company[i].name));
+        }
+        b->reused++;
+    } else {
+        ottd_info_t info;
+        if (ottd_probe(path, &info, b->opts, NULL) || ottd_catalog_hash(path, &rec.hash)) {
+            b->failed++;
+            return 0;
+        }
+        rec.size = st->st_size;
+        rec.mtime = ottd_mtime_ns(st);
+        rec.path = ottd_catalog_intern(b, path);
+        rec.format = info.format;
+        rec.version = info.version;
+        rec.mapSize.x = info.mapSize.x;
+        rec.mapSize.y = info.mapSize.y;
+        rec.startYear = info.startYear;
+        rec.curDate = info.curDate;
+        rec.companies = 0;
+        for(int i=0; i < 15; i++) {
+            rec.company[i].color = info.company[i].color;
+            rec.company[i].name = 0;
+            if (!info.company[i].active) continue;
+            rec.companies |= 1 << i;
+            rec.company[i].name = ottd_catalog_intern(b, info.company[i].name);
+        }
+        b->probed++;
+    }
+    if (b->nomem) return -1;
+    b->records[b->count++] = rec;
+    return 0;
+}
+
+static int ottd_catalog_has_save_ext(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    return ext && (strcasecmp(ext, ".sav") == 0 || strcasecmp(ext, ".scn") == 0);
+}
+
+static int ottd_catalog_scan(ottd_catalog_builder_t *b, ottd_ctx_t *ctx, const char *dir)
+{
+    DIR *dp = opendir(dir);
+    if (dp == NULL) return ottd_error(ctx, OTTD_E_IO, "%s: %s", dir, strerror(errno));
+    struct dirent *de;
+    int ret = 0;
+    while(ret == 0 && (de = readdir(dp))) {
+        if (de->d_name[0] == '.') continue;
+        char *path;
+        if (asprintf(&path, "%s/%s", dir, de->d_name) < 0) {
+            ret = ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+            break;
+        }
+        struct stat st;
+        if (stat(path, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                ret = ottd_catalog_scan(b, ctx, path);
+            } else if (S_ISREG(st.st_mode) && ottd_catalog_has_save_ext(de->d_name)) {
+                if (ottd_catalog_add(b, path, &st)) ret = ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+                else if (ottd_check(ctx, OTTD_STAGE_LOAD, b->count, 0)) ret = -1;
+            }
+        }
+        free(path);
+    }
+    closedir(dp);
+    return ret;
+}
+
+typedef struct ottd_catalog_sort {
+    const char *path;
+    const ottd_catalog_record_t *rec;
+} ottd_catalog_sort_t;
+
+static int ottd_catalog_sort_cmp(const void *a, const void *b)
+{
+    return strcmp(((const ottd_catalog_sort_t*)a)->path, ((const ottd_catalog_sort_t*)b)->path);
+}
+
+int ottd_catalog_update(const char *index_path, const char * const *dirs, int ndirs, const ottd_options_t *opts, ottd_error_t *err)
+{
+    ottd_ctx_t ctx_, *ctx = &ctx_;
+    ottd_ctx_init(ctx, opts, err);
+    ottd_catalog_builder_t b = { .opts = opts };
+    ottd_catalog_sort_t *sorted = NULL;
+    char *tmp_path = NULL;
+    FILE *fp = NULL;
+    int ret = -1;
+
+    // previous index, if any
+    if (access(index_path, F_OK) == 0) {
+        b.old = ottd_catalog_open(index_path, ctx->err);
+        if (b.old == NULL) goto end;
+    }
+
+    // scan
+    ottd_catalog_intern(&b, "");
+    if (b.nomem) {
+        ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+        goto end;
+    }
+    for(int i=0; i < ndirs; i++) {
+        if (ottd_catalog_scan(&b, ctx, dirs[i])) goto end;
+    }
+    Vprintf("catalog: %u probed, %u unchanged, %u failed\n", b.probed, b.reused, b.failed);
+
+    // sort by path for lookups
+    sorted = malloc((b.count + 1) * sizeof *sorted);
+    if (sorted == NULL) {
+        ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+        goto end;
+    }
+    for(size_t i=0; i < b.count; i++) {
+        sorted[i].path = b.strings + b.records[i].path;
+        sorted[i].rec = &b.records[i];
+    }
+    qsort(sorted, b.count, sizeof *sorted, ottd_catalog_sort_cmp);
+
+    // write to a temporary file and move it into place
+    if (asprintf(&tmp_path, "%s.tmp", index_path) < 0) {
+        tmp_path = NULL;
+        ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+        goto end;
+    }
+    fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        ottd_error(ctx, OTTD_E_IO, "%s: %s", tmp_path, strerror(errno));
+        goto end;
+    }
+    ottd_catalog_header_t header = {
+        .magic = OTTD_CATALOG_MAGIC,
+        .version = OTTD_CATALOG_VERSION,
+        .record_size = sizeof(ottd_catalog_record_t),
+        .count = (uint32_t)b.count,
+        .strings_offset = sizeof header + b.count * sizeof(ottd_catalog_record_t),
+        .strings_size = b.strings_size,
+    };
+    int failed = fwrite(&header, sizeof header, 1, fp) != 1;
+    for(size_t i=0; i < b.count && !failed; i++) failed = fwrite(sorted[i].rec, sizeof *b.records, 1, fp) != 1;
+    if (!failed) failed = fwrite(b.strings, 1, b.strings_size, fp) != b.strings_size;
+    if (fclose(fp)) failed = 1;
+    fp = NULL;
+    if (failed) {
+        ottd_error(ctx, OTTD_E_IO, "%s: %s", tmp_path, strerror(errno));
+        unlink(tmp_path);
+        goto end;
+    }
+    if (rename(tmp_path, index_path)) {
+        ottd_error(ctx, OTTD_E_IO, "%s: %s", index_path, strerror(errno));
+        unlink(tmp_path);
+        goto end;
+    }
+    ret = 0;
+
+end:
+    if (fp) fclose(fp);
+    free(tmp_path);
+    ottd_catalog_close((ottd_catalog_t*)b.old);
+    free(sorted);
+    free(b.records);
+    free(b.strings);
+    return ret;
+}
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "ottd_internal.h"
+
+// index file layout: header, re-encoded data (if any), chunk table, points, windows
+// host byte order, the magic doubles as a byte order mark
+
+#define OTTD_INDEX_MAGIC    'OTSK'
+#define OTTD_INDEX_VERSION  1
+
+typedef struct ottd_index_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format;            // of the save
+    uint32_t span;
+    uint64_t source_size;       // fingerprint of the save
+    int64_t  source_mtime;
+    uint64_t data_offset, data_size;
+    uint64_t chunks_offset;
+    uint64_t points_offset;
+    uint64_t windows_offset;
+    uint32_t nchunks, npoints;
+} ottd_index_header_t;
+
+#pragma mark - Reading
+
+ottd_index_t* ottd_index_open(const char *path, uint32_t format, const struct stat *source, ottd_ctx_t *ctx)
+{
+    ottd_index_header_t h;
+    ottd_index_t *idx = calloc(1, sizeof *idx);
+    if (idx == NULL) return NULL;
+    idx->fp = fopen(path, "rb");
+    if (idx->fp == NULL) goto fail;
+    if (fread(&h, sizeof h, 1, idx->fp) != 1 || h.magic != OTTD_INDEX_MAGIC || h.version != OTTD_INDEX_VERSION) {
+        Vprintf("%s: not a seek index\n", path);
+        goto fail;
+    }
+    if (h.format != format || h.span != OTTD_INDEX_SPAN || h.source_size != source->st_size || h.source_mtime != ottd_mtime_ns(source)) {
+        Vprintf("%s: seek index is stale\n", path);
+        goto fail;
+    }
+
+    idx->format = format;
+    idx->nchunks = h.nchunks;
+    idx->npoints = h.npoints;
+    idx->data_offset = h.data_offset;
+    idx->data_size = h.data_size;
+    idx->windows_offset = h.windows_offset;
+    idx->chunks = malloc(h.nchunks * sizeof *idx->chunks + 1);
+    idx->points = malloc(h.npoints * sizeof *idx->points + 1);
+    if (idx->chunks == NULL || idx->points == NULL ||
+        fseeko(idx->fp, h.chunks_offset, SEEK_SET) || fread(idx->chunks, sizeof *idx->chunks, h.nchunks, idx->fp) != h.nchunks ||
+        fseeko(idx->fp, h.points_offset, SEEK_SET) || fread(idx->points, sizeof *idx->points, h.npoints, idx->fp) != h.npoints) {
+        Vprintf("%s: truncated seek index\n", path);
+        goto fail;
+    }
+    Vprintf("using seek index: %u chunks, %u points\n", idx->nchunks, idx->npoints);
+    return idx;
+
+fail:
+    ottd_index_free(idx);
+    return NULL;
+}
+
+// last point at or before offset
+const ottd_index_point_t* ottd_index_find(const ottd_index_t *idx, uint64_t offset)
+{
+    uint32_t lo = 0, hi = idx->npoints;
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (idx->points[mid].out <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo? &idx->points[lo - 1] : NULL;
+}
+
+int ottd_index_window(const ottd_index_t *idx, const ottd_index_point_t *pt, uint8_t *window)
+{
+    off_t off = idx->windows_offset + (off_t)pt->window * OTTD_INDEX_WINDOW;
+    return (pread(fileno(idx->fp), window, OTTD_INDEX_WINDOW, off) == OTTD_INDEX_WINDOW)? 0 : -1;
+}
+
+void ottd_index_free(ottd_index_t *idx)
+{
+    if (idx == NULL) return;
+    if (idx->encoder) {
+        deflateEnd(idx->encoder);
+        free(idx->encoder);
+    }
+    if (idx->fp) fclose(idx->fp);
+    if (idx->tmp_path) unlink(idx->tmp_path);
+    free(idx->tmp_path);
+    free(idx->path);
+    free(idx->chunks);
+    free(idx->points);
+    free(idx->windows);
+    free(idx);
+}
+
+#pragma mark - Building
+
+// starts a new index, filled in while the save is loaded and written by ottd_index_commit
+ottd_index_t* ottd_index_create(const char *path, uint32_t format, const struct stat *source, ottd_ctx_t *ctx)
+{
+    ottd_index_t *idx = calloc(1, sizeof *idx);
+    if (idx == NULL) return NULL;
+    idx->building = 1;
+    idx->format = format;
+    idx->source_size = source->st_size;
+    idx->source_mtime = ottd_mtime_ns(source);
+    idx->path = strdup(path);
+    if (idx->path == NULL || asprintf(&idx->tmp_path, "%s.tmp", path) < 0) {
+        idx->tmp_path = NULL;
+        goto fail;
+    }
+    idx->fp = fopen(idx->tmp_path, "wb");
+    if (idx->fp == NULL) {
+        Veprintf("%s: %s\n", idx->tmp_path, strerror(errno));
+        goto fail;
+    }
+
+    // header is written last
+    ottd_index_header_t h = { 0 };
+    if (fwrite(&h, sizeof h, 1, idx->fp) != 1) goto fail;
+    idx->data_offset = sizeof h;
+
+    // zlib saves can be resumed in place, lzo and lzma are re-encoded
+    if (format == 'OTTD' || format == 'OTTX') {
+        z_stream *z = calloc(1, sizeof *z);
+        if (z == NULL) goto fail;
+        if (deflateInit2(z, Z_BEST_SPEED, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(z);
+            goto fail;
+        }
+        idx->encoder = z;
+        idx->encoding = 1;
+    }
+    Vprintf("building seek index %s\n", path);
+    return idx;
+
+fail:
+    ottd_index_free(idx);
+    return NULL;
+}
+
+int ottd_index_add_chunk(ottd_index_t *idx, uint32_t tag, uint64_t offset)
+{
+    if (idx->nchunks == idx->chunks_alloc) {
+        uint32_t alloc = idx->chunks_alloc? idx->chunks_alloc * 2 : 128;
+        ottd_index_chunk_t *chunks = realloc(idx->chunks, alloc * sizeof *chunks);
+        if (chunks == NULL) return idx->failed = -1;
+        idx->chunks = chunks;
+        idx->chunks_alloc = alloc;
+    }
+    idx->chunks[idx->nchunks++] = (ottd_index_chunk_t){ .tag = tag, .offset = offset };
+    return 0;
+}
+
+int ottd_index_add_point(ottd_index_t *idx, uint64_t out, uint64_t in, int bits, int with_window)
+{
+    if (idx->npoints == idx->points_alloc) {
+        uint32_t alloc = idx->points_alloc? idx->points_alloc * 2 : 64;
+        ottd_index_point_t *points = realloc(idx->points, alloc * sizeof *points);
+        if (points == NULL) return idx->failed = -1;
+        idx->points = points;
+        idx->points_alloc = alloc;
+        if (!idx->encoding) {
+            uint8_t *windows = realloc(idx->windows, (size_t)alloc * OTTD_INDEX_WINDOW);
+            if (windows == NULL) return idx->failed = -1;
+            idx->windows = windows;
+        }
+    }
+    ottd_index_point_t *pt = &idx->points[idx->npoints];
+    memset(pt, 0, sizeof *pt);
+    pt->out = out;
+    pt->in = in;
+    pt->bits = bits;
+    pt->window = OTTD_INDEX_NO_WINDOW;
+    if (with_window) {
+        // unroll the ring
+        uint8_t *window = idx->windows + (size_t)idx->npoints * OTTD_INDEX_WINDOW;
+        size_t head = idx->ring_total % OTTD_INDEX_WINDOW;
+        memcpy(window, idx->ring + head, OTTD_INDEX_WINDOW - head);
+        memcpy(window + OTTD_INDEX_WINDOW - head, idx->ring, head);
+        pt->window = idx->npoints;
+    }
+    idx->npoints++;
+    idx->last = out;
+    return 0;
+}
+
+// keeps the last 32K of decompressed output for the next point
+void ottd_index_track(ottd_index_t *idx, const uint8_t *data, size_t len)
+{
+    if (len >= OTTD_INDEX_WINDOW) {
+        data += len - OTTD_INDEX_WINDOW;
+        idx->ring_total += len - OTTD_INDEX_WINDOW;
+        len = OTTD_INDEX_WINDOW;
+    }
+    while(len) {
+        size_t head = idx->ring_total % OTTD_INDEX_WINDOW;
+        size_t n = OTTD_INDEX_WINDOW - head;
+        if (n > len) n = len;
+        memcpy(idx->ring + head, data, n);
+        idx->ring_total += n;
+        data += n;
+        len -= n;
+    }
+}
+
+static int ottd_index_deflate(ottd_index_t *idx, int flush)
+{
+    z_stream *z = idx->encoder;
+    uint8_t out[16 * 1024];
+    do {
+        z->next_out = out;
+        z->avail_out = sizeof out;
+        if (deflate(z, flush) == Z_STREAM_ERROR) return -1;
+        size_t have = sizeof out - z->avail_out;
+        if (have && fwrite(out, 1, have, idx->fp) != have) return -1;
+        idx->data_size += have;
+    } while(z->avail_out == 0);
+    return 0;
+}
+
+// re-encodes decompressed data, with a full flush every OTTD_INDEX_SPAN bytes
+int ottd_index_feed(ottd_index_t *idx, const uint8_t *data, size_t len)
+{
+    if (idx->failed) return -1;
+    z_stream *z = idx->encoder;
+    while(len) {
+        size_t n = OTTD_INDEX_SPAN - (idx->fed - idx->last);
+        if (n > len) n = len;
+        z->next_in = (uint8_t*)data;
+        z->avail_in = (uInt)n;
+        idx->fed += n;
+        data += n;
+        len -= n;
+        int flush = (idx->fed - idx->last == OTTD_INDEX_SPAN)? Z_FULL_FLUSH : Z_NO_FLUSH;
+        if (ottd_index_deflate(idx, flush)) return idx->failed = -1;
+        if (flush == Z_FULL_FLUSH && ottd_index_add_point(idx, idx->fed, idx->data_size, 0, 0)) return -1;
+    }
+    return 0;
+}
+
+// writes the tables and moves the index into place, the index can't be used afterwards
+int ottd_index_commit(ottd_index_t *idx, ottd_ctx_t *ctx)
+{
+    if (idx->failed) goto fail;
+    if (idx->encoding && ottd_index_deflate(idx, Z_FINISH)) goto fail;
+
+    ottd_index_header_t h = {
+        .magic = OTTD_INDEX_MAGIC,
+        .version = OTTD_INDEX_VERSION,
+        .format = idx->format,
+        .span = OTTD_INDEX_SPAN,
+        .source_size = idx->source_size,
+        .source_mtime = idx->source_mtime,
+        .data_offset = idx->encoding? idx->data_offset : 0,
+        .data_size = idx->encoding? idx->data_size : 0,
+        .nchunks = idx->nchunks,
+        .npoints = idx->npoints,
+    };
+    h.chunks_offset = idx->data_offset + idx->data_size;
+    h.points_offset = h.chunks_offset + idx->nchunks * sizeof *idx->chunks;
+    h.windows_offset = h.points_offset + idx->npoints * sizeof *idx->points;
+    // empty tables may be NULL, which fwrite mustn't be given even for nothing
+    size_t nwindows = idx->encoding? 0 : idx->npoints;
+    if ((idx->nchunks && fwrite(idx->chunks, sizeof *idx->chunks, idx->nchunks, idx->fp) != idx->nchunks) ||
+        (idx->npoints && fwrite(idx->points, sizeof *idx->points, idx->npoints, idx->fp) != idx->npoints) ||
+        (nwindows && fwrite(idx->windows, OTTD_INDEX_WINDOW, nwindows, idx->fp) != nwindows) ||
+        fseeko(idx->fp, 0, SEEK_SET) || fwrite(&h, sizeof h, 1, idx->fp) != 1) goto fail;
+    int r = fclose(idx->fp);
+    idx->fp = NULL;
+    if (r || rename(idx->tmp_path, idx->path)) goto fail;
+    free(idx->tmp_path);
+    idx->tmp_path = NULL;
+    Vprintf("wrote seek index: %u chunks, %u points\n", idx->nchunks, idx->npoints);
+    return 0;
+
+fail:
+    Veprintf("could not write seek index %s\n", idx->path);
+    return -1;
+}
@@ -0,0 +1,341 @@
+// shared between the library sources, not part of the public api
+#ifndef OTTD_INTERNAL_H
+#define OTTD_INTERNAL_H
+
+#include <sys/stat.h>
+#include "ottd.h"
+#include "ottd_schema.h"
+
+// a loaded save, see ottd_t
+struct ottd {
+    uint16_t version;
+    struct {
+        uint32_t x,y;
+    } mapSize;
+    ottd_company_t company[15];
+    int32_t startYear;
+    YearMonthDay curDate;
+    uint8_t *mapt;          // MAPT: type << 4 | height
+    uint8_t *mapo;          // MAPO: owner
+    void    *mapping;       // .ottdmap cache the planes point into, or NULL
+    size_t  mapping_size;
+    struct ottd_memory *memory; // the planes are charged to this, or NULL
+    struct ottd_rle *rle;   // run-length planes, or NULL
+    uint32_t scale;         // tiles a side per cell of a thumbnail load, 0 for full size
+    uint8_t *color;         // colour of each tile, drawn instead of the planes. set while a render shares or hillshades it, or by ottd_set_colors, else NULL
+    ottd_territory_t *territory; // NULL for thumbnail loads
+};
+
+#define TYPECHARS(t) ((t) >> 24) & 0xFF, ((t) >> 16) & 0xFF, ((t) >> 8) & 0xFF, (t) & 0xFF
+#define lengthof(x) (sizeof(x) / sizeof(x[0]))
+
+// per-call state, lives on the caller's stack
+typedef struct ottd_ctx {
+    const ottd_options_t *opts;
+    ottd_error_t *err;      // never NULL, points at local_err if the caller passed none
+    ottd_error_t local_err;
+    int verbose;
+    int coarse;             // deadline expired, rendering in coarse mode
+    int probe;              // only read metadata, don't allocate the map
+    ottd_anatomy_t *anatomy; // per-chunk accounting of this load, or NULL
+    ottd_perf_t *perf;      // from opts, or NULL
+    ottd_trace_t *trace;    // from opts, or NULL
+    int trace_file;         // file name spans are tagged with, or -1
+    ottd_memory_t *memory;  // from opts, or NULL
+    struct ottd_thumb *thumb; // thumbnail load state from MAPS to the end of the load, or NULL
+    int planes;             // map planes read so far, 1 for MAPT and 2 for MAPO
+} ottd_ctx_t;
+
+// chunk metadata, indexed by chunk id
+typedef struct ottd_chunk_info {
+    uint32_t tag;
+    uint8_t  kind;          // CH_RIFF, CH_ARRAY or CH_SPARSE_ARRAY before table chunks
+    uint8_t  needed;        // OTTD_NEED_*
+} ottd_chunk_info_t;
+
+extern const ottd_chunk_info_t ottd_chunk_info[OTTD_CHUNK_COUNT];
+int ottd_chunk_id(uint32_t tag);
+
+void ottd_ctx_init(ottd_ctx_t *ctx, const ottd_options_t *opts, ottd_error_t *err);
+uint64_t ottd_clock_ns(void);
+void ottd_log(ottd_ctx_t *ctx, int level, const char *fmt, ...);
+int ottd_error(ottd_ctx_t *ctx, int code, const char *fmt, ...);
+
+// cancellation and deadlines: ottd_interrupted returns the error code without
+// recording it, ottd_check records it and returns -1
+int ottd_interrupted(ottd_ctx_t *ctx, int stage, uint64_t done, uint64_t total);
+int ottd_check(ottd_ctx_t *ctx, int stage, uint64_t done, uint64_t total);
+
+// stage counters: enter returns the stage to go back to
+int ottd_perf_switch(ottd_perf_t *perf, int stage);
+static inline int ottd_perf_enter(ottd_ctx_t *ctx, int stage)
+{
+    return ctx->perf? ottd_perf_switch(ctx->perf, stage) : -1;
+}
+
+// memory accounting, all of these accept a NULL ottd_memory_t
+int ottd_mem_reserve(ottd_ctx_t *ctx, int stage, uint64_t size, const char *what);
+void ottd_mem_charge(ottd_memory_t *mem, int stage, uint64_t size);
+void ottd_mem_release(ottd_memory_t *mem, int stage, uint64_t size);
+uint64_t ottd_mem_available(const ottd_memory_t *mem);
+void* ottd_mem_hook_alloc(ottd_memory_t *mem, int stage, size_t size);
+void ottd_mem_hook_free(ottd_memory_t *mem, int stage, void *ptr);
+
+// trace spans, timed from ottd_trace_begin to ottd_trace_end
+enum ottd_span {
+    OTTD_SPAN_OPEN,         // loading a savegame
+    OTTD_SPAN_BLOCK,        // a decompressor block, arg is its size
+    OTTD_SPAN_CHUNK,        // a chunk proc or skip, tag is the chunk, arg its size
+    OTTD_SPAN_STRIP,        // arg is the first row
+    OTTD_SPAN_PNG_ROWS,     // encoding a block of rows, arg is the first row
+    OTTD_SPAN_PNG,          // a whole png
+    OTTD_SPAN_COLOR,        // filling a colour plane, arg is its rows
+    OTTD_SPAN_COUNT
+};
+
+int ottd_trace_file(ottd_trace_t *trace, const char *path);
+void ottd_trace_span(ottd_ctx_t *ctx, int kind, uint64_t begin, uint32_t tag, uint64_t arg);
+static inline uint64_t ottd_trace_begin(ottd_ctx_t *ctx)
+{
+    return ctx->trace? ottd_clock_ns() : 0;
+}
+static inline void ottd_trace_end(ottd_ctx_t *ctx, int kind, uint64_t begin, uint32_t tag, uint64_t arg)
+{
+    if (ctx->trace) ottd_trace_span(ctx, kind, begin, tag, arg);
+}
+
+// run-length map planes, see ottd_rle.c
+#define OTTD_RLE_MAX_WIDTH 65536        // run ends are 16 bits
+#define OTTD_RLE_RUN_BYTES 3
+
+typedef struct ottd_rle ottd_rle_t;
+
+typedef struct ottd_rle_plane {
+    uint64_t *row;          // first run of each row, and the run count at [height]
+    uint16_t *last;         // x of the last tile of each run
+    uint8_t  *value;
+    uint64_t runs, capacity;
+} ottd_rle_plane_t;
+
+struct ottd_rle {
+    uint32_t width, height;
+    ottd_rle_plane_t plane[2]; // MAPT, MAPO
+    uint64_t charged;       // bytes charged to OTTD_MEM_MAP
+};
+
+ottd_rle_t* ottd_rle_create(ottd_ctx_t *ctx, uint32_t width, uint32_t height);
+void ottd_rle_free(ottd_rle_t *rle, ottd_memory_t *memory);
+
+static inline uint8_t ottd_rle_at(const ottd_rle_plane_t *p, uint32_t x, uint32_t y)
+{
+    uint64_t lo = p->row[y], hi = p->row[y+1] - 1;
+    while(lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (p->last[mid] < x) lo = mid + 1;
+        else hi = mid;
+    }
+    return p->value[lo];
+}
+
+// spans of tiles along a map row with the same MAPT and MAPO bytes, walked from x = 0
+typedef struct ottd_rle_row {
+    const ottd_rle_t *rle;
+    uint64_t t, o;          // current run of each plane
+    uint32_t x;             // first tile of the next span, width at the end
+} ottd_rle_row_t;
+
+static inline void ottd_rle_row_begin(ottd_rle_row_t *r, const ottd_rle_t *rle, uint32_t y)
+{
+    r->rle = rle;
+    r->t = rle->plane[0].row[y];
+    r->o = rle->plane[1].row[y];
+    r->x = 0;
+}
+
+// the span starting at r->x, returns the x of its last tile
+static inline uint32_t ottd_rle_row_next(ottd_rle_row_t *r, uint8_t *mapt, uint8_t *mapo)
+{
+    const ottd_rle_plane_t *pt = &r->rle->plane[0], *po = &r->rle->plane[1];
+    uint32_t tlast = pt->last[r->t], olast = po->last[r->o];
+    uint32_t last = (tlast < olast)? tlast : olast;
+    *mapt = pt->value[r->t];
+    *mapo = po->value[r->o];
+    if (tlast == last) r->t++;
+    if (olast == last) r->o++;
+    r->x = last + 1;
+    return last;
+}
+
+// renders rows honouring cancellation, deadline and coarse fallback
+#define OTTD_COARSE_STEP 8
+#define OTTD_STRIP_ROWS 32
+int ottd_render_strip(ottd_ctx_t *ctx, const ottd_t *game, int mode, int y, int rows, uint8_t *buf, size_t stride);
+#define OTTD_MAX_THREADS 64
+int ottd_render_threads(const ottd_ctx_t *ctx, int bands);
+int ottd_render_bands(ottd_ctx_t *ctx, const ottd_t *game, int mode, int format, int y, int rows, uint8_t *buf, size_t stride);
+uint8_t* ottd_color_plane(ottd_ctx_t *ctx, const ottd_t *game, int shade);
+void ottd_color_plane_free(ottd_ctx_t *ctx, const ottd_t *game, uint8_t *color);
+const ottd_t* ottd_render_map(ottd_ctx_t *ctx, const ottd_t *game, ottd_t *copy, int shared);
+void ottd_render_map_free(ottd_ctx_t *ctx, const ottd_t *game, const ottd_t *map);
+int ottd_viewport_rows(ottd_ctx_t *ctx, const ottd_t *game, const ottd_viewport_t *vp, int format, int y, int rows, uint8_t *buf, size_t stride);
+
+// hillshade slope of a tile from the MAPT of its neighbours, 0 to 2 * OTTD_SHADE_STEPS
+#define OTTD_SHADE_STEPS 2
+static inline int ottd_shade_level(int left, int down, int right, int up)
+{
+    int d = (left & 0x0F) + (down & 0x0F) - (right & 0x0F) - (up & 0x0F);
+    if (d < -OTTD_SHADE_STEPS) d = -OTTD_SHADE_STEPS;
+    if (d > OTTD_SHADE_STEPS) d = OTTD_SHADE_STEPS;
+    return d + OTTD_SHADE_STEPS;
+}
+void ottd_shade_row(const uint8_t *mapt, uint32_t width, uint32_t height, uint32_t y, uint8_t *level);
+
+// messages only shown when verbose, errors are reported through ottd_error
+#define Vprintf(...) ottd_log(ctx, OTTD_LOG_INFO, __VA_ARGS__)
+#define Veprintf(...) ottd_log(ctx, OTTD_LOG_ERROR, __VA_ARGS__)
+
+// modification time in nanoseconds, for change detection
+static inline int64_t ottd_mtime_ns(const struct stat *sb)
+{
+#ifdef __APPLE__
+    return sb->st_mtimespec.tv_sec * 1000000000LL + sb->st_mtimespec.tv_nsec;
+#else
+    return sb->st_mtim.tv_sec * 1000000000LL + sb->st_mtim.tv_nsec;
+#endif
+}
+
+// sidecar seek index: decompressed offsets of chunks, and restart points for the decoder
+// zlib saves get zran-style points with the preceding 32K window, other compressed
+// formats are re-encoded into the index as deflate with a full flush at each point
+#define OTTD_INDEX_SPAN (1 << 20)   // decompressed bytes between restart points
+#define OTTD_INDEX_WINDOW 32768
+#define OTTD_INDEX_NO_WINDOW UINT32_MAX
+
+typedef struct ottd_index_chunk {
+    uint32_t tag, reserved;
+    uint64_t offset;
+} ottd_index_chunk_t;
+
+typedef struct ottd_index_point {
+    uint64_t out;       // decompressed offset
+    uint64_t in;        // compressed offset, in the save or in the re-encoded copy
+    uint32_t window;    // index in the window table, or OTTD_INDEX_NO_WINDOW
+    uint8_t  bits;      // unused bits of the byte before in
+    uint8_t  reserved[3];
+} ottd_index_point_t;
+
+typedef struct ottd_index {
+    char        *path, *tmp_path;
+    FILE        *fp;                // index file, or the temporary one while building
+    uint32_t    format;
+    uint64_t    source_size;
+    int64_t     source_mtime;
+    ottd_index_chunk_t *chunks;
+    ottd_index_point_t *points;
+    uint32_t    nchunks, npoints;
+    uint64_t    data_offset, data_size; // re-encoded copy of the stream, data_size is 0 for none
+    uint64_t    windows_offset;
+    
+    // building
+    int         building, encoding, failed;
+    uint32_t    chunks_alloc, points_alloc;
+    uint8_t     *windows;
+    uint8_t     ring[OTTD_INDEX_WINDOW];    // last 32K of output
+    uint64_t    ring_total;
+    void        *encoder;
+    uint64_t    fed, last;
+} ottd_index_t;
+
+ottd_index_t* ottd_index_open(const char *path, uint32_t format, const struct stat *source, ottd_ctx_t *ctx);
+ottd_index_t* ottd_index_create(const char *path, uint32_t format, const struct stat *source, ottd_ctx_t *ctx);
+int ottd_index_commit(ottd_index_t *idx, ottd_ctx_t *ctx);
+void ottd_index_free(ottd_index_t *idx);
+int ottd_index_add_chunk(ottd_index_t *idx, uint32_t tag, uint64_t offset);
+int ottd_index_add_point(ottd_index_t *idx, uint64_t out, uint64_t in, int bits, int with_window);
+void ottd_index_track(ottd_index_t *idx, const uint8_t *data, size_t len);
+int ottd_index_feed(ottd_index_t *idx, const uint8_t *data, size_t len);
+const ottd_index_point_t* ottd_index_find(const ottd_index_t *idx, uint64_t offset);
+int ottd_index_window(const ottd_index_t *idx, const ottd_index_point_t *pt, uint8_t *window);
+
+// map cache, see ottd_mapcache.c
+#define OTTD_MAP_MAGIC      'OTMC'
+#define OTTD_MAP_VERSION    2
+#define OTTD_MAP_ALIGN      16384   // a page on every platform we run on
+#define OTTD_MAP_TERRITORY  1       // ottd_map_header_t.flags: territory was counted
+
+typedef struct ottd_map_company {
+    uint8_t  active, ai, color, num_valid_stat_ent;
+    uint32_t face;
+    int32_t  inaugurated_year;
+    uint32_t reserved;
+    int64_t  money, loan;
+    int64_t  yearly_expenses[3][EXPENSES_END];
+    CompanyEconomyEntry cur_economy;
+    CompanyEconomyEntry old_economy[MAX_HISTORY_MONTHS];
+    char     name[128];
+    char     manager[128];
+} ottd_map_company_t;
+
+typedef struct ottd_map_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t crc;               // of this header, with crc zeroed
+    uint32_t align;
+    uint64_t source_size;       // fingerprint of the save
+    int64_t  source_mtime;
+    uint64_t mapt_offset, mapo_offset;
+    uint32_t mapt_crc, mapo_crc;
+    uint32_t format;
+    uint16_t save_version;
+    uint16_t flags;             // OTTD_MAP_*
+    uint32_t x, y;
+    int32_t  start_year;
+    int32_t  cur_year;
+    uint8_t  cur_month, cur_day;
+    uint8_t  reserved[6];
+    ottd_territory_t territory;
+    ottd_map_company_t company[15];
+} ottd_map_header_t;
+
+ottd_t* ottd_map_cache_open(const char *path, const struct stat *source, ottd_ctx_t *ctx);
+int ottd_map_cache_write(const ottd_t *game, const char *path, uint32_t format, const struct stat *source, ottd_ctx_t *ctx);
+void ottd_unmap(void *addr, size_t len);
+void ottd_map_advise(const ottd_t *game, int mode);
+int ottd_map_scratch(ottd_t *save, uint64_t tiles, const char *dir, ottd_ctx_t *ctx);
+
+// decompressed savegame data, decoded a block at a time
+#define OTTD_STREAM_BUFSZ (64 * 1024)
+typedef struct ottd_stream ottd_stream_t;
+struct ottd_stream {
+    ottd_ctx_t *ctx;
+    FILE        *fp;        // compressed data, after the savegame header
+    uint16_t    version;
+    uint8_t     *buf;       // current block
+    size_t      pos, len;   // read position and size of the current block
+    uint64_t    offset;     // stream offset of buf[0]
+    uint64_t    in_start, in_total; // compressed bytes consumed before the current block and through it, not kept across seek index jumps
+    uint64_t    charged;    // memory accounted to the stream
+    int         eof;        // end of data or decoder error
+    void        *state;     // decoder state
+    ottd_index_t *index;    // seek index in use or being built, may be NULL
+    int (*fill)(ottd_stream_t *st);                     // decode the next block into buf, returns its size, 0 at the end or -1
+    uint64_t (*skip)(ottd_stream_t *st, uint64_t len);  // optional, skip up to len bytes past the current block, returns how many
+    void (*close)(ottd_stream_t *st);
+};
+
+int ottd_stream_open(ottd_stream_t *st, FILE *fp, uint32_t format, uint16_t version, ottd_index_t *index, ottd_ctx_t *ctx);
+int ottd_stream_refill(ottd_stream_t *st);
+uint64_t ottd_stream_in_tell(ottd_stream_t *st);
+void ottd_stream_close(ottd_stream_t *st);
+size_t ottd_read_bytes(ottd_stream_t *st, void *dst, size_t size);
+int ottd_rle_read(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_rle_t *rle, int plane);
+
+// thumbnail loads, see ottd_thumb.c
+typedef struct ottd_thumb ottd_thumb_t;
+int ottd_thumb_create(ottd_ctx_t *ctx, ottd_t *save, uint32_t size);
+int ottd_thumb_read(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, int plane, uint32_t len);
+int ottd_territory_read(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, uint32_t len);
+int ottd_territory_count(ottd_ctx_t *ctx, ottd_t *save);
+void ottd_thumb_free(ottd_ctx_t *ctx);
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <sys/errno.h>
 #include <string.h>
 #ifdef __WIN32__
@@ -9,189 +10,328 @@
 #include <netinet/in.h>
 #endif
 #include <stdint.h>
-#include "ottd.h"
-
-#define TYPECHARS(t) ((t) >> 24) & 0xFF, ((t) >> 16) & 0xFF, ((t) >> 8) & 0xFF, (t) & 0xFF
-#define lengthof(x) (sizeof(x) / sizeof(x[0]))
-#define SL_MAX_VERSION 255
-
-#define Vprintf(...) do{if(verbose){printf(__VA_ARGS__);}}while(0);
-#define Veprintf(...) do{if(verbose){fprintf(stderr, __VA_ARGS__);}}while(0);
-#define eprintf(...) fprintf(stderr, __VA_ARGS__);
+#include <time.h>
+#include "ottd_internal.h"
 
 #define ORIGINAL_BASE_YEAR 1920
 
 // reading
-void* ottd_read(FILE *fp, size_t size);
-void ottd_skip(FILE *fp, size_t len);
-uint8_t ottd_read_u8(FILE *fp);
-uint16_t ottd_read_u16(FILE *fp);
-uint32_t ottd_read_u32(FILE *fp);
-uint64_t ottd_read_u64(FILE *fp);
-uint32_t ottd_read_sg(FILE *fp);
-uint32_t ottd_read_riff_length(FILE *fp);
-char *ottd_read_str(FILE *fp);
-
-// decompression
-FILE* ottd_decompress_none(FILE *fp, uint16_t version, int verbose);
-FILE* ottd_decompress_lzo(FILE *fp, uint16_t version, int verbose);
-FILE* ottd_decompress_zlib(FILE *fp, uint16_t version, int verbose);
-FILE* ottd_decompress_lzma(FILE *fp, uint16_t version, int verbose);
-
-// chunky stuff
-typedef struct ChunkProc {
-    uint32_t type;
-    int(*proc)(FILE*,int,ottd_t*);
-} ChunkProc;
-
-int ottd_skip_riff(FILE *fp, int verbose, ottd_t*save);
-int ottd_skip_array(FILE *fp, int verbose, ottd_t*save);
-int ottd_skip_LGRS(FILE *fp, int verbose, ottd_t*save);
-#define ottd_skip_sparse ottd_skip_array
-int ottd_read_MAPS(FILE *fp, int verbose, ottd_t*save);
-int ottd_read_MAPT(FILE *fp, int verbose, ottd_t*save);
-int ottd_read_MAPO(FILE *fp, int verbose, ottd_t *save);
-int ottd_read_DATE(FILE *fp, int verbose, ottd_t *save);
-int ottd_read_PATS(FILE *fp, int verbose, ottd_t *save);
-int ottd_read_PLYR(FILE *fp, int verbose, ottd_t *save);
-
-static ChunkProc ChunkProcs[] = {
-    {'AIPL', ottd_skip_array},
-    {'ANIT', ottd_skip_riff},
-    {'APID', ottd_skip_array},
-    {'ATID', ottd_skip_array},
-    {'BKOR', ottd_skip_array},
-    {'CAPA', ottd_skip_array},
-    {'CAPR', ottd_skip_riff},
-    {'CAPY', ottd_skip_array},
-    {'CHKP', ottd_skip_array},
-    {'CHTS', ottd_skip_riff},
-    {'CITY', ottd_skip_array},
-    {'CMDL', ottd_skip_array},
-    {'CMPU', ottd_skip_array},
-    {'DATE', ottd_read_DATE},
-    {'DEPT', ottd_skip_array},
-    {'ECMY', ottd_skip_riff},
-    {'EIDS', ottd_skip_array},
-    {'ENGN', ottd_skip_array},
-    {'ENGS', ottd_skip_riff},
-    {'ERNW', ottd_skip_array},
-    {'GLOG', ottd_skip_riff},
-    {'GOAL', ottd_skip_array},
-    {'GRPS', ottd_skip_array},
-    {'GSDT', ottd_skip_array},
-    {'GSTR', ottd_skip_array},
-    {'HIDS', ottd_skip_array},
-    {'IBLD', ottd_skip_riff},
-    {'IIDS', ottd_skip_array},
-    {'INDY', ottd_skip_array},
-    {'ITBL', ottd_skip_array},
-    {'LGRJ', ottd_skip_array},
-    {'LGRP', ottd_skip_array},
-    {'LGRS', ottd_skip_LGRS},
-    {'M3HI', ottd_skip_riff},
-    {'M3LO', ottd_skip_riff},
-    {'MAP2', ottd_skip_riff},
-    {'MAP5', ottd_skip_riff},
-    {'MAP7', ottd_skip_riff},
-    {'MAPE', ottd_skip_riff},
-    {'MAPH', ottd_skip_riff},
-    {'MAPO', ottd_read_MAPO},
-    {'MAPS', ottd_read_MAPS},
-    {'MAPT', ottd_read_MAPT},
-    {'NAME', ottd_skip_array},
-    {'NGRF', ottd_skip_array},
-    {'OBID', ottd_skip_array},
-    {'OBJS', ottd_skip_array},
-    {'OPTS', ottd_skip_riff},
-    {'ORDL', ottd_skip_array},
-    {'ORDR', ottd_skip_array},
-    {'PATS', ottd_read_PATS},
-    {'PLYR', ottd_read_PLYR},
-    {'PRIC', ottd_skip_riff},
-    {'PSAC', ottd_skip_array},
-    {'RAIL', ottd_skip_array},
-    {'ROAD', ottd_skip_array},
-    {'SIGN', ottd_skip_array},
-    {'STNN', ottd_skip_array},
-    {'STNS', ottd_skip_array},
-    {'STPA', ottd_skip_array},
-    {'STPE', ottd_skip_array},
-    {'SUBS', ottd_skip_array},
-    {'TIDS', ottd_skip_array},
-    {'VEHS', ottd_skip_sparse},
-    {'VIEW', ottd_skip_riff}
+size_t ottd_read_bytes(ottd_stream_t *st, void *dst, size_t size);
+void* ottd_read(ottd_stream_t *st, size_t size);
+uint64_t ottd_tell(ottd_stream_t *st);
+void ottd_skip(ottd_stream_t *st, uint64_t len);
+void ottd_seek(ottd_stream_t *st, uint64_t offset);
+uint8_t ottd_read_u8(ottd_stream_t *st);
+uint16_t ottd_read_u16(ottd_stream_t *st);
+uint32_t ottd_read_u32(ottd_stream_t *st);
+uint64_t ottd_read_u64(ottd_stream_t *st);
+uint32_t ottd_read_sg(ottd_stream_t *st);
+char *ottd_read_str(ottd_stream_t *st);
+
+// table header field types
+enum {
+    SLE_FILE_END,
+    SLE_FILE_I8,
+    SLE_FILE_U8,
+    SLE_FILE_I16,
+    SLE_FILE_U16,
+    SLE_FILE_I32,
+    SLE_FILE_U32,
+    SLE_FILE_I64,
+    SLE_FILE_U64,
+    SLE_FILE_STRINGID,
+    SLE_FILE_STRING,
+    SLE_FILE_STRUCT,
+    SLE_FILE_TYPE_MASK = 0xF,
+    SLE_FILE_HAS_LENGTH_FIELD = 0x10, // a gamma count precedes the values
+};
+
+// table header, struct fields have the header of the struct
+typedef struct ottd_table ottd_table_t;
+typedef struct ottd_table_field {
+    uint8_t         type;
+    char            *key;
+    ottd_table_t    *sub;
+} ottd_table_field_t;
+
+struct ottd_table {
+    int                 nfields;
+    ottd_table_field_t  *fields;
+};
+
+// value passed to a field callback while reading a table element
+typedef struct ottd_field {
+    const char  *key;
+    const char  *parent;        // key of the enclosing struct field, NULL at the top level
+    uint32_t    parent_index;   // element of the enclosing struct list
+    uint32_t    index;          // element of an array field
+    uint32_t    count;          // elements in the array field
+    int64_t     value;          // integer fields
+    const char  *str;           // string fields, only valid during the call
+} ottd_field_t;
+typedef void (*ottd_field_fn)(void *ud, const ottd_field_t *field);
+
+typedef struct ottd_chunk {
+    uint32_t        tag;
+    int             type;       // CH_*
+    uint32_t        length;     // CH_RIFF
+    uint32_t        index;      // next array index
+    uint64_t        elements;   // non-empty elements read or skipped
+    ottd_table_t    *table;     // header of CH_TABLE and CH_SPARSE_TABLE
+} ottd_chunk_t;
+
+typedef int (*ottd_chunk_proc)(ottd_stream_t*,ottd_ctx_t*,ottd_t*,ottd_chunk_t*);
+
+static int ottd_read_chunk_header(ottd_stream_t *st, uint32_t tag, ottd_chunk_t *ch);
+static ottd_table_t* ottd_read_table_header(ottd_stream_t *st);
+static void ottd_free_table(ottd_table_t *table);
+int ottd_skip_chunk(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_chunk_t *ch);
+int ottd_read_MAPS(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_chunk_t *ch);
+int ottd_read_MAPT(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_chunk_t *ch);
+int ottd_read_MAPO(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_chunk_t *ch);
+int ottd_read_DATE(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_chunk_t *ch);
+int ottd_read_PATS(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_chunk_t *ch);
+int ottd_read_PLYR(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_chunk_t *ch);
+
+#pragma mark - Chunk Dispatch
+
+// generated from OTTD_CHUNKS in ottd_schema.h
+#define OTTD_CHUNK_INFO(id, tag, kind, needed) [OTTD_CHUNK_##id] = { tag, kind, needed },
+const ottd_chunk_info_t ottd_chunk_info[OTTD_CHUNK_COUNT] = {
+    OTTD_CHUNKS(OTTD_CHUNK_INFO)
+    [OTTD_CHUNK_UNKNOWN] = { 0, 0, 0 },
+};
+
+// chunks with a reader, the others are skipped
+static const ottd_chunk_proc ottd_chunk_procs[OTTD_CHUNK_COUNT] = {
+    [OTTD_CHUNK_DATE] = ottd_read_DATE,
+    [OTTD_CHUNK_MAPO] = ottd_read_MAPO,
+    [OTTD_CHUNK_MAPS] = ottd_read_MAPS,
+    [OTTD_CHUNK_MAPT] = ottd_read_MAPT,
+    [OTTD_CHUNK_PATS] = ottd_read_PATS,
+    [OTTD_CHUNK_PLYR] = ottd_read_PLYR,
 };
 
-int ottd_chunkproc_cmp(const void *key, const void *val)
+int ottd_chunk_id(uint32_t tag)
 {
-    int32_t tKey = *(int32_t*)key;
-    int32_t tVal = (int32_t)((ChunkProc*)val)->type;
-    return tKey-tVal;
+#define OTTD_CHUNK_CASE(id, tag, kind, needed) case tag: return OTTD_CHUNK_##id;
+    switch(tag) {
+        OTTD_CHUNKS(OTTD_CHUNK_CASE)
+    }
+#undef OTTD_CHUNK_CASE
+    return OTTD_CHUNK_UNKNOWN;
 }
 
-ottd_t* ottd_load(const char *path, int verbose)
+static ottd_anatomy_chunk_t* ottd_anatomy_row(ottd_anatomy_t *anatomy, int id, uint32_t tag);
+
+static int ottd_load_mode(ottd_ctx_t *ctx)
 {
-    ottd_t *game = calloc(1, sizeof(ottd_t));
-    if (game == NULL) return NULL;
+    return ctx->probe? OTTD_NEED_PROBE : OTTD_NEED_LOAD;
+}
+
+// chunks the loader reads, the others can be jumped over with a seek index
+static int ottd_chunk_needed(uint32_t tag, ottd_ctx_t *ctx)
+{
+    return (ottd_chunk_info[ottd_chunk_id(tag)].needed & ottd_load_mode(ctx)) != 0;
+}
+
+
+// loads chunks from a savegame, in probe mode stopping once DATE, PATS and PLYR have been read
+static int ottd_load_file(const char *path, ottd_ctx_t *ctx, ottd_t *game, uint32_t *format)
+{
+    ottd_stream_t stream, *st = NULL;
+    ottd_index_t *index = NULL;
+    int ret = -1;
     
     FILE *savefp = fopen(path, "rb");
-    FILE *fp = NULL;
-    if (savefp == NULL) return NULL;
+    if (savefp == NULL) return ottd_error(ctx, OTTD_E_IO, "%s: %s", path, strerror(errno));
+    int perf_stage = ottd_perf_enter(ctx, OTTD_PERF_PARSE);
+    uint64_t trace_begin = ottd_trace_begin(ctx);
+    if (ctx->trace) ctx->trace_file = ottd_trace_file(ctx->trace, path);
     
     // read header
     uint8_t header[8];
-    uint32_t format, version;
-    if (fread(header, 8, 1, savefp) != 1) goto fail;
-    format = ntohl(*(uint32_t*)header);
+    uint32_t version;
+    if (fread(header, 8, 1, savefp) != 1) {
+        ottd_error(ctx, OTTD_E_FORMAT, "%s: file too short", path);
+        goto end;
+    }
+    *format = ntohl(*(uint32_t*)header);
     version = ntohl(*(uint32_t*)(header+4));
     version >>= 16;
     game->version = version;
 
     Vprintf("version: %d\n", version);
 
+    // seek index, built while loading if missing or stale
+    struct stat sb;
+    const char *index_path = (ctx->opts && ctx->anatomy == NULL)? ctx->opts->seek_index : NULL;
+    if (index_path && fstat(fileno(savefp), &sb) == 0) {
+        index = ottd_index_open(index_path, *format, &sb, ctx);
+        if (index == NULL && !ctx->probe) index = ottd_index_create(index_path, *format, &sb, ctx);
+    }
+
     // decompress
-    FILE*(*dcmp_fcn)(FILE*,uint16_t,int) = NULL;
-    switch(format) {
-        case 'OTTD': dcmp_fcn = ottd_decompress_lzo; break;
-        case 'OTTN': dcmp_fcn = ottd_decompress_none; break;
-        case 'OTTZ': dcmp_fcn = ottd_decompress_zlib; break;
-        case 'OTTX': dcmp_fcn = ottd_decompress_lzma; break;
-        default:
-            // unsupported format
-            errno = EINVAL;
-            Veprintf("unsupported format: %c%c%c%c\n", header[0], header[1], header[2], header[3]);
-            goto fail;
-    }
-    fp = dcmp_fcn(savefp, version, verbose);
-    fclose(savefp); savefp = NULL;
-
-    // load chunks
-    uint32_t chunkType;
+    if (ottd_stream_open(&stream, savefp, *format, version, index, ctx)) goto end;
+    st = &stream;
+    uint64_t total = (fstat(fileno(st->fp), &sb) == 0)? sb.st_size : 0;
+
+    // load chunks, until every chunk this mode needs has been read
+    uint32_t chunkType, next = 0;
+    int mode = ottd_load_mode(ctx), wanted = 0;
+    bool seen[OTTD_CHUNK_COUNT] = { false };
+    for(int i=0; i < OTTD_CHUNK_COUNT; i++) if (ottd_chunk_info[i].needed & mode) wanted++;
     do {
-        chunkType = ottd_read_u32(fp);
+        if (index && !index->building) {
+            // jump to the next chunk we need
+            uint64_t pos = ottd_tell(st);
+            while(next < index->nchunks && (index->chunks[next].offset < pos || !ottd_chunk_needed(index->chunks[next].tag, ctx))) next++;
+            if (next == index->nchunks) break;
+            ottd_seek(st, index->chunks[next].offset);
+        }
+        if (ottd_check(ctx, OTTD_STAGE_LOAD, ftello(st->fp), total)) goto end;
+        uint64_t chunkOffset = ottd_tell(st);
+        uint64_t chunkIn = ctx->anatomy? ottd_stream_in_tell(st) : 0;
+        uint64_t chunkTime = ctx->anatomy? ottd_clock_ns() : 0;
+        chunkType = ottd_read_u32(st);
         if (chunkType == 0) break;
+        if (index && !index->building && chunkType != index->chunks[next].tag) {
+            ottd_error(ctx, OTTD_E_CORRUPT, "seek index doesn't match %s", path);
+            goto end;
+        }
+        if (index && index->building) ottd_index_add_chunk(index, chunkType, chunkOffset);
         Vprintf("read chunk %c%c%c%c...\n", TYPECHARS(chunkType));
-        const ChunkProc *proc = bsearch(&chunkType, ChunkProcs, lengthof(ChunkProcs), sizeof(ChunkProcs[0]), ottd_chunkproc_cmp);
-        if (proc == NULL) {
-            char chunkTypeStr[5];
-            *(uint32_t*)chunkTypeStr = htonl(chunkType);
-            eprintf("don't know what to do with chunkType %4s\n", chunkTypeStr);
+        ottd_chunk_t chunk;
+        if (ottd_read_chunk_header(st, chunkType, &chunk)) {
+            ottd_error(ctx, OTTD_E_CORRUPT, "unknown type of chunk %c%c%c%c", TYPECHARS(chunkType));
+            goto end;
+        }
+        int id = ottd_chunk_id(chunkType);
+        ottd_chunk_proc proc = ottd_chunk_procs[id];
+        if (id == OTTD_CHUNK_UNKNOWN) Vprintf("skipping unknown chunk %c%c%c%c\n", TYPECHARS(chunkType));
+        int r;
+        int stage = ottd_perf_enter(ctx, (id == OTTD_CHUNK_MAPT || id == OTTD_CHUNK_MAPO)? OTTD_PERF_MAP : OTTD_PERF_PARSE);
+        uint64_t trace_chunk = ottd_trace_begin(ctx);
+        if (proc) {
+            // table headers are only parsed for chunks we read
+            int is_table = (chunk.type == CH_TABLE || chunk.type == CH_SPARSE_TABLE);
+            if (is_table && (chunk.table = ottd_read_table_header(st)) == NULL) r = -1;
+            else r = proc(st, ctx, game, &chunk);
+            ottd_free_table(chunk.table);
         } else {
-            proc->proc(fp, verbose, game);
+            r = ottd_skip_chunk(st, ctx, game, &chunk);
+        }
+        ottd_perf_enter(ctx, stage);
+        ottd_trace_end(ctx, OTTD_SPAN_CHUNK, trace_chunk, chunkType, ottd_tell(st) - chunkOffset);
+        if (r < 0 || ctx->err->code != OTTD_OK) {
+            ottd_error(ctx, OTTD_E_CORRUPT, "bad chunk %c%c%c%c", TYPECHARS(chunkType));
+            goto end;
+        }
+        
+        if (ctx->anatomy) {
+            ottd_anatomy_chunk_t *row = ottd_anatomy_row(ctx->anatomy, id, chunkType);
+            if (row == NULL) {
+                ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+                goto end;
+            }
+            row->type = chunk.type;
+            row->count++;
+            row->elements += chunk.elements;
+            row->bytes += ottd_tell(st) - chunkOffset;
+            row->compressed += ottd_stream_in_tell(st) - chunkIn;
+            row->time_ns += ottd_clock_ns() - chunkTime;
+            continue; // walks every chunk
+        }
+        
+        if ((ottd_chunk_info[id].needed & mode) && !seen[id]) {
+            seen[id] = true;
+            if (--wanted == 0) break;
         }
-
     } while(1);
+    if (ctx->err->code != OTTD_OK) goto end;
+    if (index && index->building) ottd_index_commit(index, ctx);
+    ret = 0;
+
+end:
+    if (st) ottd_stream_close(st);
+    ottd_thumb_free(ctx);
+    ottd_index_free(index);
+    fclose(savefp);
+    ottd_perf_enter(ctx, perf_stage);
+    ottd_trace_end(ctx, OTTD_SPAN_OPEN, trace_begin, 0, 0);
+    return ret;
+}
 
-    // this is the end
-    fclose(fp); fp = NULL;
+ottd_t* ottd_open(const char *path, const ottd_options_t *opts, ottd_error_t *err)
+{
+    ottd_ctx_t ctx_, *ctx = &ctx_;
+    ottd_ctx_init(ctx, opts, err);
+    uint32_t format;
+    
+    // map cache, if current
+    struct stat sb;
+    const char *cache_path = opts? opts->map_cache : NULL;
+    int have_stat = (stat(path, &sb) == 0);
+    if (opts && opts->thumbnail) cache_path = NULL; // the cache is full size
+    if (cache_path && have_stat) {
+        ottd_t *game = ottd_map_cache_open(cache_path, &sb, ctx);
+        if (game) return game;
+    }
+    
+    ottd_t *game = calloc(1, sizeof(ottd_t));
+    if (game == NULL) {
+        ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+        return NULL;
+    }
+    if (ottd_load_file(path, ctx, game, &format)) {
+        ottd_free(game);
+        return NULL;
+    }
+    if (cache_path && have_stat) ottd_map_cache_write(game, cache_path, format, &sb, ctx);
     return game;
+}
 
-fail:
+int ottd_probe(const char *path, ottd_info_t *info, const ottd_options_t *opts, ottd_error_t *err)
+{
+    ottd_ctx_t ctx_, *ctx = &ctx_;
+    ottd_ctx_init(ctx, opts, err);
+    ctx->probe = 1;
+    memset(info, 0, sizeof *info);
+    
+    ottd_t *game = calloc(1, sizeof(ottd_t));
+    if (game == NULL) return ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+    if (ottd_load_file(path, ctx, game, &info->format)) {
+        ottd_free(game);
+        return -1;
+    }
+    
+    // copy what we need
+    info->version = game->version;
+    info->mapSize.x = game->mapSize.x;
+    info->mapSize.y = game->mapSize.y;
+    info->startYear = game->startYear;
+    info->curDate = game->curDate;
+    for(int i=0; i < lengthof(info->company); i++) {
+        ottd_company_t *cmp = &game->company[i];
+        info->company[i].active = cmp->active;
+        info->company[i].color = cmp->color;
+        if (cmp->name) snprintf(info->company[i].name, sizeof info->company[i].name, "%s", cmp->name);
+    }
     ottd_free(game);
-    if (savefp) fclose(savefp);
-    if (fp) fclose(fp);
-    return NULL;
+    return 0;
+}
+
+ottd_t* ottd_load(const char *path, int verbose)
+{
+    ottd_options_t opts = { .verbose = verbose };
+    ottd_error_t err;
+    ottd_t *game = ottd_open(path, &opts, &err);
+    if (game == NULL) {
+        // keep errno from the failing call for i/o errors
+        if (err.code == OTTD_E_NOMEM) errno = ENOMEM;
+        else if (err.code != OTTD_E_IO) errno = EINVAL;
+    }
+    return game;
 }
 
 void ottd_free(ottd_t *save)
@@ -204,69 +344,376 @@ void ottd_free(ottd_t *save)
         free(save->company[i].manager);
     }
     
-    // free tiles
-    if (save->tile) {
-        free(save->tile[0]);
-        free(save->tile);
+    // free planes
+    if (save->mapping) {
+        ottd_unmap(save->mapping, save->mapping_size);
+    } else if (save->rle) {
+        ottd_rle_free(save->rle, save->memory);
+    } else {
+        free(save->mapt);
+        free(save->mapo);
+        if (save->memory) ottd_mem_release(save->memory, OTTD_MEM_MAP, 2 * (uint64_t)save->mapSize.x * save->mapSize.y);
     }
+    free(save->territory);
     
     free(save);
 }
 
+int ottd_get_tile(const ottd_t *game, uint32_t x, uint32_t y, ottd_tile_t *tile)
+{
+    if (game == NULL || (game->mapt == NULL && game->rle == NULL) || x >= game->mapSize.x || y >= game->mapSize.y) return -1;
+    uint8_t mapt, mapo;
+    if (game->rle) {
+        mapt = ottd_rle_at(&game->rle->plane[0], x, y);
+        mapo = ottd_rle_at(&game->rle->plane[1], x, y);
+    } else {
+        size_t i = (size_t)y * game->mapSize.x + x;
+        mapt = game->mapt[i];
+        mapo = game->mapo[i];
+    }
+    tile->type = mapt >> 4;
+    tile->height = mapt & 0x0F;
+    tile->owner = mapo;
+    return 0;
+}
+
+uint16_t ottd_version(const ottd_t *game)
+{
+    return game->version;
+}
+
+void ottd_map_size(const ottd_t *game, uint32_t *width, uint32_t *height)
+{
+    *width = game->mapSize.x;
+    *height = game->mapSize.y;
+}
+
+uint32_t ottd_map_scale(const ottd_t *game)
+{
+    return game->scale;
+}
+
+int32_t ottd_start_year(const ottd_t *game)
+{
+    return game->startYear;
+}
+
+YearMonthDay ottd_current_date(const ottd_t *game)
+{
+    return game->curDate;
+}
+
+const ottd_company_t* ottd_company(const ottd_t *game, int c)
+{
+    return (c >= 0 && c < lengthof(game->company))? &game->company[c] : NULL;
+}
+
+const uint8_t* ottd_map_types(const ottd_t *game)
+{
+    return game->mapt;
+}
+
+const uint8_t* ottd_map_owners(const ottd_t *game)
+{
+    return game->mapo;
+}
+
+const ottd_territory_t* ottd_territory(const ottd_t *game)
+{
+    return game->territory;
+}
+
+void ottd_set_colors(ottd_t *game, uint8_t *color)
+{
+    game->color = color;
+}
+
+#pragma mark - Anatomy
+
+// known chunks have a row each in id order, other tags are appended as they show up
+static ottd_anatomy_chunk_t* ottd_anatomy_row(ottd_anatomy_t *anatomy, int id, uint32_t tag)
+{
+    if (anatomy->chunks == NULL) {
+        anatomy->chunks = calloc(OTTD_CHUNK_UNKNOWN, sizeof *anatomy->chunks);
+        if (anatomy->chunks == NULL) return NULL;
+        anatomy->nchunks = OTTD_CHUNK_UNKNOWN;
+        for(int i=0; i < OTTD_CHUNK_UNKNOWN; i++) {
+            anatomy->chunks[i].tag = ottd_chunk_info[i].tag;
+            anatomy->chunks[i].type = ottd_chunk_info[i].kind;
+        }
+    }
+    if (id != OTTD_CHUNK_UNKNOWN) return &anatomy->chunks[id];
+    for(int i=OTTD_CHUNK_UNKNOWN; i < anatomy->nchunks; i++) {
+        if (anatomy->chunks[i].tag == tag) return &anatomy->chunks[i];
+    }
+    ottd_anatomy_chunk_t *chunks = realloc(anatomy->chunks, (anatomy->nchunks + 1) * sizeof *chunks);
+    if (chunks == NULL) return NULL;
+    anatomy->chunks = chunks;
+    ottd_anatomy_chunk_t *row = &chunks[anatomy->nchunks++];
+    memset(row, 0, sizeof *row);
+    row->tag = tag;
+    return row;
+}
+
+int ottd_anatomy_add(ottd_anatomy_t *anatomy, const char *path, const ottd_options_t *opts, ottd_error_t *err)
+{
+    ottd_ctx_t ctx_, *ctx = &ctx_;
+    ottd_ctx_init(ctx, opts, err);
+    ottd_anatomy_t file = { 0 };
+    ctx->anatomy = &file;
+    uint32_t format;
+    int ret = -1;
+    
+    struct stat sb;
+    if (stat(path, &sb)) return ottd_error(ctx, OTTD_E_IO, "%s: %s", path, strerror(errno));
+    ottd_t *game = calloc(1, sizeof(ottd_t));
+    if (game == NULL) return ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+    uint64_t start = ottd_clock_ns();
+    if (ottd_load_file(path, ctx, game, &format)) goto end;
+    anatomy->time_ns += ottd_clock_ns() - start;
+    anatomy->files++;
+    anatomy->file_bytes += sb.st_size;
+    
+    // merge
+    for(int i=0; i < file.nchunks; i++) {
+        const ottd_anatomy_chunk_t *src = &file.chunks[i];
+        if (src->count == 0) continue;
+        ottd_anatomy_chunk_t *row = ottd_anatomy_row(anatomy, ottd_chunk_id(src->tag), src->tag);
+        if (row == NULL) {
+            ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+            goto end;
+        }
+        row->type = src->type;
+        row->count += src->count;
+        row->elements += src->elements;
+        row->bytes += src->bytes;
+        row->compressed += src->compressed;
+        row->time_ns += src->time_ns;
+        anatomy->bytes += src->bytes;
+    }
+    ret = 0;
+    
+end:
+    ottd_free(game);
+    ottd_anatomy_free(&file);
+    return ret;
+}
+
+void ottd_anatomy_free(ottd_anatomy_t *anatomy)
+{
+    free(anatomy->chunks);
+    memset(anatomy, 0, sizeof *anatomy);
+}
+
+#pragma mark - Errors and logging
+
+static const char *ottd_errors[] = {
+    [OTTD_OK]           = "no error",
+    [OTTD_E_ARG]        = "invalid argument",
+    [OTTD_E_IO]         = "i/o error",
+    [OTTD_E_FORMAT]     = "unsupported file format",
+    [OTTD_E_DECOMPRESS] = "decompression error",
+    [OTTD_E_CORRUPT]    = "corrupt savegame",
+    [OTTD_E_NOMEM]      = "out of memory",
+    [OTTD_E_ENCODE]     = "image encoding error",
+    [OTTD_E_CANCELLED]  = "cancelled",
+    [OTTD_E_TIMEOUT]    = "deadline expired",
+    [OTTD_E_BUDGET]     = "memory budget exceeded",
+};
+
+const char* ottd_strerror(int code)
+{
+    if (code < 0 || code >= lengthof(ottd_errors) || ottd_errors[code] == NULL) return "unknown error";
+    return ottd_errors[code];
+}
+
+void ottd_ctx_init(ottd_ctx_t *ctx, const ottd_options_t *opts, ottd_error_t *err)
+{
+    ctx->opts = opts;
+    ctx->err = err? err : &ctx->local_err;
+    ctx->verbose = opts? opts->verbose : 0;
+    ctx->coarse = 0;
+    ctx->probe = 0;
+    ctx->anatomy = NULL;
+    ctx->perf = opts? opts->perf : NULL;
+    ctx->trace = opts? opts->trace : NULL;
+    ctx->trace_file = -1;
+    ctx->memory = opts? opts->memory : NULL;
+    ctx->thumb = NULL;
+    ctx->planes = 0;
+    ctx->err->code = OTTD_OK;
+    ctx->err->message[0] = '\0';
+}
+
+static void ottd_vlog(ottd_ctx_t *ctx, int level, const char *fmt, va_list ap)
+{
+    if (ctx->opts && ctx->opts->log) {
+        char msg[256];
+        vsnprintf(msg, sizeof msg, fmt, ap);
+        ctx->opts->log(ctx->opts->log_ctx, level, msg);
+    } else {
+        vfprintf(level == OTTD_LOG_INFO? stdout : stderr, fmt, ap);
+    }
+}
+
+void ottd_log(ottd_ctx_t *ctx, int level, const char *fmt, ...)
+{
+    if (!ctx->verbose) return;
+    va_list ap;
+    va_start(ap, fmt);
+    ottd_vlog(ctx, level, fmt, ap);
+    va_end(ap);
+}
+
+// records the first error of a call, always returns -1
+int ottd_error(ottd_ctx_t *ctx, int code, const char *fmt, ...)
+{
+    ottd_error_t *err = ctx->err;
+    if (err->code != OTTD_OK) return -1;
+    err->code = code;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(err->message, sizeof err->message, fmt, ap);
+    va_end(ap);
+    return -1;
+}
+
+#pragma mark - Cancellation
+
+uint64_t ottd_clock_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t ottd_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int ottd_interrupted(ottd_ctx_t *ctx, int stage, uint64_t done, uint64_t total)
+{
+    const ottd_options_t *opts = ctx->opts;
+    if (opts == NULL) return OTTD_OK;
+    if (opts->progress && opts->progress(opts->progress_ctx, stage, done, total)) return OTTD_E_CANCELLED;
+    if (opts->cancel && *opts->cancel) return OTTD_E_CANCELLED;
+    if (opts->deadline && ottd_clock_ms() >= opts->deadline) return OTTD_E_TIMEOUT;
+    return OTTD_OK;
+}
+
+int ottd_check(ottd_ctx_t *ctx, int stage, uint64_t done, uint64_t total)
+{
+    int code = ottd_interrupted(ctx, stage, done, total);
+    if (code == OTTD_OK) return 0;
+    return ottd_error(ctx, code, "%s", ottd_strerror(code));
+}
+
 #pragma mark - Low-level reading
 
-void* ottd_read(FILE *fp, size_t size)
+// copies up to size bytes, decoding blocks as needed
+size_t ottd_read_bytes(ottd_stream_t *st, void *dst, size_t size)
+{
+    size_t done = 0;
+    while(done < size) {
+        if (st->pos == st->len && ottd_stream_refill(st) <= 0) break;
+        size_t n = st->len - st->pos;
+        if (n > size - done) n = size - done;
+        memcpy((uint8_t*)dst + done, st->buf + st->pos, n);
+        st->pos += n;
+        done += n;
+    }
+    return done;
+}
+
+void* ottd_read(ottd_stream_t *st, size_t size)
 {
     void *mem = malloc(size);
     if (mem == NULL) return NULL;
-    if (fread(mem, 1, size, fp) != size) {
+    if (ottd_read_bytes(st, mem, size) != size) {
         free(mem);
         return NULL;
     }
     return mem;
 }
 
-void ottd_skip(FILE *fp, size_t len)
+uint64_t ottd_tell(ottd_stream_t *st)
 {
-    fseek(fp, len, SEEK_CUR);
+    return st->offset + st->pos;
 }
 
-uint8_t ottd_read_u8(FILE *fp)
+void ottd_skip(ottd_stream_t *st, uint64_t len)
 {
+    if (len <= st->len - st->pos) {
+        st->pos += len;
+        return;
+    }
+    len -= st->len - st->pos;
+    st->pos = st->len;
+    if (st->skip && !st->eof) {
+        st->offset += st->len;
+        st->pos = st->len = 0;
+        int stage = ottd_perf_enter(st->ctx, OTTD_PERF_DECOMPRESS);
+        uint64_t trace_begin = ottd_trace_begin(st->ctx);
+        uint64_t skipped = st->skip(st, len);
+        ottd_trace_end(st->ctx, OTTD_SPAN_BLOCK, trace_begin, 0, skipped);
+        ottd_perf_enter(st->ctx, stage);
+        len -= skipped;
+    }
+    while(len && ottd_stream_refill(st) > 0) {
+        size_t n = (len < st->len)? len : st->len;
+        st->pos = n;
+        len -= n;
+    }
+}
+
+// only forward, like everything else in the stream
+void ottd_seek(ottd_stream_t *st, uint64_t offset)
+{
+    uint64_t pos = ottd_tell(st);
+    if (offset > pos) ottd_skip(st, offset - pos);
+}
+
+uint8_t ottd_read_u8(ottd_stream_t *st)
+{
+    if (st->pos < st->len) return st->buf[st->pos++];
     uint8_t b;
-    if (fread(&b, 1, 1, fp) != 1) return 0;
+    if (ottd_read_bytes(st, &b, 1) != 1) return 0;
     return b;
 }
 
-uint16_t ottd_read_u16(FILE *fp)
+uint16_t ottd_read_u16(ottd_stream_t *st)
 {
     uint16_t val;
-    if (fread(&val, 1, sizeof val, fp) != sizeof val) return 0;
+    if (ottd_read_bytes(st, &val, sizeof val) != sizeof val) return 0;
     return ntohs(val);
 }
 
-uint32_t ottd_read_u32(FILE *fp)
+uint32_t ottd_read_u32(ottd_stream_t *st)
 {
     uint32_t val;
-    if (fread(&val, 1, sizeof val, fp) != sizeof val) return 0;
+    if (ottd_read_bytes(st, &val, sizeof val) != sizeof val) return 0;
     return ntohl(val);
 }
 
-uint64_t ottd_read_u64(FILE *fp)
+uint64_t ottd_read_u64(ottd_stream_t *st)
 {
     uint8_t b[8];
-    if (fread(b, 1, 8, fp) != 8) return 0;
+    if (ottd_read_bytes(st, b, 8) != 8) return 0;
     return ((uint64_t)b[0] << 56) | ((uint64_t)b[1] << 48) | ((uint64_t)b[2] << 40) | ((uint64_t)b[3] << 32) |
         ((uint64_t)b[4] << 24) |  ((uint64_t)b[5] << 16) |  ((uint64_t)b[6] << 8) | (uint64_t)b[7];
 }
 
-char *ottd_read_str(FILE *fp)
+char *ottd_read_str(ottd_stream_t *st)
 {
-    uint32_t len = ottd_read_sg(fp);
+    uint32_t len = ottd_read_sg(st);
     if (len == 0) return NULL;
     char *str = malloc(len+1);
+    if (str == NULL) return NULL;
     str[len] = '\0';
-    if (fread(str, 1, len, fp) != len) {
+    if (ottd_read_bytes(st, str, len) != len) {
         free(str);
         return NULL;
     }
@@ -278,15 +725,16 @@ char *ottd_read_str(FILE *fp)
  * 10xxxxxx xxxxxxxx
  * 110xxxxx xxxxxxxx xxxxxxxx
  * 1110xxxx xxxxxxxx xxxxxxxx xxxxxxxx
+ * 11110--- xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx
  */
-uint32_t ottd_read_sg(FILE *fp)
+uint32_t ottd_read_sg(ottd_stream_t *st)
 {
     int btr = 0;
     uint8_t b;
     uint32_t res;
     
     // read first byte
-    if (fread(&b, 1, 1, fp) != 1) return 0;
+    if (ottd_read_bytes(st, &b, 1) != 1) return 0;
     
     // what do?
     if ((b & 0x80) == 0) {
@@ -305,323 +753,565 @@ uint32_t ottd_read_sg(FILE *fp)
         // 4 bytes
         res = (b & 0x0F);
         btr = 3;
+    } else if ((b & 0xF8) == 0xF0) {
+        // 5 bytes, 32 bits
+        res = 0;
+        btr = 4;
+    } else {
+        return 0;
     }
     
     // read the other bytes
     while(btr--) {
         res <<= 8;
-        if (fread(&b, 1, 1, fp) != 1) return 0;
+        if (ottd_read_bytes(st, &b, 1) != 1) return 0;
         res |= b;
     }
     
     return res;
 }
 
-uint32_t ottd_read_riff_length(FILE *fp)
-{
-    uint32_t len = ottd_read_u32(fp);
-    if (len == 0) return -1;
-    len = (len & 0xFFFFFF) | ((len >> 24) << 28);
-    return len;
-}
-
 size_t ottd_sg_len(uint32_t sg)
 {
     if (sg <= 0x7F) return 1;
     else if (sg <= 0x3FFF) return 2;
     else if (sg <= 0x1FFFFF) return 3;
     else if (sg <= 0x0FFFFFFF) return 4;
+    return 5;
+}
+
+#pragma mark - Chunk Headers
+
+// reads the type byte after the tag, and the length of CH_RIFF chunks
+static int ottd_read_chunk_header(ottd_stream_t *st, uint32_t tag, ottd_chunk_t *ch)
+{
+    memset(ch, 0, sizeof *ch);
+    ch->tag = tag;
+    uint8_t m = ottd_read_u8(st);
+    ch->type = m & CH_TYPE_MASK;
+    switch(ch->type) {
+        case CH_RIFF:
+            // 28-bit length, the top 4 bits are in the type byte
+            ch->length = ((uint32_t)(m >> 4) << 24) | ((uint32_t)ottd_read_u8(st) << 16) | ottd_read_u16(st);
+            return 0;
+        case CH_ARRAY:
+        case CH_SPARSE_ARRAY:
+        case CH_TABLE:
+        case CH_SPARSE_TABLE:
+            return 0;
+    }
+    return -1;
+}
+
+static void ottd_free_table(ottd_table_t *table)
+{
+    if (table == NULL) return;
+    for(int i=0; i < table->nfields; i++) {
+        free(table->fields[i].key);
+        ottd_free_table(table->fields[i].sub);
+    }
+    free(table->fields);
+    free(table);
+}
+
+// field list up to SLE_FILE_END, then the headers of its struct fields in order
+static ottd_table_t* ottd_parse_table(ottd_stream_t *st, int depth)
+{
+    if (depth > 16) return NULL;
+    ottd_table_t *table = calloc(1, sizeof *table);
+    if (table == NULL) return NULL;
+    int alloc = 0;
+    uint8_t type;
+    while((type = ottd_read_u8(st)) != SLE_FILE_END) {
+        if ((type & SLE_FILE_TYPE_MASK) > SLE_FILE_STRUCT) goto fail;
+        if (table->nfields == alloc) {
+            alloc = alloc? alloc * 2 : 16;
+            ottd_table_field_t *fields = realloc(table->fields, alloc * sizeof *fields);
+            if (fields == NULL) goto fail;
+            table->fields = fields;
+        }
+        ottd_table_field_t *field = &table->fields[table->nfields++];
+        field->type = type;
+        field->sub = NULL;
+        if ((field->key = ottd_read_str(st)) == NULL) goto fail;
+    }
+    for(int i=0; i < table->nfields; i++) {
+        ottd_table_field_t *field = &table->fields[i];
+        if ((field->type & SLE_FILE_TYPE_MASK) != SLE_FILE_STRUCT) continue;
+        if ((field->sub = ottd_parse_table(st, depth + 1)) == NULL) goto fail;
+    }
+    return table;
+    
+fail:
+    ottd_free_table(table);
+    return NULL;
+}
+
+// the header is the first element of a table chunk
+static ottd_table_t* ottd_read_table_header(ottd_stream_t *st)
+{
+    uint32_t len = ottd_read_sg(st);
+    if (len == 0) return NULL;
+    uint64_t end = ottd_tell(st) + len - 1;
+    ottd_table_t *table = ottd_parse_table(st, 0);
+    if (table && ottd_tell(st) != end) {
+        ottd_free_table(table);
+        return NULL;
+    }
+    return table;
+}
+
+// steps to the next element of an array or table chunk, false at the end.
+// *len excludes the sparse index, empty elements only advance the index
+static bool ottd_array_next(ottd_stream_t *st, ottd_chunk_t *ch, uint32_t *index, uint32_t *len)
+{
+    uint32_t sg = ottd_read_sg(st);
+    if (sg == 0) return false;
+    *len = sg - 1;
+    if (ch->type == CH_SPARSE_ARRAY || ch->type == CH_SPARSE_TABLE) {
+        uint32_t sparse = ottd_read_sg(st);
+        size_t n = ottd_sg_len(sparse);
+        *len = (*len > n)? *len - n : 0;
+        ch->index = sparse;
+    }
+    *index = ch->index++;
+    if (*len) ch->elements++;
+    return true;
+}
+
+static const int ottd_field_size[] = {
+    [SLE_FILE_I8] = 1, [SLE_FILE_U8] = 1,
+    [SLE_FILE_I16] = 2, [SLE_FILE_U16] = 2,
+    [SLE_FILE_I32] = 4, [SLE_FILE_U32] = 4,
+    [SLE_FILE_I64] = 8, [SLE_FILE_U64] = 8,
+    [SLE_FILE_STRINGID] = 2,
+    [SLE_FILE_STRING] = 1,
+};
+
+// decodes one element with a table header, calling fn for each value
+static int ottd_read_fields(ottd_stream_t *st, const ottd_table_t *table, ottd_field_t *f, ottd_field_fn fn, void *ud)
+{
+    for(int i=0; i < table->nfields; i++) {
+        const ottd_table_field_t *field = &table->fields[i];
+        int type = field->type & SLE_FILE_TYPE_MASK;
+        uint32_t count = (field->type & SLE_FILE_HAS_LENGTH_FIELD)? ottd_read_sg(st) : 1;
+        
+        if (type == SLE_FILE_STRUCT) {
+            ottd_field_t sub = { .parent = field->key };
+            for(uint32_t j=0; j < count; j++) {
+                sub.parent_index = j;
+                if (ottd_read_fields(st, field->sub, &sub, fn, ud)) return -1;
+            }
+            continue;
+        }
+        
+        f->key = field->key;
+        f->index = 0;
+        f->count = count;
+        f->value = 0;
+        if (type == SLE_FILE_STRING) {
+            char *str = malloc(count + 1);
+            if (str == NULL || ottd_read_bytes(st, str, count) != count) {
+                free(str);
+                return -1;
+            }
+            str[count] = '\0';
+            f->str = str;
+            fn(ud, f);
+            f->str = NULL;
+            free(str);
+            continue;
+        }
+        
+        int size = ottd_field_size[type];
+        int is_signed = (type == SLE_FILE_I8 || type == SLE_FILE_I16 || type == SLE_FILE_I32 || type == SLE_FILE_I64);
+        for(uint32_t j=0; j < count; j++) {
+            uint8_t b[8];
+            if (ottd_read_bytes(st, b, size) != size) return -1;
+            uint64_t val = 0;
+            for(int k=0; k < size; k++) val = (val << 8) | b[k];
+            if (is_signed && size < 8) {
+                uint64_t sign = 1ULL << (size * 8 - 1);
+                val = (val ^ sign) - sign;
+            }
+            f->index = j;
+            f->value = (int64_t)val;
+            fn(ud, f);
+        }
+    }
     return 0;
 }
 
-#pragma mark - Chunk Reading
+static int ottd_read_element(ottd_stream_t *st, const ottd_table_t *table, ottd_field_fn fn, void *ud)
+{
+    ottd_field_t f = { 0 };
+    return ottd_read_fields(st, table, &f, fn, ud);
+}
 
-int ottd_skip_riff(FILE *fp, int verbose, ottd_t *save)
+// reads every element of a table chunk with fn, for chunks holding a single object
+static int ottd_read_table_chunk(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_chunk_t *ch, ottd_field_fn fn, void *ud)
 {
-    uint32_t len = ottd_read_riff_length(fp);
-    if (len == 0) return -1;
-    fseek(fp, len, SEEK_CUR);
+    uint32_t index, len;
+    while(ottd_array_next(st, ch, &index, &len)) {
+        uint64_t end = ottd_tell(st) + len;
+        if (len && ottd_read_element(st, ch->table, fn, ud)) return -1;
+        if (ottd_tell(st) > end) return -1;
+        ottd_seek(st, end);
+    }
     return 0;
 }
 
-int ottd_skip_array(FILE *fp, int verbose, ottd_t *save)
+#pragma mark - Chunk Reading
+
+// any chunk type, arrays and tables by element length
+int ottd_skip_chunk(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_chunk_t *ch)
 {
-    uint8_t mark = ottd_read_u8(fp);
-    if (mark != 1 && mark != 2) return -1; // array or sparse array marker
+    if (ch->type == CH_RIFF) {
+        ottd_skip(st, ch->length);
+        return 0;
+    }
     
-    // elements
+    // a table header is the first element
+    int header = (ch->type == CH_TABLE || ch->type == CH_SPARSE_TABLE);
     uint32_t len;
-    while((len = ottd_read_sg(fp))) {
-        fseek(fp, len - 1, SEEK_CUR);
+    while((len = ottd_read_sg(st))) {
+        if (header) header = 0;
+        else if (len > 1) ch->elements++;
+        ottd_skip(st, len - 1);
     }
-    
     return 0;
 }
 
-int ottd_skip_LGRS(FILE *fp, int verbose, ottd_t *save)
+static void ottd_MAPS_field(void *ud, const ottd_field_t *f)
 {
-    if (save->version < 191) {
-        return ottd_skip_array(fp, verbose, save);
-    } else {
-        return ottd_skip_riff(fp, verbose, save);
-    }
+    ottd_t *save = ud;
+    if (f->parent) return;
+    if (!strcmp(f->key, "dim_x")) save->mapSize.x = (uint32_t)f->value;
+    else if (!strcmp(f->key, "dim_y")) save->mapSize.y = (uint32_t)f->value;
 }
 
-int ottd_read_MAPS(FILE *fp, int verbose, ottd_t *save)
+int ottd_read_MAPS(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_chunk_t *ch)
 {
-    uint32_t len = ottd_read_riff_length(fp);
-    if (len < 8) return -1;
-    save->mapSize.x = ottd_read_u32(fp);
-    save->mapSize.y = ottd_read_u32(fp);
+    if (save->mapt || save->rle || save->memory || save->mapping || ctx->thumb) return ottd_error(ctx, OTTD_E_CORRUPT, "more than one MAPS chunk");
+    if (ch->table) {
+        if (ottd_read_table_chunk(st, ctx, ch, ottd_MAPS_field, save)) return -1;
+    } else if (ch->type == CH_RIFF) {
+        if (ch->length < 8) return -1;
+        save->mapSize.x = ottd_read_u32(st);
+        save->mapSize.y = ottd_read_u32(st);
+        ottd_skip(st, ch->length - 8);
+    } else {
+        return -1;
+    }
     Vprintf("Map size: %ux%u\n", save->mapSize.x, save->mapSize.y);
+    if (ctx->probe) return 0;
+    
+    // thumbnail planes, unless the map is small enough already
+    if (ctx->opts && ctx->opts->thumbnail && ctx->anatomy == NULL) {
+        if (ottd_thumb_create(ctx, save, ctx->opts->thumbnail)) return -1;
+        if (ctx->thumb) return 0;
+    }
     
-    // allocate tile types
-    save->tile = malloc(sizeof(ottd_tile_t*)*save->mapSize.y);
-    ottd_tile_t *ttmp = malloc(sizeof(ottd_tile_t)*save->mapSize.x*save->mapSize.y);
-    for(int i=0; i < save->mapSize.y; i++) {
-        save->tile[i] = &ttmp[save->mapSize.x*i];
+    // run-length planes grow as the rows are read, too wide maps are kept flat
+    if (ctx->opts && (ctx->opts->flags & OTTD_F_RLE_MAP)) {
+        if (save->mapSize.x > OTTD_RLE_MAX_WIDTH) {
+            Vprintf("map too wide for run-length planes, keeping them flat\n");
+        } else {
+            if ((save->rle = ottd_rle_create(ctx, save->mapSize.x, save->mapSize.y)) == NULL) return -1;
+            save->memory = ctx->memory;
+            return 0;
+        }
     }
     
-    if (len > 8) fseek(fp, len-8, SEEK_CUR);
+    // allocate planes, a byte per tile each, on the heap or in a scratch file when
+    // they don't fit the budget
+    uint64_t tiles = (uint64_t)save->mapSize.x * save->mapSize.y;
+    const char *scratch = ctx->opts? ctx->opts->scratch_dir : NULL;
+    if (tiles > SIZE_MAX / 2) return ottd_error(ctx, OTTD_E_NOMEM, "cannot allocate %ux%u map", save->mapSize.x, save->mapSize.y);
+    if (scratch && 2 * tiles > ottd_mem_available(ctx->memory)) return ottd_map_scratch(save, tiles, scratch, ctx);
+    if (ottd_mem_reserve(ctx, OTTD_MEM_MAP, 2 * tiles, "map")) return -1;
+    save->memory = ctx->memory;
+    save->mapt = calloc(tiles, 1);
+    save->mapo = calloc(tiles, 1);
+    if (save->mapt == NULL || save->mapo == NULL) {
+        if (scratch) {
+            free(save->mapt);
+            free(save->mapo);
+            save->mapt = save->mapo = NULL;
+            ottd_mem_release(save->memory, OTTD_MEM_MAP, 2 * tiles);
+            save->memory = NULL;
+            return ottd_map_scratch(save, tiles, scratch, ctx);
+        }
+        return ottd_error(ctx, OTTD_E_NOMEM, "cannot allocate %ux%u map", save->mapSize.x, save->mapSize.y);
+    }
     return 0;
 }
 
-int ottd_read_MAPT(FILE *fp, int verbose, ottd_t *save)
+int ottd_read_MAPT(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_chunk_t *ch)
 {
-    uint32_t len = ottd_read_riff_length(fp);
-    if (len != save->mapSize.x * save->mapSize.y) {
-        Veprintf("MAPT size doesn't match map size\n");
-        return -1;
+    if (ctx->probe) return ottd_skip_chunk(st, ctx, save, ch);
+    uint32_t len = ch->length;
+    if (ch->type == CH_RIFF && ctx->thumb) return ottd_thumb_read(st, ctx, save, 0, len);
+    if (ch->type != CH_RIFF || (save->mapt == NULL && save->rle == NULL) || len != (uint64_t)save->mapSize.x * save->mapSize.y) {
+        return ottd_error(ctx, OTTD_E_CORRUPT, "MAPT size doesn't match map size");
     }
     
-    // read tiles
-    uint8_t *tiles = ottd_read(fp, len);
-    for(int i=0; i < len; i++) {
-        save->tile[0][i].type = (tiles[i] & 0xF0) >> 4;
-        save->tile[0][i].height = tiles[i] & 0x0F;
+    // the plane is kept as it is, or as runs. territory is counted with MAPO, unless it came first
+    if (save->rle) {
+        if (ottd_rle_read(st, ctx, save->rle, 0)) return -1;
+    } else if (ottd_read_bytes(st, save->mapt, len) != len) {
+        return ottd_error(ctx, OTTD_E_CORRUPT, "MAPT truncated");
     }
-    
-    free(tiles);
+    ctx->planes |= 1;
+    if ((ctx->planes & 2) && ottd_territory_count(ctx, save)) return -1;
     return len;
 }
 
-int ottd_read_MAPO(FILE *fp, int verbose, ottd_t *save)
+int ottd_read_MAPO(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_chunk_t *ch)
 {
-    uint32_t len = ottd_read_riff_length(fp);
-    if (len != save->mapSize.x * save->mapSize.y) {
-        Veprintf("MAPT size doesn't match map size\n");
-        return -1;
+    if (ctx->probe) return ottd_skip_chunk(st, ctx, save, ch);
+    uint32_t len = ch->length;
+    if (ch->type == CH_RIFF && ctx->thumb) return ottd_thumb_read(st, ctx, save, 1, len);
+    if (ch->type != CH_RIFF || (save->mapo == NULL && save->rle == NULL) || len != (uint64_t)save->mapSize.x * save->mapSize.y) {
+        return ottd_error(ctx, OTTD_E_CORRUPT, "MAPO size doesn't match map size");
     }
     
-    // read tiles
-    uint8_t *tiles = ottd_read(fp, len);
-    for(int i=0; i < len; i++) {
-        save->tile[0][i].owner = tiles[i];
+    ctx->planes |= 2;
+    if (save->rle) {
+        if (ottd_rle_read(st, ctx, save->rle, 1)) return -1;
+        return ((ctx->planes & 1) && ottd_territory_count(ctx, save))? -1 : len;
     }
-    
-    free(tiles);
+    if (ctx->planes & 1) return ottd_territory_read(st, ctx, save, len);
+    if (ottd_read_bytes(st, save->mapo, len) != len) return ottd_error(ctx, OTTD_E_CORRUPT, "MAPO truncated");
     return len;
 }
 
-int ottd_read_DATE(FILE *fp, int verbose, ottd_t *save)
+static void ottd_DATE_field(void *ud, const ottd_field_t *f)
+{
+    if (f->parent == NULL && !strcmp(f->key, "date")) *(int32_t*)ud = (int32_t)f->value;
+}
+
+int ottd_read_DATE(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_chunk_t *ch)
 {
-    uint32_t len = ottd_read_riff_length(fp);
-    if (len == 0) return -1;
-    long end = ftell(fp) + len;
-    
     // read current date
-    int32_t date;
-    if (save->version < 31) {
-        date = ottd_read_u16(fp) + DAYS_TILL_ORIGINAL_BASE_YEAR;
+    int32_t date = 0;
+    if (ch->table) {
+        if (ottd_read_table_chunk(st, ctx, ch, ottd_DATE_field, &date)) return -1;
+    } else if (ch->type == CH_RIFF && ch->length) {
+        uint64_t end = ottd_tell(st) + ch->length;
+        if (save->version < 31) {
+            date = ottd_read_u16(st) + DAYS_TILL_ORIGINAL_BASE_YEAR;
+        } else {
+            date = ottd_read_u32(st);
+        }
+        // skip to end
+        ottd_seek(st, end);
     } else {
-        date = ottd_read_u32(fp);
+        return -1;
     }
     
     // deconstruct it
     ConvertDateToYMD(date, &save->curDate);
+    return 0;
+}
+
+#pragma mark - Schema tables
+
+// field offsets per version, see ottd_schema.h
+static const uint16_t ottd_pats_offsets[SL_MAX_VERSION+1][PATS_END+1] = { OTTD_V256(OTTD_PATS_ROW, 0) };
+static const uint16_t ottd_plyr_offsets[SL_MAX_VERSION+1][PLYR_END+1] = { OTTD_V256(OTTD_PLYR_ROW, 0) };
+static const uint16_t ottd_econ_offsets[SL_MAX_VERSION+1][ECON_END+1] = { OTTD_V256(OTTD_ECON_ROW, 0) };
+
+static void ottd_PATS_field(void *ud, const ottd_field_t *f)
+{
+    if (f->parent == NULL && !strcmp(f->key, "game_creation.starting_year")) *(int32_t*)ud = (int32_t)f->value;
+}
+
+int ottd_read_PATS(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_chunk_t *ch)
+{
+    // settings by name
+    if (ch->table) return ottd_read_table_chunk(st, ctx, ch, ottd_PATS_field, &save->startYear);
+    if (ch->type != CH_RIFF) return -1;
     
-    // skip to end
-    fseek(fp, end, SEEK_SET);
-    return len;
+    uint64_t end = ottd_tell(st) + ch->length;
+    const uint16_t *offsets = ottd_pats_offsets[OTTD_SCHEMA_VERSION(save->version)];
+    
+    // jump to start year
+    ottd_skip(st, offsets[PATS_STARTING_YEAR]);
+    save->startYear = ottd_read_u32(st);
+    
+    ottd_seek(st, end);
+    return 0;
 }
 
-int ottd_read_PATS(FILE *fp, int verbose, ottd_t *save)
-{
-    uint32_t len = ottd_read_riff_length(fp);
-    long end = ftell(fp) + len;
-    int version = save->version;
-    
-    // skip generated with gen_PATS_skip.rb
-    ottd_skip(fp, 28);
-    if (version >= 97) ottd_skip(fp, 22);
-    if (version >= 97 && version <= 110) ottd_skip(fp, 2);
-    if (version >= 97 && version <= 178) ottd_skip(fp, 1);
-    if (version >= 97 && version <= 164) ottd_skip(fp, 1);
-    if (version >= 194) ottd_skip(fp, 2);
-    if (version >= 154) ottd_skip(fp, 1);
-    if (version >= 156) ottd_skip(fp, 12);
-    if (version >= 175) ottd_skip(fp, 6);
-    if (version >= 75) ottd_skip(fp, 1);
-    if (version >= 159) ottd_skip(fp, 5);
-    if (version <= 159) ottd_skip(fp, 5);
-    if (version >= 59) ottd_skip(fp, 1);
-    if (version >= 113) ottd_skip(fp, 1);
-    if (version >= 128) ottd_skip(fp, 1);
-    if (version >= 143) ottd_skip(fp, 1);
-    if (version >= 208) ottd_skip(fp, 1);
-    if (version >= 183) ottd_skip(fp, 12);
-    if (version >= 139) ottd_skip(fp, 2);
-    if (version >= 133) ottd_skip(fp, 1);
-    if (version >= 145) ottd_skip(fp, 1);
-    if (version <= 87) ottd_skip(fp, 1);
-    if (version >= 28 && version <= 87) ottd_skip(fp, 3);
-    if (version >= 87) ottd_skip(fp, 3);
-    if (version <= 120) ottd_skip(fp, 9);
-    if (version >= 38) ottd_skip(fp, 1);
-    if (version >= 39) ottd_skip(fp, 1);
-    if (version >= 67 && version <= 159) ottd_skip(fp, 1);
-    if (version >= 90) ottd_skip(fp, 1);
-    if (version >= 95) ottd_skip(fp, 1);
-    if (version >= 138) ottd_skip(fp, 1);
-    if (version >= 22 && version <= 93) ottd_skip(fp, 2);
-    if (version >= 210) ottd_skip(fp, 1);
-    if (version >= 40) ottd_skip(fp, 1);
-    if (version >= 47) ottd_skip(fp, 1);
-    if (version >= 114) ottd_skip(fp, 1);
-    if (version >= 62) ottd_skip(fp, 1);
-    if (version >= 96) ottd_skip(fp, 1);
-    if (version >= 106) ottd_skip(fp, 1);
-    if (version >= 148) ottd_skip(fp, 1);
-    if (version <= 141) ottd_skip(fp, 1);
-    if (version >= 79) ottd_skip(fp, 2);
-    if (version >= 165) ottd_skip(fp, 1);
-    if (version >= 160) ottd_skip(fp, 1);
-    if (version <= 144) ottd_skip(fp, 4);
-    
-    // read start year
-    save->startYear = ottd_read_u32(fp);
-    
-    fseek(fp, end, SEEK_SET);
-    return len;
+void ottd_read_PLYR_economy(const uint8_t *rec, const uint16_t *offsets, CompanyEconomyEntry *econ)
+{
+    econ->income = (int64_t)ottd_schema_get(rec, offsets, ECON_INCOME);
+    econ->expenses = (int64_t)ottd_schema_get(rec, offsets, ECON_EXPENSES);
+    econ->company_value = (int64_t)ottd_schema_get(rec, offsets, ECON_COMPANY_VALUE);
+    econ->performance_history = (int32_t)ottd_schema_get(rec, offsets, ECON_PERFORMANCE_HISTORY);
+    
+    // total over cargo types
+    uint32_t delivered = 0;
+    for(int i=offsets[ECON_DELIVERED_CARGO]; i < offsets[ECON_DELIVERED_CARGO+1]; i += 4) {
+        delivered += ((uint32_t)rec[i] << 24) | (rec[i+1] << 16) | (rec[i+2] << 8) | rec[i+3];
+    }
+    econ->delivered_cargo = (int32_t)delivered;
+}
+
+// binary company record, after the name strings
+static int ottd_read_PLYR_company(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_company_t *company, uint64_t end)
+{
+    int version = OTTD_SCHEMA_VERSION(save->version);
+    const uint16_t *offsets = ottd_plyr_offsets[version];
+    const uint16_t *econ_offsets = ottd_econ_offsets[version];
+    uint8_t rec[1024];
+    uint8_t econ[(MAX_HISTORY_MONTHS + 1) * 288];
+    if (offsets[PLYR_END] > sizeof rec || econ_offsets[ECON_END] > 288) {
+        return ottd_error(ctx, OTTD_E_FORMAT, "PLYR layout too large for version %d", save->version);
+    }
+    
+    // everything up to the old ai settings has a fixed layout per version
+    if (ottd_read_bytes(st, rec, offsets[PLYR_END]) != offsets[PLYR_END]) {
+        return ottd_error(ctx, OTTD_E_CORRUPT, "PLYR truncated");
+    }
+    company->face = (uint32_t)ottd_schema_get(rec, offsets, PLYR_FACE);
+    company->money = (int64_t)ottd_schema_get(rec, offsets, PLYR_MONEY);
+    company->loan = (int64_t)ottd_schema_get(rec, offsets, PLYR_LOAN);
+    company->color = (uint8_t)ottd_schema_get(rec, offsets, PLYR_COLOUR);
+    company->inaugurated_year = (int32_t)ottd_schema_get(rec, offsets, PLYR_INAUGURATED_YEAR);
+    if (save->version < 31) company->inaugurated_year += ORIGINAL_BASE_YEAR;
+    company->num_valid_stat_ent = (uint8_t)ottd_schema_get(rec, offsets, PLYR_NUM_VALID_STAT_ENT);
+    if (company->num_valid_stat_ent > MAX_HISTORY_MONTHS) company->num_valid_stat_ent = MAX_HISTORY_MONTHS;
+    company->ai = ottd_schema_get(rec, offsets, PLYR_IS_AI)?true:false;
+    
+    // yearly expenses
+    const uint8_t *expenses = rec + offsets[PLYR_YEARLY_EXPENSES];
+    int size = (offsets[PLYR_YEARLY_EXPENSES+1] - offsets[PLYR_YEARLY_EXPENSES]) / (3 * EXPENSES_END);
+    for(int i=0; i < 3; i++) for(int j=0; j < EXPENSES_END; j++, expenses += size) {
+        uint64_t val = 0;
+        for(int k=0; k < size; k++) val = (val << 8) | expenses[k];
+        company->yearly_expenses[i][j] = (int64_t)val;
+    }
+    
+    // old ai settings
+    if (company->ai && save->version < 107) {
+        ottd_skip(st, 10);
+        ottd_skip(st, (save->version < 13)?2:4);
+        uint8_t num_build_rec = ottd_read_u8(st);
+        ottd_skip(st, (save->version < 6)?8:16);
+        ottd_skip(st, (save->version < 69)?2:4);
+        ottd_skip(st, 77);
+        if (save->version >= 2) ottd_skip(st, 64);
+        
+        for(int i=0; i < num_build_rec; i++) {
+            ottd_skip(st, (save->version < 6)?4:8);
+            ottd_skip(st, 8);
+        }
+    }
+    
+    // economy, current quarter then history, missing entries are left empty
+    size_t stride = econ_offsets[ECON_END];
+    size_t econ_len = (company->num_valid_stat_ent + 1) * stride;
+    uint64_t pos = ottd_tell(st);
+    if (pos + econ_len > end) {
+        Vprintf("PLYR economy truncated\n");
+        memset(econ, 0, econ_len);
+        econ_len = (pos < end)? end - pos : 0;
+    }
+    if (ottd_read_bytes(st, econ, econ_len) != econ_len) return ottd_error(ctx, OTTD_E_CORRUPT, "PLYR truncated");
+    ottd_read_PLYR_economy(econ, econ_offsets, &company->cur_economy);
+    for(int i=0; i < company->num_valid_stat_ent; i++)
+        ottd_read_PLYR_economy(econ + (i + 1) * stride, econ_offsets, &company->old_economy[i]);
+    return 0;
+}
+
+static void ottd_PLYR_economy_field(CompanyEconomyEntry *econ, const ottd_field_t *f)
+{
+    if (!strcmp(f->key, "income")) econ->income = f->value;
+    else if (!strcmp(f->key, "expenses")) econ->expenses = f->value;
+    else if (!strcmp(f->key, "company_value")) econ->company_value = f->value;
+    else if (!strcmp(f->key, "performance_history")) econ->performance_history = (int32_t)f->value;
+    else if (!strcmp(f->key, "delivered_cargo")) {
+        if (f->index == 0) econ->delivered_cargo = 0;
+        econ->delivered_cargo += (int32_t)f->value;
+    }
 }
 
-void ottd_read_PLYR_economy(FILE *fp, int version, CompanyEconomyEntry *econ)
+// company from a table element, by key
+static void ottd_PLYR_field(void *ud, const ottd_field_t *f)
 {
-    econ->income = (int64_t)(version < 2)?ottd_read_u32(fp):ottd_read_u64(fp);
-    econ->expenses = (int64_t)(version < 2)?ottd_read_u32(fp):ottd_read_u64(fp);
-    econ->company_value = (int64_t)(version < 2)?ottd_read_u32(fp):ottd_read_u64(fp);
-    econ->delivered_cargo = (int32_t)ottd_read_u32(fp);
-    econ->performance_history = (int32_t)ottd_read_u32(fp);
+    ottd_company_t *company = ud;
+    if (f->parent) {
+        if (!strcmp(f->parent, "cur_economy")) {
+            ottd_PLYR_economy_field(&company->cur_economy, f);
+        } else if (!strcmp(f->parent, "old_economy") && f->parent_index < MAX_HISTORY_MONTHS) {
+            ottd_PLYR_economy_field(&company->old_economy[f->parent_index], f);
+        }
+        return;
+    }
+    if (f->str) {
+        char **str = NULL;
+        if (!strcmp(f->key, "name")) str = &company->name;
+        else if (!strcmp(f->key, "president_name")) str = &company->manager;
+        if (str && *f->str && *str == NULL) *str = strdup(f->str);
+    }
+    else if (!strcmp(f->key, "face")) company->face = (uint32_t)f->value;
+    else if (!strcmp(f->key, "money")) company->money = f->value;
+    else if (!strcmp(f->key, "current_loan")) company->loan = f->value;
+    else if (!strcmp(f->key, "colour")) company->color = (uint8_t)f->value;
+    else if (!strcmp(f->key, "inaugurated_year")) company->inaugurated_year = (int32_t)f->value;
+    else if (!strcmp(f->key, "is_ai")) company->ai = f->value? true : false;
+    else if (!strcmp(f->key, "num_valid_stat_ent")) {
+        company->num_valid_stat_ent = (f->value > MAX_HISTORY_MONTHS)? MAX_HISTORY_MONTHS : (uint8_t)f->value;
+    } else if (!strcmp(f->key, "yearly_expenses")) {
+        // three years of however many expense types the save has
+        uint32_t types = f->count / 3;
+        if (types && f->index / types < 3 && f->index % types < EXPENSES_END) {
+            company->yearly_expenses[f->index / types][f->index % types] = f->value;
+        }
+    }
 }
 
-int ottd_read_PLYR(FILE *fp, int verbose, ottd_t *save)
+int ottd_read_PLYR(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, ottd_chunk_t *ch)
 {
-    uint8_t mark = ottd_read_u8(fp);
-    if (mark != 1 && mark != 2) return -1; // array or sparse array marker
+    if (ch->type == CH_RIFF) return -1;
     
     // elements
-    ottd_company_t *company = &save->company[0];
-    uint32_t len;
-    while((len = ottd_read_sg(fp))) {
-        if (len == 1) {
-            company->active = false;
-            // skip to next
-            company++;
+    uint32_t index, len;
+    while(ottd_array_next(st, ch, &index, &len)) {
+        if (len == 0 || index >= lengthof(save->company)) {
+            ottd_skip(st, len);
             continue;
         }
+        ottd_company_t *company = &save->company[index];
         company->active = true;
-        long end = ftell(fp) + len - 1;
-        // skip name args, openttd strings make me cry
-        ottd_skip(fp, 6);
-        // read name
-        char *name = (save->version >= 84)? ottd_read_str(fp) : NULL;
-        if (name == NULL) {
-            name = malloc(16);
-            sprintf(name, "Company %d", (int)((company-save->company)+1));
-        }
-        company->name = name;
+        uint64_t end = ottd_tell(st) + len;
         
-        // skip manager args
-        ottd_skip(fp, 6);
-        // read manager name
-        char *mgr = (save->version >= 84)? ottd_read_str(fp) : NULL;
-        company->manager = mgr?mgr:strdup("Unknown");
-        
-        // read more things
-        company->face = ottd_read_u32(fp);
-        company->money = (int64_t)(save->version > 0)?ottd_read_u64(fp):ottd_read_u32(fp);
-        company->loan = (save->version > 64)?ottd_read_u64(fp):ottd_read_u32(fp);
-        company->color = ottd_read_u8(fp);
-        
-        // skip
-        ottd_skip(fp, 1); // money fraction
-        if (save->version <= 57) ottd_skip(fp, 1); // available railtypes
-        ottd_skip(fp, 1); // block preview
-        
-        // skip cargo types
-        (save->version > 93)?ottd_read_u32(fp):ottd_read_u16(fp);
-        // skip hq location
-        (save->version > 5)?ottd_read_u32(fp):ottd_read_u16(fp);
-        // skip last build coord
-        (save->version > 5)?ottd_read_u32(fp):ottd_read_u16(fp);
-        // inaugurated year
-        if (save->version < 31) {
-            company->inaugurated_year = ottd_read_u8(fp) + ORIGINAL_BASE_YEAR;
+        if (ch->table) {
+            if (ottd_read_element(st, ch->table, ottd_PLYR_field, company)) return -1;
         } else {
-            company->inaugurated_year = (int32_t)ottd_read_u32(fp);
-        }
-        // skip share owners
-        ottd_skip(fp, 4);
-        // valid economy entries
-        company->num_valid_stat_ent = ottd_read_u8(fp);
-        if (company->num_valid_stat_ent > MAX_HISTORY_MONTHS) company->num_valid_stat_ent = MAX_HISTORY_MONTHS;
-        // skip bankrupcy data
-        ottd_skip(fp, 1 + (save->version>103?2:1) + 2 + (save->version>64?8:4));
-        // yearly expenses
-        for(int i=0; i < 3; i++) for(int j=0; j < 13; j++) {
-            company->yearly_expenses[i][j] = (int64_t)(save->version > 1)?ottd_read_u64(fp):ottd_read_u32(fp);
+            // skip name args, openttd strings make me cry
+            ottd_skip(st, 6);
+            // read name
+            company->name = (save->version >= 84)? ottd_read_str(st) : NULL;
+            // skip manager args
+            ottd_skip(st, 6);
+            // read manager name
+            company->manager = (save->version >= 84)? ottd_read_str(st) : NULL;
+            if (ottd_read_PLYR_company(st, ctx, save, company, end)) return -1;
         }
-        // ai
-        if (save->version >= 2) company->ai = ottd_read_u8(fp)?true:false;
-        if (save->version >= 107 && save->version <= 111) ottd_skip(fp, 1);
-        if (save->version >= 4 && save->version <= 99) ottd_skip(fp, 1);
-        // skip limits
-        if (save->version >= 156) ottd_skip(fp, 8);
+        if (ottd_tell(st) > end) return ottd_error(ctx, OTTD_E_CORRUPT, "PLYR element overrun");
         
-        // company settings we don't care about
-        if (save->version >= 16 && save->version <= 18) ottd_skip(fp, 512);
-        if (save->version >= 19 && save->version <= 68) ottd_skip(fp, 2);
-        if (save->version >= 69) ottd_skip(fp, 4);
-        if (save->version >= 16) ottd_skip(fp, 7);
-        if (save->version >= 2) ottd_skip(fp, 1);
-        if (save->version >= 120) ottd_skip(fp, 9);
-        if (save->version >= 2 && save->version <= 143) ottd_skip(fp, 63);
-        
-        // old ai settings
-        if (company->ai && save->version < 107) {
-            ottd_skip(fp, 10);
-            ottd_skip(fp, (save->version < 13)?2:4);
-            uint8_t num_build_rec = ottd_read_u8(fp);
-            ottd_skip(fp, (save->version < 6)?8:16);
-            ottd_skip(fp, (save->version < 69)?2:4);
-            ottd_skip(fp, 77);
-            if (save->version >= 2) ottd_skip(fp, 64);
-            
-            for(int i=0; i < num_build_rec; i++) {
-                ottd_skip(fp, (save->version < 6)?4:8);
-                ottd_skip(fp, 8);
-            }
+        if (company->name == NULL) {
+            company->name = malloc(16);
+            if (company->name) sprintf(company->name, "Company %d", (int)index + 1);
         }
-        
-        // economy
-        ottd_read_PLYR_economy(fp, save->version, &company->cur_economy);
-        for(int i=0; i < company->num_valid_stat_ent; i++)
-            ottd_read_PLYR_economy(fp, save->version, &company->old_economy[i]);
+        if (company->manager == NULL) company->manager = strdup("Unknown");
         
         // skip to next
-        fseek(fp, end, SEEK_SET);
-        company++;
+        ottd_seek(st, end);
     }
     
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "ottd_internal.h"
+
+// .ottdmap layout: header page, then the MAPT and MAPO planes, each starting on
+// an OTTD_MAP_ALIGN boundary. host byte order, the magic doubles as a byte order mark.
+// the header crc covers the header with the crc field zeroed, each plane has its own crc,
+// checked on open only with OTTD_F_VERIFY_CACHE so that a hit doesn't read the planes
+
+#define OTTD_ALIGN_UP(x) (((x) + OTTD_MAP_ALIGN - 1) & ~(uint64_t)(OTTD_MAP_ALIGN - 1))
+
+static uLong ottd_map_crc(uLong crc, const uint8_t *data, uint64_t len)
+{
+    while(len) {
+        uInt n = (len > (1u << 30))? (1u << 30) : (uInt)len;
+        crc = crc32(crc, data, n);
+        data += n;
+        len -= n;
+    }
+    return crc;
+}
+
+void ottd_unmap(void *addr, size_t len)
+{
+    munmap(addr, len);
+}
+
+// access hint for mapped planes: renders in nw mode read them row by row, the others jump around
+void ottd_map_advise(const ottd_t *game, int mode)
+{
+    if (game->mapping == NULL) return;
+    madvise(game->mapping, game->mapping_size, (mode == OTTD_MAP_NW)? MADV_SEQUENTIAL : MADV_NORMAL);
+}
+
+#pragma mark - Scratch
+
+// planes that don't fit the memory budget are backed by an unlinked scratch file in dir,
+// so the kernel can write them out instead of the process running out of memory
+int ottd_map_scratch(ottd_t *save, uint64_t tiles, const char *dir, ottd_ctx_t *ctx)
+{
+    char *path = NULL;
+    if (asprintf(&path, "%s/ottd-scratch-XXXXXX", dir) < 0) return ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        ottd_error(ctx, OTTD_E_IO, "%s: %s", path, strerror(errno));
+        free(path);
+        return -1;
+    }
+    unlink(path);
+    free(path);
+
+    // the file starts out sparse and zeroed, like calloc'd planes
+    size_t size = 2 * tiles;
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) map = mmap(NULL, size? size : 1, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int saved_errno = errno;
+    close(fd);
+    if (map == MAP_FAILED) return ottd_error(ctx, OTTD_E_IO, "%s: scratch file: %s", dir, strerror(saved_errno));
+    madvise(map, size, MADV_SEQUENTIAL); // MAPT and MAPO are written front to back
+    save->mapping = map;
+    save->mapping_size = size;
+    save->mapt = map;
+    save->mapo = (uint8_t*)map + tiles;
+    Vprintf("map planes backed by a %llu byte scratch file in %s\n", (unsigned long long)size, dir);
+    return 0;
+}
+
+#pragma mark - Reading
+
+// maps a cache, returns NULL without recording an error if it's missing, stale or damaged
+ottd_t* ottd_map_cache_open(const char *path, const struct stat *source, ottd_ctx_t *ctx)
+{
+    ottd_t *game = NULL;
+    void *map = MAP_FAILED;
+    struct stat sb;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &sb) || sb.st_size < sizeof(ottd_map_header_t)) goto fail;
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); fd = -1;
+    if (map == MAP_FAILED) goto fail;
+
+    // validate, each plane must fit the file without the offsets wrapping around
+    const ottd_map_header_t *h = map;
+    uint64_t tiles = (uint64_t)h->x * h->y, size = sb.st_size;
+    if (h->magic != OTTD_MAP_MAGIC || h->version != OTTD_MAP_VERSION || h->align != OTTD_MAP_ALIGN || tiles > size ||
+        h->mapt_offset < sizeof *h || h->mapt_offset > size - tiles || h->mapo_offset > size - tiles ||
+        h->mapo_offset < h->mapt_offset + tiles) {
+        Vprintf("%s: not a map cache\n", path);
+        goto fail;
+    }
+    if (source && (h->source_size != source->st_size || h->source_mtime != ottd_mtime_ns(source))) {
+        Vprintf("%s: map cache is stale\n", path);
+        goto fail;
+    }
+    // the crc covers the planes too, so opening reads the whole file once before
+    // ottd_territory_count reads the planes again
+    ottd_map_header_t hcopy = *h;
+    hcopy.crc = 0;
+    if (ottd_map_crc(crc32(0, Z_NULL, 0), (const uint8_t*)&hcopy, sizeof hcopy) != h->crc) {
+        Vprintf("%s: map cache checksum mismatch\n", path);
+        goto fail;
+    }
+    if (ctx->opts && (ctx->opts->flags & OTTD_F_VERIFY_CACHE) &&
+        (ottd_map_crc(crc32(0, Z_NULL, 0), (const uint8_t*)map + h->mapt_offset, tiles) != h->mapt_crc ||
+         ottd_map_crc(crc32(0, Z_NULL, 0), (const uint8_t*)map + h->mapo_offset, tiles) != h->mapo_crc)) {
+        Vprintf("%s: map cache planes checksum mismatch\n", path);
+        goto fail;
+    }
+
+    // the planes point into the mapping
+    game = calloc(1, sizeof *game);
+    if (game == NULL) goto fail;
+    game->mapping = map;
+    game->mapping_size = sb.st_size;
+    game->version = h->save_version;
+    game->mapSize.x = h->x;
+    game->mapSize.y = h->y;
+    game->startYear = h->start_year;
+    game->curDate.year = h->cur_year;
+    game->curDate.month = h->cur_month;
+    game->curDate.day = h->cur_day;
+    game->mapt = (uint8_t*)map + h->mapt_offset;
+    game->mapo = (uint8_t*)map + h->mapo_offset;
+    for(int i=0; i < lengthof(game->company); i++) {
+        const ottd_map_company_t *c = &h->company[i];
+        ottd_company_t *cmp = &game->company[i];
+        cmp->active = c->active;
+        cmp->ai = c->ai;
+        cmp->color = c->color;
+        if (!cmp->active) continue;
+        cmp->face = c->face;
+        cmp->inaugurated_year = c->inaugurated_year;
+        cmp->money = c->money;
+        cmp->loan = c->loan;
+        memcpy(cmp->yearly_expenses, c->yearly_expenses, sizeof cmp->yearly_expenses);
+        cmp->cur_economy = c->cur_economy;
+        memcpy(cmp->old_economy, c->old_economy, sizeof cmp->old_economy);
+        cmp->num_valid_stat_ent = c->num_valid_stat_ent;
+        cmp->name = strndup(c->name, sizeof c->name);
+        cmp->manager = strndup(c->manager, sizeof c->manager);
+        if (cmp->name == NULL || cmp->manager == NULL) {
+            ottd_free(game);
+            return NULL;
+        }
+    }
+    // the territory was counted when the cache was written
+    if (h->flags & OTTD_MAP_TERRITORY) {
+        game->territory = malloc(sizeof *game->territory);
+        if (game->territory == NULL) {
+            ottd_free(game);
+            return NULL;
+        }
+        *game->territory = h->territory;
+    } else if (ottd_territory_count(ctx, game)) {
+        ottd_free(game);
+        return NULL;
+    }
+    Vprintf("using map cache %s\n", path);
+    return game;
+
+fail:
+    if (fd >= 0) close(fd);
+    if (map != MAP_FAILED) munmap(map, sb.st_size);
+    return NULL;
+}
+
+ottd_t* ottd_open_map_cache(const char *cache_path, const char *save_path, const ottd_options_t *opts, ottd_error_t *err)
+{
+    ottd_ctx_t ctx_, *ctx = &ctx_;
+    ottd_ctx_init(ctx, opts, err);
+    struct stat sb;
+    if (save_path && stat(save_path, &sb)) {
+        ottd_error(ctx, OTTD_E_IO, "%s: %s", save_path, strerror(errno));
+        return NULL;
+    }
+    ottd_t *game = ottd_map_cache_open(cache_path, save_path? &sb : NULL, ctx);
+    if (game == NULL) ottd_error(ctx, OTTD_E_FORMAT, "%s: missing, stale or damaged map cache", cache_path);
+    return game;
+}
+
+#pragma mark - Writing
+
+// writes to a temporary file and moves it into place, errors are only logged
+int ottd_map_cache_write(const ottd_t *game, const char *path, uint32_t format, const struct stat *source, ottd_ctx_t *ctx)
+{
+    if (game->mapt == NULL || game->mapo == NULL || game->scale) return -1;
+    uint64_t tiles = (uint64_t)game->mapSize.x * game->mapSize.y;
+    char *tmp_path = NULL;
+    FILE *fp = NULL;
+    int ret = -1;
+
+    ottd_map_header_t *h = calloc(1, sizeof *h);
+    if (h == NULL) goto end;
+    h->magic = OTTD_MAP_MAGIC;
+    h->version = OTTD_MAP_VERSION;
+    h->align = OTTD_MAP_ALIGN;
+    h->source_size = source? source->st_size : 0;
+    h->source_mtime = source? ottd_mtime_ns(source) : 0;
+    h->mapt_offset = OTTD_ALIGN_UP(sizeof *h);
+    h->mapo_offset = OTTD_ALIGN_UP(h->mapt_offset + tiles);
+    h->format = format;
+    h->save_version = game->version;
+    h->x = game->mapSize.x;
+    h->y = game->mapSize.y;
+    h->start_year = game->startYear;
+    h->cur_year = game->curDate.year;
+    h->cur_month = game->curDate.month;
+    h->cur_day = game->curDate.day;
+    for(int i=0; i < lengthof(h->company); i++) {
+        const ottd_company_t *cmp = &game->company[i];
+        ottd_map_company_t *c = &h->company[i];
+        c->active = cmp->active;
+        c->ai = cmp->ai;
+        c->color = cmp->color;
+        if (!cmp->active) continue;
+        c->face = cmp->face;
+        c->inaugurated_year = cmp->inaugurated_year;
+        c->money = cmp->money;
+        c->loan = cmp->loan;
+        memcpy(c->yearly_expenses, cmp->yearly_expenses, sizeof c->yearly_expenses);
+        c->cur_economy = cmp->cur_economy;
+        memcpy(c->old_economy, cmp->old_economy, sizeof c->old_economy);
+        c->num_valid_stat_ent = cmp->num_valid_stat_ent;
+        if (cmp->name) strncpy(c->name, cmp->name, sizeof c->name);
+        if (cmp->manager) strncpy(c->manager, cmp->manager, sizeof c->manager);
+    }
+    if (game->territory) {
+        h->flags |= OTTD_MAP_TERRITORY;
+        h->territory = *game->territory;
+    }
+
+    // checksums
+    static const uint8_t zeros[OTTD_MAP_ALIGN];
+    uint64_t pad1 = h->mapt_offset - sizeof *h, pad2 = h->mapo_offset - h->mapt_offset - tiles;
+    h->mapt_crc = (uint32_t)ottd_map_crc(crc32(0, Z_NULL, 0), game->mapt, tiles);
+    h->mapo_crc = (uint32_t)ottd_map_crc(crc32(0, Z_NULL, 0), game->mapo, tiles);
+    h->crc = (uint32_t)ottd_map_crc(crc32(0, Z_NULL, 0), (const uint8_t*)h, sizeof *h);
+
+    if (asprintf(&tmp_path, "%s.tmp", path) < 0) {
+        tmp_path = NULL;
+        goto end;
+    }
+    fp = fopen(tmp_path, "wb");
+    if (fp == NULL) goto end;
+    int failed = fwrite(h, sizeof *h, 1, fp) != 1 ||
+        fwrite(zeros, 1, pad1, fp) != pad1 ||
+        fwrite(game->mapt, 1, tiles, fp) != tiles ||
+        fwrite(zeros, 1, pad2, fp) != pad2 ||
+        fwrite(game->mapo, 1, tiles, fp) != tiles;
+    if (fclose(fp)) failed = 1;
+    fp = NULL;
+    if (failed || rename(tmp_path, path)) {
+        unlink(tmp_path);
+        goto end;
+    }
+    Vprintf("wrote map cache %s\n", path);
+    ret = 0;
+
+end:
+    if (ret) Veprintf("could not write map cache %s\n", path);
+    if (fp) fclose(fp);
+    free(tmp_path);
+    free(h);
+    return ret;
+}
+
+int ottd_write_map_cache(const ottd_t *game, const char *cache_path, const char *save_path, const ottd_options_t *opts, ottd_error_t *err)
+{
+    ottd_ctx_t ctx_, *ctx = &ctx_;
+    ottd_ctx_init(ctx, opts, err);
+    struct stat sb;
+    if (game && game->rle) return ottd_error(ctx, OTTD_E_ARG, "run-length maps can't be cached");
+    if (game && game->scale) return ottd_error(ctx, OTTD_E_ARG, "thumbnails can't be cached");
+    if (game == NULL || game->mapt == NULL) return ottd_error(ctx, OTTD_E_ARG, "no map to cache");
+    if (save_path && stat(save_path, &sb)) return ottd_error(ctx, OTTD_E_IO, "%s: %s", save_path, strerror(errno));
+    if (ottd_map_cache_write(game, cache_path, 0, save_path? &sb : NULL, ctx)) {
+        return ottd_error(ctx, OTTD_E_IO, "%s: could not write map cache", cache_path);
+    }
+    return 0;
+}
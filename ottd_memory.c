@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "ottd_internal.h"
+
+// one ottd_memory_t can be shared by every call in a process, so the counters are
+// updated with atomics. the budget is enforced where memory is reserved up front,
+// decoder internals are only charged
+
+static void ottd_mem_peak(uint64_t *peak, uint64_t value)
+{
+    uint64_t p = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while(value > p && !__atomic_compare_exchange_n(peak, &p, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void ottd_mem_charge_stage(ottd_memory_t *mem, int stage, uint64_t size)
+{
+    ottd_mem_peak(&mem->stage[stage].peak, __atomic_add_fetch(&mem->stage[stage].current, size, __ATOMIC_RELAXED));
+}
+
+void ottd_mem_charge(ottd_memory_t *mem, int stage, uint64_t size)
+{
+    if (mem == NULL) return;
+    ottd_mem_peak(&mem->peak, __atomic_add_fetch(&mem->current, size, __ATOMIC_RELAXED));
+    ottd_mem_charge_stage(mem, stage, size);
+}
+
+// charges size if it fits in the budget, records OTTD_E_BUDGET otherwise
+int ottd_mem_reserve(ottd_ctx_t *ctx, int stage, uint64_t size, const char *what)
+{
+    ottd_memory_t *mem = ctx->memory;
+    if (mem == NULL) return 0;
+    uint64_t cur = __atomic_load_n(&mem->current, __ATOMIC_RELAXED);
+    do {
+        if (mem->budget && (size > mem->budget || cur > mem->budget - size)) {
+            return ottd_error(ctx, OTTD_E_BUDGET, "%s needs %llu bytes, %llu left of the memory budget", what,
+                (unsigned long long)size, (unsigned long long)((cur < mem->budget)? mem->budget - cur : 0));
+        }
+    } while(!__atomic_compare_exchange_n(&mem->current, &cur, cur + size, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    ottd_mem_peak(&mem->peak, cur + size);
+    ottd_mem_charge_stage(mem, stage, size);
+    return 0;
+}
+
+void ottd_mem_release(ottd_memory_t *mem, int stage, uint64_t size)
+{
+    if (mem == NULL) return;
+    __atomic_sub_fetch(&mem->current, size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&mem->stage[stage].current, size, __ATOMIC_RELAXED);
+}
+
+// what's left of the budget, UINT64_MAX without one
+uint64_t ottd_mem_available(const ottd_memory_t *mem)
+{
+    if (mem == NULL || mem->budget == 0) return UINT64_MAX;
+    uint64_t cur = __atomic_load_n(&mem->current, __ATOMIC_RELAXED);
+    return (cur < mem->budget)? mem->budget - cur : 0;
+}
+
+// allocator hooks for libraries that free without a size, which is kept in front
+void* ottd_mem_hook_alloc(ottd_memory_t *mem, int stage, size_t size)
+{
+    uint64_t *p = malloc(size + 16);
+    if (p == NULL) return NULL;
+    p[0] = size;
+    ottd_mem_charge(mem, stage, size);
+    return p + 2;
+}
+
+void ottd_mem_hook_free(ottd_memory_t *mem, int stage, void *ptr)
+{
+    if (ptr == NULL) return;
+    uint64_t *p = (uint64_t*)ptr - 2;
+    ottd_mem_release(mem, stage, p[0]);
+    free(p);
+}
+
+const char* ottd_mem_stage_name(int stage)
+{
+    static const char *names[OTTD_MEM_STAGES] = {
+        [OTTD_MEM_DECOMPRESS] = "decompress",
+        [OTTD_MEM_MAP] = "map",
+        [OTTD_MEM_RENDER] = "render",
+        [OTTD_MEM_ANALYSIS] = "analysis",
+    };
+    return (stage >= 0 && stage < OTTD_MEM_STAGES)? names[stage] : "unknown";
+}
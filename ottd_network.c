@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ottd_internal.h"
+
+// networks: rail, road, station and tunnel/bridge tiles of one company joined by their
+// edges, so a tunnel or bridge joins what's next to its heads but not its two ends. the
+// map is cut in bands of rows that threads take in turn, labelling each with a union-find
+// over a parent per tile, where a parent always comes before its child. the rows where
+// bands meet are then joined on the calling thread. a last pass in tile order turns the
+// parents into network numbers, as a tile's parent was numbered before the tile, and
+// adds up the networks as it goes
+
+#define OTTD_NETWORK_BAND_ROWS 64
+#define OTTD_NETWORK_NONE 0xFF
+
+typedef struct ottd_network_job {
+    const ottd_t *game;
+    uint32_t *parent;
+    uint32_t bands;
+    uint32_t next;          // next band, taken atomically
+    int      failed;        // stop taking bands
+    int      code;          // why
+    ottd_ctx_t ctx;         // without a progress callback, which is only called on the calling thread
+    ottd_options_t opts;
+} ottd_network_job_t;
+
+static inline uint8_t ottd_network_owner(uint8_t mapt, uint8_t mapo)
+{
+    int owner;
+    switch(mapt >> 4) {
+        case MP_RAILWAY:
+        case MP_STATION:
+        case MP_TUNNELBRIDGE:
+            owner = mapo & 0x1F;
+            break;
+        case MP_ROAD:
+            owner = mapo;
+            break;
+        default:
+            return OTTD_NETWORK_NONE;
+    }
+    return (owner < OWNER_TOWN)? owner : OTTD_NETWORK_NONE;
+}
+
+// the company whose network each tile of row y is on, or OTTD_NETWORK_NONE
+static void ottd_network_row(const ottd_t *game, uint32_t y, uint8_t *owner)
+{
+    uint32_t width = game->mapSize.x;
+    if (game->rle) {
+        ottd_rle_row_t r;
+        ottd_rle_row_begin(&r, game->rle, y);
+        while(r.x < width) {
+            uint32_t first = r.x, last;
+            uint8_t mapt, mapo;
+            last = ottd_rle_row_next(&r, &mapt, &mapo);
+            memset(owner + first, ottd_network_owner(mapt, mapo), last - first + 1);
+        }
+        return;
+    }
+    const uint8_t *mapt = game->mapt + (size_t)y * width, *mapo = game->mapo + (size_t)y * width;
+    for(uint32_t x=0; x < width; x++) owner[x] = ottd_network_owner(mapt[x], mapo[x]);
+}
+
+static inline uint32_t ottd_network_find(uint32_t *parent, uint32_t i)
+{
+    while(parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// hangs the later root under the earlier one
+static inline void ottd_network_union(uint32_t *parent, uint32_t a, uint32_t b)
+{
+    a = ottd_network_find(parent, a);
+    b = ottd_network_find(parent, b);
+    if (a < b) parent[b] = a;
+    else if (b < a) parent[a] = b;
+}
+
+static void ottd_network_band(ottd_network_job_t *job, uint32_t band, uint8_t *rows[2])
+{
+    const ottd_t *game = job->game;
+    uint32_t width = game->mapSize.x, height = game->mapSize.y;
+    uint32_t y0 = band * OTTD_NETWORK_BAND_ROWS;
+    uint32_t y1 = (height - y0 < OTTD_NETWORK_BAND_ROWS)? height : y0 + OTTD_NETWORK_BAND_ROWS;
+    uint32_t *parent = job->parent;
+    for(uint32_t y=y0; y < y1; y++) {
+        uint8_t *owner = rows[y & 1], *above = rows[~y & 1];
+        ottd_network_row(game, y, owner);
+        uint32_t i = y * width;
+        for(uint32_t x=0; x < width; x++, i++) {
+            if (owner[x] == OTTD_NETWORK_NONE) continue;
+            parent[i] = i;
+            if (x > 0 && owner[x - 1] == owner[x]) ottd_network_union(parent, i - 1, i);
+            if (y > y0 && above[x] == owner[x]) ottd_network_union(parent, i - width, i);
+        }
+    }
+}
+
+static void ottd_network_fail(ottd_network_job_t *job, int code)
+{
+    int expected = 0;
+    if (__atomic_compare_exchange_n(&job->failed, &expected, 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) job->code = code;
+}
+
+// labels bands until there are none left. ctx is the caller's on the calling thread, so
+// its progress callback sees the bands taken so far
+static void ottd_network_bands(ottd_network_job_t *job, ottd_ctx_t *ctx)
+{
+    uint32_t width = job->game->mapSize.x;
+    uint8_t *rows[2] = { malloc(width), malloc(width) };
+    if (rows[0] == NULL || rows[1] == NULL) ottd_network_fail(job, OTTD_E_NOMEM);
+    while(!__atomic_load_n(&job->failed, __ATOMIC_RELAXED)) {
+        uint32_t band = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (band >= job->bands) break;
+        int code = ottd_interrupted(ctx, OTTD_STAGE_ANALYSIS, band, job->bands);
+        if (code != OTTD_OK) {
+            ottd_network_fail(job, code);
+            break;
+        }
+        ottd_network_band(job, band, rows);
+    }
+    free(rows[0]);
+    free(rows[1]);
+}
+
+static void* ottd_network_work(void *arg)
+{
+    ottd_network_job_t *job = arg;
+    ottd_network_bands(job, &job->ctx);
+    return NULL;
+}
+
+static int ottd_network_compare(const void *a, const void *b)
+{
+    const ottd_network_t *na = a, *nb = b;
+    if (na->owner != nb->owner) return na->owner - nb->owner;
+    return (na->tiles < nb->tiles) - (na->tiles > nb->tiles);
+}
+
+// sorts the networks by company, largest first, and renumbers the labels to match
+static int ottd_network_sort(ottd_networks_t *nets, uint32_t tiles)
+{
+    for(uint32_t n=0; n < nets->count; n++) nets->network[n].id = n + 1;
+    qsort(nets->network, nets->count, sizeof *nets->network, ottd_network_compare);
+    for(uint32_t n=0; n < nets->count; n++) nets->companies[nets->network[n].owner]++;
+    if (nets->labels == NULL) return 0;
+    uint32_t *number = malloc(((size_t)nets->count + 1) * sizeof *number);
+    if (number == NULL) return -1;
+    number[0] = 0;
+    for(uint32_t n=0; n < nets->count; n++) number[nets->network[n].id] = n + 1;
+    for(uint32_t i=0; i < tiles; i++) nets->labels[i] = number[nets->labels[i]];
+    for(uint32_t n=0; n < nets->count; n++) nets->network[n].id = n + 1;
+    free(number);
+    return 0;
+}
+
+int ottd_find_networks(const ottd_t *game, ottd_networks_t *nets, int labels, const ottd_options_t *opts, ottd_error_t *err)
+{
+    ottd_ctx_t ctx;
+    ottd_ctx_init(&ctx, opts, err);
+    memset(nets, 0, sizeof *nets);
+    if (game == NULL || ((game->mapt == NULL || game->mapo == NULL) && game->rle == NULL)) return ottd_error(&ctx, OTTD_E_ARG, "no map to analyse");
+    uint32_t width = game->mapSize.x, height = game->mapSize.y;
+    uint64_t tiles = (uint64_t)width * height;
+    if (tiles >= UINT32_MAX) return ottd_error(&ctx, OTTD_E_ARG, "%ux%u map too large for networks", width, height);
+    uint64_t size = tiles * sizeof(uint32_t);
+    if (ottd_mem_reserve(&ctx, OTTD_MEM_ANALYSIS, size, "network labels")) return -1;
+
+    int stage = ottd_perf_enter(&ctx, OTTD_PERF_NETWORK);
+    ottd_network_job_t job = { .game = game, .bands = (height + OTTD_NETWORK_BAND_ROWS - 1) / OTTD_NETWORK_BAND_ROWS };
+    uint32_t *parent = job.parent = malloc(size? size : 1);
+    uint8_t *owner = malloc(width), *above = malloc(width);
+    if (parent == NULL || owner == NULL || above == NULL) {
+        ottd_error(&ctx, OTTD_E_NOMEM, "cannot allocate network labels for %ux%u map", width, height);
+        goto fail;
+    }
+
+    // label the bands in parallel
+    job.ctx = ctx;
+    job.ctx.err = &job.ctx.local_err;
+    job.ctx.perf = NULL;
+    if (opts) {
+        job.opts = *opts;
+        job.opts.progress = NULL;
+        job.ctx.opts = &job.opts;
+    }
+    pthread_t threads[OTTD_MAX_THREADS];
+    int nthreads = ottd_render_threads(&ctx, job.bands), started = 0;
+    for(int i=1; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, ottd_network_work, &job)) break;
+        started = i;
+    }
+    ottd_network_bands(&job, &ctx);
+    for(int i=1; i <= started; i++) pthread_join(threads[i], NULL);
+    if (job.failed) {
+        ottd_error(&ctx, job.code, "%s", ottd_strerror(job.code));
+        goto fail;
+    }
+
+    // join the bands where they meet
+    for(uint32_t y=OTTD_NETWORK_BAND_ROWS; y < height; y += OTTD_NETWORK_BAND_ROWS) {
+        ottd_network_row(game, y - 1, above);
+        ottd_network_row(game, y, owner);
+        uint32_t i = y * width;
+        for(uint32_t x=0; x < width; x++, i++) {
+            if (owner[x] != OTTD_NETWORK_NONE && above[x] == owner[x]) ottd_network_union(parent, i - width, i);
+        }
+    }
+
+    // number the networks in tile order and add them up. parents become numbers from 1
+    uint32_t alloc = 0;
+    for(uint32_t y=0; y < height; y++) {
+        if (y % 256 == 0 && ottd_check(&ctx, OTTD_STAGE_ANALYSIS, y, height)) goto fail;
+        ottd_network_row(game, y, owner);
+        uint32_t i = y * width;
+        for(uint32_t x=0; x < width; x++, i++) {
+            if (owner[x] == OTTD_NETWORK_NONE) {
+                parent[i] = 0;
+                continue;
+            }
+            uint32_t p = parent[i];
+            if (p == i) {
+                if (nets->count == alloc) {
+                    alloc = alloc? alloc * 2 : 64;
+                    ottd_network_t *network = realloc(nets->network, alloc * sizeof *network);
+                    if (network == NULL) {
+                        ottd_error(&ctx, OTTD_E_NOMEM, "out of memory");
+                        goto fail;
+                    }
+                    nets->network = network;
+                }
+                ottd_network_t *n = &nets->network[nets->count];
+                memset(n, 0, sizeof *n);
+                n->owner = owner[x];
+                n->x0 = n->x1 = x;
+                n->y0 = y;
+                parent[i] = ++nets->count;
+            } else {
+                parent[i] = parent[p];
+            }
+            ottd_network_t *n = &nets->network[parent[i] - 1];
+            n->tiles++;
+            if (x < n->x0) n->x0 = x;
+            if (x > n->x1) n->x1 = x;
+            n->y1 = y;
+        }
+    }
+
+    nets->width = width;
+    nets->height = height;
+    nets->memory = ctx.memory;
+    if (labels) nets->labels = parent;
+    if (ottd_network_sort(nets, (uint32_t)tiles)) {
+        ottd_error(&ctx, OTTD_E_NOMEM, "out of memory");
+        nets->labels = NULL;
+        goto fail;
+    }
+    if (labels == 0) {
+        free(parent);
+        ottd_mem_release(ctx.memory, OTTD_MEM_ANALYSIS, size);
+    }
+    free(owner);
+    free(above);
+    ottd_perf_enter(&ctx, stage);
+    return 0;
+fail:
+    free(parent);
+    free(owner);
+    free(above);
+    ottd_mem_release(ctx.memory, OTTD_MEM_ANALYSIS, size);
+    free(nets->network);
+    memset(nets, 0, sizeof *nets);
+    ottd_perf_enter(&ctx, stage);
+    return -1;
+}
+
+void ottd_networks_free(ottd_networks_t *nets)
+{
+    if (nets->labels) ottd_mem_release(nets->memory, OTTD_MEM_ANALYSIS, (uint64_t)nets->width * nets->height * sizeof *nets->labels);
+    free(nets->labels);
+    free(nets->network);
+    memset(nets, 0, sizeof *nets);
+}
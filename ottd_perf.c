@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ottd_internal.h"
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+// hardware counters per stage: one counter group for the calling thread, read
+// whenever the stage changes and the difference added to the stage being left.
+// without perf_event_open, or when it isn't permitted, only the time is kept
+
+#ifdef __linux__
+static const uint64_t ottd_perf_config[OTTD_PERF_COUNTERS] = {
+    [OTTD_PERF_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+    [OTTD_PERF_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+    [OTTD_PERF_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+    [OTTD_PERF_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static void ottd_perf_open(ottd_perf_t *perf)
+{
+    for(int i=0; i < OTTD_PERF_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = ottd_perf_config[i];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = (perf->group < 0);
+        attr.exclude_kernel = 1; // allowed with perf_event_paranoid up to 2
+        attr.exclude_hv = 1;
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, perf->group, 0);
+        perf->fd[i] = fd;
+        if (fd < 0) continue;
+        if (perf->group < 0) perf->group = fd;
+        perf->available |= 1 << i;
+    }
+    if (perf->group >= 0) ioctl(perf->group, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+// counter values in group order, which is OTTD_PERF_* order without the missing ones
+static void ottd_perf_read(ottd_perf_t *perf, uint64_t *values)
+{
+    uint64_t buf[1 + OTTD_PERF_COUNTERS];
+    memset(values, 0, OTTD_PERF_COUNTERS * sizeof *values);
+    if (perf->group < 0 || read(perf->group, buf, sizeof buf) < (ssize_t)sizeof(uint64_t)) return;
+    for(int i=0, n=0; i < OTTD_PERF_COUNTERS && n < buf[0]; i++) {
+        if (perf->available & (1 << i)) values[i] = buf[1 + n++];
+    }
+}
+#else
+static void ottd_perf_open(ottd_perf_t *perf)
+{
+}
+
+static void ottd_perf_read(ottd_perf_t *perf, uint64_t *values)
+{
+    memset(values, 0, OTTD_PERF_COUNTERS * sizeof *values);
+}
+#endif
+
+// charges the time and counters since the last switch to the current stage, returns it
+int ottd_perf_switch(ottd_perf_t *perf, int stage)
+{
+    if (!perf->opened) {
+        perf->opened = 1;
+        perf->group = -1;
+        perf->current = -1;
+        ottd_perf_open(perf);
+    }
+    int prev = perf->current;
+    if (stage == prev) return prev;
+    uint64_t values[OTTD_PERF_COUNTERS];
+    uint64_t now = ottd_clock_ns();
+    ottd_perf_read(perf, values);
+    if (prev >= 0) {
+        perf->stage[prev].time_ns += now - perf->last_ns;
+        for(int i=0; i < OTTD_PERF_COUNTERS; i++) perf->stage[prev].count[i] += values[i] - perf->last[i];
+    }
+    memcpy(perf->last, values, sizeof values);
+    perf->last_ns = now;
+    perf->current = stage;
+    return prev;
+}
+
+void ottd_perf_close(ottd_perf_t *perf)
+{
+    if (!perf->opened) return;
+    for(int i=0; i < OTTD_PERF_COUNTERS; i++) {
+        if (perf->available & (1 << i)) close(perf->fd[i]);
+    }
+    perf->opened = 0;
+}
+
+const char* ottd_perf_stage_name(int stage)
+{
+    static const char *names[OTTD_PERF_STAGES] = {
+        [OTTD_PERF_DECOMPRESS] = "decompress",
+        [OTTD_PERF_PARSE] = "chunk parse",
+        [OTTD_PERF_MAP] = "MAPT/MAPO",
+        [OTTD_PERF_COLOR] = "colour mapping",
+        [OTTD_PERF_ENCODE] = "encode",
+        [OTTD_PERF_NETWORK] = "networks",
+    };
+    return (stage >= 0 && stage < OTTD_PERF_STAGES)? names[stage] : "unknown";
+}
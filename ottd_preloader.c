@@ -1,241 +1,383 @@
 #include <lzma.h>
 #include <zlib.h>
 #include <lzo/lzo1x.h>
-#include "ottd.h"
+#include "ottd_internal.h"
 
-#define Vprintf(...) do{if(verbose){printf(__VA_ARGS__);}}while(0);
-#define Veprintf(...) do{if(verbose){fprintf(stderr, __VA_ARGS__);}}while(0);
-#define eprintf(...) fprintf(stderr, __VA_ARGS__);
+// decompression is pull-based: the loader reads from an ottd_stream_t, which
+// decodes one block at a time into its buffer as the read position reaches it
 
-FILE* ottd_tmpfile()
+#define LZO_BUFFER_SIZE 8192
+
+#pragma mark - No compression
+
+static int ottd_fill_none(ottd_stream_t *st)
 {
-    return tmpfile();
+    size_t br = fread(st->buf, 1, OTTD_STREAM_BUFSZ, st->fp);
+    if (br == 0 && ferror(st->fp)) return ottd_error(st->ctx, OTTD_E_IO, "fread: %s", strerror(errno));
+    st->len = br;
+    st->in_total += br;
+    return (int)br;
 }
 
-FILE* ottd_decompress_none(FILE *fp, uint16_t version, int verbose)
+// the file is the stream, so skipping past the buffer is a seek
+static uint64_t ottd_skip_none(ottd_stream_t *st, uint64_t len)
 {
-    FILE *tf = ottd_tmpfile();
-    if (tf == NULL) {
-        Veprintf("tmpfile: %s", strerror(errno));
-        return NULL;
-    }
-    
-    // copy whole file starting at 8
-    fseek(fp, 8, SEEK_SET);
-    size_t bufsz = 64 * 1024, bufrd;
-    uint8_t *buf = malloc(bufsz);
-    while(!feof(fp)) {
-        bufrd = fread(buf, 1, bufsz, fp);
-        fwrite(buf, 1, bufrd, tf);
+    if (fseeko(st->fp, len, SEEK_CUR)) {
+        ottd_error(st->ctx, OTTD_E_IO, "fseek: %s", strerror(errno));
+        st->eof = 1;
+        return 0;
     }
-    free(buf);
-    
-    rewind(tf);
-    return tf;
+    st->offset += len;
+    st->in_start = st->in_total += len;
+    return len;
 }
 
-FILE* ottd_decompress_lzo(FILE *fp, uint16_t version, int verbose)
+#pragma mark - LZO
+
+static int ottd_fill_lzo(ottd_stream_t *st)
 {
-    Vprintf("decompressing lzo...\n");
-    
-    FILE *tf = ottd_tmpfile();
-    if (tf == NULL) {
-        Veprintf("tmpfile: %s", strerror(errno));
-        return NULL;
+    // openttd told me to do this
+    uint8_t out[LZO_BUFFER_SIZE + LZO_BUFFER_SIZE / 16 + 64 + 3 + 8];
+    uint32_t tmp[2], size;
+    lzo_uint len;
+
+    // read header
+    size_t br = fread(tmp, 1, 8, st->fp);
+    if (br == 0 && feof(st->fp)) return 0;
+    if (br != 8) goto read_error;
+
+    // check size
+    ((uint32_t*)out)[0] = size = tmp[1];
+    if (st->version != 0) {
+        tmp[0] = ntohl(tmp[0]);
+        size = ntohl(size);
     }
-    
-    // initialize decoder
-    if (lzo_init() != LZO_E_OK) {
-        Veprintf("could not initialize decompressor\n");
-        fclose(tf);
-        return NULL;
+    if (size >= sizeof(out) - 4) {
+        return ottd_error(st->ctx, OTTD_E_DECOMPRESS, "corrupt lzo block: inconsistent size");
     }
-    
-    // buffers
-    size_t LZO_BUFFER_SIZE = 8192;
-    uint8_t buf[LZO_BUFFER_SIZE + 64];
-    do {
-        // openttd told me to do this
-        uint8_t out[LZO_BUFFER_SIZE + LZO_BUFFER_SIZE / 16 + 64 + 3 + 8];
-        uint32_t tmp[2], size;
-        lzo_uint len;
-        
-        // read header
-        size_t br = fread(tmp, 1, 8, fp);
-        if (br == 0 && feof(fp)) break;
-        if (br != 8) goto read_error;
-        
-        // check size
-        ((uint32_t*)out)[0] = size = tmp[1];
-        if (version != 0) {
-            tmp[0] = ntohl(tmp[0]);
-            size = ntohl(size);
-        }
-        if (size >= sizeof(out)) {
-            eprintf("corrupt lzo block: inconsistent size\n");
-            fclose(tf);
-            return NULL;
-        }
-        
-        // read block
-        if (fread(out+4, 1, size, fp) != size) goto read_error;
-        
-        // verify checksum
-        if (tmp[0] != lzo_adler32(0, out, size + 4)) {
-            eprintf("corrupt lzo block: bad checksum\n");
-            fclose(tf);
-            return NULL;
-        }
-        
-        // decompress
-        lzo1x_decompress(out + 4, size, buf, &len, NULL);
-        
-        // write
-        fwrite(buf, 1, len, tf);
-    } while(1);
-    
-    // end
-    rewind(tf);
-    return tf;
+
+    // read block
+    if (fread(out+4, 1, size, st->fp) != size) goto read_error;
+
+    // verify checksum
+    if (tmp[0] != lzo_adler32(0, out, size + 4)) {
+        return ottd_error(st->ctx, OTTD_E_DECOMPRESS, "corrupt lzo block: bad checksum");
+    }
+
+    // decompress
+    len = LZO_BUFFER_SIZE;
+    if (lzo1x_decompress_safe(out + 4, size, st->buf, &len, NULL) != LZO_E_OK) {
+        return ottd_error(st->ctx, OTTD_E_DECOMPRESS, "corrupt lzo block");
+    }
+    st->len = len;
+    st->in_total += 8 + size;
+    return (int)len;
 
 read_error:
-    eprintf("fread: %s\n", strerror(errno));
-    fclose(tf);
-    return NULL;
+    if (ferror(st->fp)) return ottd_error(st->ctx, OTTD_E_IO, "fread: %s", strerror(errno));
+    return ottd_error(st->ctx, OTTD_E_DECOMPRESS, "unexpected end of compressed data");
 }
 
-FILE* ottd_decompress_zlib(FILE *fp, uint16_t version, int verbose)
+#pragma mark - zlib
+
+typedef struct ottd_zlib_state {
+    z_stream z;
+    uint8_t rbuf[OTTD_STREAM_BUFSZ];
+} ottd_zlib_state_t;
+
+static voidpf ottd_zlib_alloc(voidpf opaque, uInt items, uInt size)
 {
-    Vprintf("decompressing zlib...\n");
-    
-    FILE *tf = ottd_tmpfile();
-    if (tf == NULL) {
-        Veprintf("tmpfile: %s", strerror(errno));
-        return NULL;
-    }
-    
-    // init decoder
-    z_stream z = {
-        .zalloc = NULL,
-        .zfree = NULL,
-        .opaque = NULL,
-        .avail_in = 0,
-        .next_in = NULL
-    };
-    if (inflateInit(&z) != Z_OK) {
-        Veprintf("could not initialize decompressor\n");
-        fclose(tf);
-        return NULL;
+    return ottd_mem_hook_alloc(opaque, OTTD_MEM_DECOMPRESS, (size_t)items * size);
+}
+
+static void ottd_zlib_free(voidpf opaque, voidpf address)
+{
+    ottd_mem_hook_free(opaque, OTTD_MEM_DECOMPRESS, address);
+}
+
+static ottd_zlib_state_t* ottd_zlib_state(ottd_stream_t *st)
+{
+    ottd_zlib_state_t *zs = calloc(1, sizeof *zs);
+    if (zs == NULL) return NULL;
+    if (st->ctx->memory) {
+        zs->z.zalloc = ottd_zlib_alloc;
+        zs->z.zfree = ottd_zlib_free;
+        zs->z.opaque = st->ctx->memory;
     }
-    
-    // buffers
-    size_t bufsz = 64 * 1024, bufrd;
-    uint8_t *rbuf = malloc(bufsz);
-    uint8_t *wbuf = malloc(bufsz);
-    
+    ottd_mem_charge(st->ctx->memory, OTTD_MEM_DECOMPRESS, sizeof *zs);
+    st->charged += sizeof *zs;
+    return zs;
+}
+
+static int ottd_fill_zlib(ottd_stream_t *st)
+{
+    ottd_zlib_state_t *zs = st->state;
+    z_stream *z = &zs->z;
+    ottd_index_t *idx = (st->index && st->index->building)? st->index : NULL;
+    size_t bufrd;
+
+    z->next_out = st->buf;
+    z->avail_out = OTTD_STREAM_BUFSZ;
     do {
         // read from file
-        if (z.avail_in == 0) {
-            if ((bufrd = fread(rbuf, 1, bufsz, fp)) <= 0) {
-                eprintf("fread: %s\n", strerror(errno));
-                free(rbuf); free(wbuf);
-                fclose(tf);
-                inflateEnd(&z);
-                return NULL;
+        if (z->avail_in == 0) {
+            if ((bufrd = fread(zs->rbuf, 1, sizeof zs->rbuf, st->fp)) <= 0) {
+                return ottd_error(st->ctx, OTTD_E_DECOMPRESS, "unexpected end of compressed data");
             }
-            z.next_in = rbuf;
-            z.avail_in = (uInt)bufrd;
+            z->next_in = zs->rbuf;
+            z->avail_in = (uInt)bufrd;
         }
-        
-        // decode
-        z.next_out = wbuf;
-        z.avail_out = (uInt)bufsz;
-        int r = inflate(&z, Z_NO_FLUSH);
-        
-        // write decoded
-        if ((bufsz - z.avail_out) > 0) {
-            fwrite(wbuf, 1, bufsz - z.avail_out, tf);
-        }
-        
-        // end?
+
+        // decode, stopping at block boundaries when indexing
+        uint8_t *out = z->next_out;
+        int r = inflate(z, idx? Z_BLOCK : Z_NO_FLUSH);
         if (r == Z_STREAM_END) break;
-        if (r != Z_OK) {
-            eprintf("zlib not ok\n");
-            free(rbuf); free(wbuf);
-            fclose(tf);
-            inflateEnd(&z);
-            return NULL;
+        if (r != Z_OK) return ottd_error(st->ctx, OTTD_E_DECOMPRESS, "zlib error %d", r);
+        if (idx) {
+            ottd_index_track(idx, out, z->next_out - out);
+            uint64_t pos = st->offset + (z->next_out - st->buf);
+            if ((z->data_type & 128) && !(z->data_type & 64) && pos - idx->last >= OTTD_INDEX_SPAN) {
+                ottd_index_add_point(idx, pos, ftello(st->fp) - z->avail_in, z->data_type & 7, 1);
+            }
         }
-    } while(1);
-    
-    // end
-    inflateEnd(&z);
-    free(rbuf); free(wbuf);
-    rewind(tf);
-    return tf;
-}
-
-FILE* ottd_decompress_lzma(FILE *fp, uint16_t version, int verbose)
-{
-    Vprintf("decompressing lzma...\n");
-    
-    FILE *tf = ottd_tmpfile();
-    if (tf == NULL) {
-        Veprintf("tmpfile: %s", strerror(errno));
-        return NULL;
+    } while(z->avail_out > 0);
+
+    st->len = OTTD_STREAM_BUFSZ - z->avail_out;
+    st->in_total = z->total_in;
+    return (int)st->len;
+}
+
+// restarts raw inflate at the last index point before the target, zran-style
+static uint64_t ottd_skip_zlib_indexed(ottd_stream_t *st, uint64_t len)
+{
+    ottd_zlib_state_t *zs = st->state;
+    z_stream *z = &zs->z;
+    const ottd_index_point_t *pt = ottd_index_find(st->index, st->offset + len);
+    if (pt == NULL || pt->out <= st->offset) return 0;
+
+    uint8_t window[OTTD_INDEX_WINDOW];
+    off_t in = st->index->data_offset + pt->in;
+    if (inflateReset2(z, -15) != Z_OK || fseeko(st->fp, in - (pt->bits? 1 : 0), SEEK_SET)) goto fail;
+    if (pt->bits) {
+        int ch = getc(st->fp);
+        if (ch == EOF || inflatePrime(z, pt->bits, ch >> (8 - pt->bits)) != Z_OK) goto fail;
     }
-    
-    // init decoder
-    lzma_stream lzma = LZMA_STREAM_INIT;
-    if (lzma_auto_decoder(&lzma, 1 << 28, 0) != LZMA_OK) {
-        Veprintf("could not initialize decompressor\n");
-        fclose(tf);
-        return NULL;
+    if (pt->window != OTTD_INDEX_NO_WINDOW) {
+        if (ottd_index_window(st->index, pt, window) || inflateSetDictionary(z, window, OTTD_INDEX_WINDOW) != Z_OK) goto fail;
     }
-    
-    // buffers
-    size_t bufsz = 64 * 1024, bufrd;
-    uint8_t *rbuf = malloc(bufsz);
-    uint8_t *wbuf = malloc(bufsz);
-    
+    z->avail_in = 0;
+    uint64_t skipped = pt->out - st->offset;
+    st->offset = pt->out;
+    return skipped;
+
+fail:
+    ottd_error(st->ctx, OTTD_E_DECOMPRESS, "cannot resume at seek index point");
+    st->eof = 1;
+    return 0;
+}
+
+static void ottd_close_zlib(ottd_stream_t *st)
+{
+    ottd_zlib_state_t *zs = st->state;
+    inflateEnd(&zs->z);
+    free(zs);
+}
+
+#pragma mark - LZMA
+
+typedef struct ottd_lzma_state {
+    lzma_stream lzma;
+    lzma_allocator allocator;
+    uint8_t rbuf[OTTD_STREAM_BUFSZ];
+} ottd_lzma_state_t;
+
+#define OTTD_LZMA_MEMLIMIT (1 << 28)
+
+static void* ottd_lzma_alloc(void *opaque, size_t nmemb, size_t size)
+{
+    return ottd_mem_hook_alloc(opaque, OTTD_MEM_DECOMPRESS, nmemb * size);
+}
+
+static void ottd_lzma_free(void *opaque, void *ptr)
+{
+    ottd_mem_hook_free(opaque, OTTD_MEM_DECOMPRESS, ptr);
+}
+
+static int ottd_fill_lzma(ottd_stream_t *st)
+{
+    ottd_lzma_state_t *ls = st->state;
+    lzma_stream *lzma = &ls->lzma;
+    size_t bufrd;
+
+    lzma->next_out = st->buf;
+    lzma->avail_out = OTTD_STREAM_BUFSZ;
     do {
         // read from file
-        if (lzma.avail_in == 0) {
-            if ((bufrd = fread(rbuf, 1, bufsz, fp)) <= 0) {
-                eprintf("fread: %s\n", strerror(errno));
-                free(rbuf); free(wbuf);
-                fclose(tf);
-                lzma_end(&lzma);
-                return NULL;
+        if (lzma->avail_in == 0) {
+            if ((bufrd = fread(ls->rbuf, 1, sizeof ls->rbuf, st->fp)) <= 0) {
+                return ottd_error(st->ctx, OTTD_E_DECOMPRESS, "unexpected end of compressed data");
             }
-            lzma.next_in = rbuf;
-            lzma.avail_in = bufrd;
+            lzma->next_in = ls->rbuf;
+            lzma->avail_in = bufrd;
         }
-        
+
         // decode
-        lzma.next_out = wbuf;
-        lzma.avail_out = bufsz;
-        lzma_ret r = lzma_code(&lzma, LZMA_RUN);
-        
-        // write decoded
-        if ((bufsz - lzma.avail_out) > 0) {
-            fwrite(wbuf, 1, bufsz - lzma.avail_out, tf);
-        }
-        
-        // end?
+        lzma_ret r = lzma_code(lzma, LZMA_RUN);
         if (r == LZMA_STREAM_END) break;
-        if (r != LZMA_OK) {
-            eprintf("lzma not ok\n");
-            free(rbuf); free(wbuf);
-            fclose(tf);
-            lzma_end(&lzma);
-            return NULL;
+        if (r == LZMA_MEMLIMIT_ERROR && lzma_memlimit_get(lzma) < OTTD_LZMA_MEMLIMIT) {
+            return ottd_error(st->ctx, OTTD_E_BUDGET, "lzma decoder needs %llu bytes, over the memory budget", (unsigned long long)lzma_memusage(lzma));
+        }
+        if (r != LZMA_OK) return ottd_error(st->ctx, OTTD_E_DECOMPRESS, "lzma error %d", r);
+    } while(lzma->avail_out > 0);
+
+    st->len = OTTD_STREAM_BUFSZ - lzma->avail_out;
+    st->in_total = lzma->total_in;
+    return (int)st->len;
+}
+
+static void ottd_close_lzma(ottd_stream_t *st)
+{
+    ottd_lzma_state_t *ls = st->state;
+    lzma_end(&ls->lzma);
+    free(ls);
+}
+
+#pragma mark - Streams
+
+int ottd_stream_open(ottd_stream_t *st, FILE *fp, uint32_t format, uint16_t version, ottd_index_t *index, ottd_ctx_t *ctx)
+{
+    memset(st, 0, sizeof *st);
+    st->ctx = ctx;
+    st->fp = fp;
+    st->version = version;
+    st->index = index;
+    if (ottd_mem_reserve(ctx, OTTD_MEM_DECOMPRESS, OTTD_STREAM_BUFSZ, "stream buffer")) return -1;
+    st->charged = OTTD_STREAM_BUFSZ;
+    st->buf = malloc(OTTD_STREAM_BUFSZ);
+    if (st->buf == NULL) goto nomem;
+
+    // the index has a re-encoded copy, read that instead
+    if (index && !index->building && index->data_size) {
+        Vprintf("decompressing indexed copy...\n");
+        ottd_zlib_state_t *zs = ottd_zlib_state(st);
+        if (zs == NULL) goto nomem;
+        if (inflateInit2(&zs->z, -15) != Z_OK) {
+            free(zs);
+            goto init_error;
         }
-    } while(1);
-    
-    // end
-    lzma_end(&lzma);
-    free(rbuf); free(wbuf);
-    rewind(tf);
-    return tf;
+        st->fp = index->fp;
+        st->state = zs;
+        st->fill = ottd_fill_zlib;
+        st->skip = ottd_skip_zlib_indexed;
+        st->close = ottd_close_zlib;
+        if (fseeko(st->fp, index->data_offset, SEEK_SET)) {
+            ottd_stream_close(st);
+            return ottd_error(ctx, OTTD_E_IO, "fseek: %s", strerror(errno));
+        }
+        return 0;
+    }
+
+    switch(format) {
+        case 'OTTN':
+            st->fill = ottd_fill_none;
+            st->skip = ottd_skip_none;
+            break;
+        case 'OTTD':
+            Vprintf("decompressing lzo...\n");
+            if (lzo_init() != LZO_E_OK) goto init_error;
+            st->fill = ottd_fill_lzo;
+            break;
+        case 'OTTZ': {
+            Vprintf("decompressing zlib...\n");
+            ottd_zlib_state_t *zs = ottd_zlib_state(st);
+            if (zs == NULL) goto nomem;
+            if (inflateInit(&zs->z) != Z_OK) {
+                free(zs);
+                goto init_error;
+            }
+            st->state = zs;
+            st->fill = ottd_fill_zlib;
+            st->close = ottd_close_zlib;
+            if (index && !index->building) st->skip = ottd_skip_zlib_indexed;
+            break;
+        }
+        case 'OTTX': {
+            Vprintf("decompressing lzma...\n");
+            ottd_lzma_state_t *ls = calloc(1, sizeof *ls);
+            if (ls == NULL) goto nomem;
+            ottd_mem_charge(ctx->memory, OTTD_MEM_DECOMPRESS, sizeof *ls);
+            st->charged += sizeof *ls;
+            lzma_stream init = LZMA_STREAM_INIT;
+            ls->lzma = init;
+            if (ctx->memory) {
+                ls->allocator = (lzma_allocator){ ottd_lzma_alloc, ottd_lzma_free, ctx->memory };
+                ls->lzma.allocator = &ls->allocator;
+            }
+            // the dictionary is the big one, keep it within what's left of the budget
+            uint64_t memlimit = ottd_mem_available(ctx->memory);
+            if (memlimit > OTTD_LZMA_MEMLIMIT) memlimit = OTTD_LZMA_MEMLIMIT;
+            if (memlimit == 0) memlimit = 1;
+            if (lzma_auto_decoder(&ls->lzma, memlimit, 0) != LZMA_OK) {
+                free(ls);
+                goto init_error;
+            }
+            st->state = ls;
+            st->fill = ottd_fill_lzma;
+            st->close = ottd_close_lzma;
+            break;
+        }
+        default:
+            ottd_stream_close(st);
+            return ottd_error(ctx, OTTD_E_FORMAT, "unsupported format: %c%c%c%c", TYPECHARS(format));
+    }
+    return 0;
+
+nomem:
+    ottd_stream_close(st);
+    return ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+init_error:
+    ottd_stream_close(st);
+    return ottd_error(ctx, OTTD_E_DECOMPRESS, "could not initialize decompressor");
+}
+
+void ottd_stream_close(ottd_stream_t *st)
+{
+    if (st->close) st->close(st);
+    st->close = NULL;
+    free(st->buf);
+    st->buf = NULL;
+    ottd_mem_release(st->ctx->memory, OTTD_MEM_DECOMPRESS, st->charged);
+    st->charged = 0;
+}
+
+// decodes the next block, returns its size, 0 at the end of the stream or -1
+int ottd_stream_refill(ottd_stream_t *st)
+{
+    if (st->eof) return 0;
+    st->offset += st->len;
+    st->pos = st->len = 0;
+    st->in_start = st->in_total;
+    if (ottd_check(st->ctx, OTTD_STAGE_DECOMPRESS, st->offset, 0)) {
+        st->eof = 1;
+        return -1;
+    }
+    int stage = ottd_perf_enter(st->ctx, OTTD_PERF_DECOMPRESS);
+    uint64_t trace_begin = ottd_trace_begin(st->ctx);
+    int r = st->fill(st);
+    ottd_trace_end(st->ctx, OTTD_SPAN_BLOCK, trace_begin, 0, (r > 0)? r : 0);
+    ottd_perf_enter(st->ctx, stage);
+    if (r <= 0) {
+        st->len = 0;
+        st->eof = 1;
+    } else if (st->index && st->index->encoding) {
+        ottd_index_feed(st->index, st->buf, st->len);
+    }
+    return r;
+}
+
+// compressed bytes consumed up to the read position, in proportion within the current block
+uint64_t ottd_stream_in_tell(ottd_stream_t *st)
+{
+    if (st->len == 0) return st->in_total;
+    return st->in_start + (st->in_total - st->in_start) * st->pos / st->len;
 }
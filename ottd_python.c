@@ -0,0 +1,506 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "ottd.h"
+
+// python module: ottd.load returns a Save with the metadata as python objects and the
+// MAPT and MAPO planes as read-only buffers, so numpy.asarray(save.mapt) is a view of the
+// loaded map rather than a copy. loading and rendering run without the GIL. a save can't
+// be closed while a render runs on another thread or a plane buffer is held
+
+typedef struct {
+    PyObject_HEAD
+    ottd_t      *game;      // NULL once closed
+    int         busy;       // renders running without the GIL
+    Py_ssize_t  exports;    // plane buffers held
+    PyObject    *companies; // built on first use
+} ottd_py_save_t;
+
+typedef struct {
+    PyObject_HEAD
+    ottd_py_save_t *save;
+    int         plane;      // 0 for MAPT, 1 for MAPO
+    Py_ssize_t  shape[2], strides[2];
+} ottd_py_plane_t;
+
+typedef struct {
+    PyObject_HEAD
+    ottd_view_t view;
+    Py_ssize_t  shape[3], strides[3];
+} ottd_py_image_t;
+
+#define OTTD_PY_YEARS 3  // of yearly_expenses
+
+static PyObject *ottd_py_error;
+static PyTypeObject ottd_py_save_type, ottd_py_plane_type, ottd_py_image_type;
+
+static PyObject* ottd_py_raise(const ottd_error_t *err)
+{
+    PyObject *exc = PyObject_CallFunction(ottd_py_error, "s", err->message);
+    if (exc == NULL) return NULL;
+    PyObject *code = PyLong_FromLong(err->code);
+    if (code) PyObject_SetAttrString(exc, "code", code);
+    Py_XDECREF(code);
+    PyErr_SetObject(ottd_py_error, exc);
+    Py_DECREF(exc);
+    return NULL;
+}
+
+static int ottd_py_mode(const char *name)
+{
+    if (name == NULL || strcmp(name, "nw") == 0) return OTTD_MAP_NW;
+    if (strcmp(name, "ne") == 0) return OTTD_MAP_NE;
+    if (strcmp(name, "iso") == 0) return OTTD_MAP_ISO;
+    PyErr_Format(PyExc_ValueError, "unknown map mode '%s', expected nw, ne or iso", name);
+    return -1;
+}
+
+static int ottd_py_open(ottd_py_save_t *self)
+{
+    if (self->game) return 0;
+    PyErr_SetString(PyExc_ValueError, "save is closed");
+    return -1;
+}
+
+#pragma mark - Metadata
+
+static PyObject* ottd_py_economy(const CompanyEconomyEntry *e)
+{
+    return Py_BuildValue("{s:L,s:L,s:i,s:i,s:L}", "income", (long long)e->income, "expenses", (long long)e->expenses,
+        "delivered_cargo", (int)e->delivered_cargo, "performance", (int)e->performance_history, "company_value", (long long)e->company_value);
+}
+
+static PyObject* ottd_py_company(int id, const ottd_company_t *c)
+{
+    PyObject *expenses = PyList_New(OTTD_PY_YEARS);
+    PyObject *history = PyList_New(0);
+    PyObject *economy = ottd_py_economy(&c->cur_economy);
+    PyObject *company = NULL;
+    if (expenses == NULL || history == NULL || economy == NULL) goto end;
+    for(int y=0; y < OTTD_PY_YEARS; y++) {
+        PyObject *year = PyList_New(EXPENSES_END);
+        if (year == NULL) goto end;
+        PyList_SET_ITEM(expenses, y, year);
+        for(int i=0; i < EXPENSES_END; i++) {
+            PyObject *v = PyLong_FromLongLong(c->yearly_expenses[y][i]);
+            if (v == NULL) goto end;
+            PyList_SET_ITEM(year, i, v);
+        }
+    }
+    for(int i=0; i < c->num_valid_stat_ent && i < MAX_HISTORY_MONTHS; i++) {
+        PyObject *entry = ottd_py_economy(&c->old_economy[i]);
+        if (entry == NULL || PyList_Append(history, entry)) {
+            Py_XDECREF(entry);
+            goto end;
+        }
+        Py_DECREF(entry);
+    }
+    png_color rgb = ottd_color[ottd_company_color(c->color)];
+    company = Py_BuildValue("{s:i,s:z,s:z,s:O,s:I,s:i,s:L,s:L,s:i,s:(iii),s:O,s:O,s:O}",
+        "id", id, "name", c->name, "manager", c->manager, "ai", c->ai? Py_True : Py_False, "face", (unsigned int)c->face,
+        "inaugurated", (int)c->inaugurated_year, "money", (long long)c->money, "loan", (long long)c->loan,
+        "color", (int)c->color, "rgb", rgb.red, rgb.green, rgb.blue,
+        "expenses", expenses, "economy", economy, "history", history);
+end:
+    Py_XDECREF(expenses);
+    Py_XDECREF(history);
+    Py_XDECREF(economy);
+    return company;
+}
+
+static PyObject* ottd_py_save_companies(ottd_py_save_t *self, void *closure)
+{
+    if (self->companies == NULL) {
+        if (ottd_py_open(self)) return NULL;
+        PyObject *list = PyList_New(0);
+        for(int i=0; list && i < 15; i++) {
+            const ottd_company_t *c = ottd_company(self->game, i);
+            if (!c->active) continue;
+            PyObject *company = ottd_py_company(i, c);
+            if (company == NULL || PyList_Append(list, company)) Py_CLEAR(list);
+            Py_XDECREF(company);
+        }
+        if (list == NULL) return NULL;
+        self->companies = list;
+    }
+    Py_INCREF(self->companies);
+    return self->companies;
+}
+
+static PyObject* ottd_py_save_int(ottd_py_save_t *self, void *closure)
+{
+    if (ottd_py_open(self)) return NULL;
+    const ottd_t *game = self->game;
+    uint32_t width, height;
+    ottd_map_size(game, &width, &height);
+    switch((int)(intptr_t)closure) {
+        case 0: return PyLong_FromLong(ottd_version(game));
+        case 1: return PyLong_FromUnsignedLong(width);
+        case 2: return PyLong_FromUnsignedLong(height);
+        case 3: return PyLong_FromLong(ottd_start_year(game));
+        default: return PyLong_FromUnsignedLong(ottd_map_scale(game));
+    }
+}
+
+static PyObject* ottd_py_save_date(ottd_py_save_t *self, void *closure)
+{
+    if (ottd_py_open(self)) return NULL;
+    YearMonthDay d = ottd_current_date(self->game);
+    return Py_BuildValue("(iii)", (int)d.year, d.month + 1, (int)d.day);
+}
+
+static PyObject* ottd_py_save_plane(ottd_py_save_t *self, void *closure)
+{
+    if (ottd_py_open(self)) return NULL;
+    const ottd_t *game = self->game;
+    if (ottd_map_types(game) == NULL || ottd_map_owners(game) == NULL) {
+        PyErr_SetString(PyExc_ValueError, "map is run-length encoded, load it without rle for its planes");
+        return NULL;
+    }
+    ottd_py_plane_t *plane = PyObject_New(ottd_py_plane_t, &ottd_py_plane_type);
+    if (plane == NULL) return NULL;
+    Py_INCREF(self);
+    plane->save = self;
+    plane->plane = (int)(intptr_t)closure;
+    uint32_t width, height;
+    ottd_map_size(game, &width, &height);
+    plane->shape[0] = height;
+    plane->shape[1] = width;
+    plane->strides[0] = width;
+    plane->strides[1] = 1;
+    return (PyObject*)plane;
+}
+
+#pragma mark - Rendering
+
+static PyObject* ottd_py_save_render(ottd_py_save_t *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"mode", "rgba", "hillshade", "threads", NULL};
+    const char *mode_name = NULL;
+    int rgba = 0, hillshade = 0, threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$sppi", keywords, &mode_name, &rgba, &hillshade, &threads)) return NULL;
+    int mode = ottd_py_mode(mode_name);
+    if (mode < 0 || ottd_py_open(self)) return NULL;
+    ottd_py_image_t *image = PyObject_New(ottd_py_image_t, &ottd_py_image_type);
+    if (image == NULL) return NULL;
+    memset(&image->view, 0, sizeof image->view);
+
+    ottd_options_t opts = { .flags = hillshade? OTTD_F_HILLSHADE : 0, .threads = threads };
+    ottd_error_t err;
+    int ret;
+    self->busy++;
+    Py_BEGIN_ALLOW_THREADS
+    ret = ottd_render(self->game, mode, rgba? OTTD_PIXEL_RGBA : OTTD_PIXEL_INDEXED, &image->view, &opts, &err);
+    Py_END_ALLOW_THREADS
+    self->busy--;
+    if (ret) {
+        Py_DECREF(image);
+        return ottd_py_raise(&err);
+    }
+    const ottd_view_t *view = &image->view;
+    image->shape[0] = view->height;
+    image->shape[1] = view->width;
+    image->shape[2] = 4;
+    image->strides[0] = view->stride;
+    image->strides[1] = ottd_pixel_size(view->format);
+    image->strides[2] = 1;
+    return (PyObject*)image;
+}
+
+static PyObject* ottd_py_save_write_png(ottd_py_save_t *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"path", "mode", "size", "hillshade", "threads", NULL};
+    PyObject *path;
+    const char *mode_name = NULL;
+    int size = 0, hillshade = 0, threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&|$sipi", keywords, PyUnicode_FSConverter, &path, &mode_name, &size, &hillshade, &threads)) return NULL;
+    int mode = ottd_py_mode(mode_name);
+    if (mode < 0 || ottd_py_open(self)) {
+        Py_DECREF(path);
+        return NULL;
+    }
+    ottd_output_t output = { .mode = mode, .path = PyBytes_AS_STRING(path), .size = size };
+    ottd_options_t opts = { .flags = hillshade? OTTD_F_HILLSHADE : 0, .threads = threads };
+    ottd_error_t err;
+    int ret;
+    self->busy++;
+    Py_BEGIN_ALLOW_THREADS
+    ret = ottd_write_pngs(self->game, &output, 1, &opts, &err);
+    Py_END_ALLOW_THREADS
+    self->busy--;
+    Py_DECREF(path);
+    if (ret) return ottd_py_raise(output.err.code? &output.err : &err);
+    Py_RETURN_NONE;
+}
+
+#pragma mark - Save
+
+static int ottd_py_save_close_game(ottd_py_save_t *self)
+{
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "save is being rendered on another thread");
+        return -1;
+    }
+    if (self->exports) {
+        PyErr_SetString(PyExc_BufferError, "save has plane buffers in use");
+        return -1;
+    }
+    ottd_free(self->game);
+    self->game = NULL;
+    return 0;
+}
+
+static PyObject* ottd_py_save_close(ottd_py_save_t *self, PyObject *unused)
+{
+    if (ottd_py_save_close_game(self)) return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject* ottd_py_save_enter(ottd_py_save_t *self, PyObject *unused)
+{
+    if (ottd_py_open(self)) return NULL;
+    Py_INCREF(self);
+    return (PyObject*)self;
+}
+
+static PyObject* ottd_py_save_exit(ottd_py_save_t *self, PyObject *args)
+{
+    if (ottd_py_save_close_game(self)) return NULL;
+    Py_RETURN_FALSE;
+}
+
+static void ottd_py_save_dealloc(ottd_py_save_t *self)
+{
+    ottd_free(self->game);
+    Py_XDECREF(self->companies);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* ottd_py_save_repr(ottd_py_save_t *self)
+{
+    if (self->game == NULL) return PyUnicode_FromString("<ottd.Save closed>");
+    uint32_t width, height;
+    ottd_map_size(self->game, &width, &height);
+    return PyUnicode_FromFormat("<ottd.Save version %d, %ux%u>", ottd_version(self->game), width, height);
+}
+
+static PyGetSetDef ottd_py_save_getset[] = {
+    {"version", (getter)ottd_py_save_int, NULL, "savegame version", (void*)0},
+    {"width", (getter)ottd_py_save_int, NULL, "map width in tiles, or cells of a thumbnail load", (void*)1},
+    {"height", (getter)ottd_py_save_int, NULL, "map height in tiles, or cells of a thumbnail load", (void*)2},
+    {"start_year", (getter)ottd_py_save_int, NULL, "year the game started", (void*)3},
+    {"scale", (getter)ottd_py_save_int, NULL, "tiles a side per cell of a thumbnail load, 0 for full size", (void*)4},
+    {"date", (getter)ottd_py_save_date, NULL, "current date as (year, month, day), month from 1", NULL},
+    {"companies", (getter)ottd_py_save_companies, NULL, "active companies as dicts, id is the owner in mapo", NULL},
+    {"mapt", (getter)ottd_py_save_plane, NULL, "MAPT plane, height x width bytes of type << 4 | height", (void*)0},
+    {"mapo", (getter)ottd_py_save_plane, NULL, "MAPO plane, height x width bytes of the owner as saved", (void*)1},
+    {NULL}
+};
+
+static PyMethodDef ottd_py_save_methods[] = {
+    {"render", (PyCFunction)(void(*)(void))ottd_py_save_render, METH_VARARGS | METH_KEYWORDS,
+        "render(*, mode='nw', rgba=False, hillshade=False, threads=0) -> Image\n\nrender the map, without the GIL"},
+    {"write_png", (PyCFunction)(void(*)(void))ottd_py_save_write_png, METH_VARARGS | METH_KEYWORDS,
+        "write_png(path, *, mode='nw', size=0, hillshade=False, threads=0)\n\nwrite the map as a png, shrunk to size pixels a side when non-zero, without the GIL"},
+    {"close", (PyCFunction)ottd_py_save_close, METH_NOARGS, "free the map, fails while plane buffers are held"},
+    {"__enter__", (PyCFunction)ottd_py_save_enter, METH_NOARGS, NULL},
+    {"__exit__", (PyCFunction)ottd_py_save_exit, METH_VARARGS, NULL},
+    {NULL}
+};
+
+static PyTypeObject ottd_py_save_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "ottd.Save",
+    .tp_doc = "a loaded savegame, see ottd.load",
+    .tp_basicsize = sizeof(ottd_py_save_t),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)ottd_py_save_dealloc,
+    .tp_repr = (reprfunc)ottd_py_save_repr,
+    .tp_getset = ottd_py_save_getset,
+    .tp_methods = ottd_py_save_methods,
+};
+
+#pragma mark - Plane
+
+static int ottd_py_plane_getbuffer(ottd_py_plane_t *self, Py_buffer *view, int flags)
+{
+    ottd_py_save_t *save = self->save;
+    view->obj = NULL;
+    if (ottd_py_open(save)) return -1;
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "planes are read-only");
+        return -1;
+    }
+    view->buf = (void*)(self->plane? ottd_map_owners(save->game) : ottd_map_types(save->game));
+    view->len = self->shape[0] * self->shape[1];
+    view->readonly = 1;
+    view->itemsize = 1;
+    view->format = (flags & PyBUF_FORMAT)? "B" : NULL;
+    view->ndim = 2;
+    view->shape = ((flags & PyBUF_ND) == PyBUF_ND)? self->shape : NULL;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES)? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    view->obj = (PyObject*)self;
+    Py_INCREF(self);
+    save->exports++;
+    return 0;
+}
+
+static void ottd_py_plane_releasebuffer(ottd_py_plane_t *self, Py_buffer *view)
+{
+    self->save->exports--;
+}
+
+static void ottd_py_plane_dealloc(ottd_py_plane_t *self)
+{
+    Py_DECREF(self->save);
+    PyObject_Free(self);
+}
+
+static PyBufferProcs ottd_py_plane_buffer = {
+    .bf_getbuffer = (getbufferproc)ottd_py_plane_getbuffer,
+    .bf_releasebuffer = (releasebufferproc)ottd_py_plane_releasebuffer,
+};
+
+static PyTypeObject ottd_py_plane_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "ottd.Plane",
+    .tp_doc = "a map plane of a Save, height x width read-only bytes through the buffer protocol",
+    .tp_basicsize = sizeof(ottd_py_plane_t),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)ottd_py_plane_dealloc,
+    .tp_as_buffer = &ottd_py_plane_buffer,
+};
+
+#pragma mark - Image
+
+static int ottd_py_image_getbuffer(ottd_py_image_t *self, Py_buffer *view, int flags)
+{
+    const ottd_view_t *image = &self->view;
+    view->buf = image->pixels;
+    view->len = (Py_ssize_t)image->stride * image->height;
+    view->readonly = 0;
+    view->itemsize = 1;
+    view->format = (flags & PyBUF_FORMAT)? "B" : NULL;
+    view->ndim = (image->format == OTTD_PIXEL_RGBA)? 3 : 2;
+    view->shape = ((flags & PyBUF_ND) == PyBUF_ND)? self->shape : NULL;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES)? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    view->obj = (PyObject*)self;
+    Py_INCREF(self);
+    return 0;
+}
+
+static PyObject* ottd_py_image_int(ottd_py_image_t *self, void *closure)
+{
+    switch((int)(intptr_t)closure) {
+        case 0: return PyLong_FromLong(self->view.width);
+        case 1: return PyLong_FromLong(self->view.height);
+        default: return PyBool_FromLong(self->view.format == OTTD_PIXEL_RGBA);
+    }
+}
+
+static void ottd_py_image_dealloc(ottd_py_image_t *self)
+{
+    ottd_view_free(&self->view);
+    PyObject_Free(self);
+}
+
+static PyGetSetDef ottd_py_image_getset[] = {
+    {"width", (getter)ottd_py_image_int, NULL, "width in pixels", (void*)0},
+    {"height", (getter)ottd_py_image_int, NULL, "height in pixels", (void*)1},
+    {"rgba", (getter)ottd_py_image_int, NULL, "True for rgba pixels, False for ottd.palette indexes", (void*)2},
+    {NULL}
+};
+
+static PyBufferProcs ottd_py_image_buffer = {
+    .bf_getbuffer = (getbufferproc)ottd_py_image_getbuffer,
+};
+
+static PyTypeObject ottd_py_image_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "ottd.Image",
+    .tp_doc = "a rendered map, height x width palette indexes or height x width x 4 rgba bytes through the buffer protocol",
+    .tp_basicsize = sizeof(ottd_py_image_t),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)ottd_py_image_dealloc,
+    .tp_getset = ottd_py_image_getset,
+    .tp_as_buffer = &ottd_py_image_buffer,
+};
+
+#pragma mark - Module
+
+static PyObject* ottd_py_load(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"path", "rle", "thumbnail", NULL};
+    PyObject *path;
+    int rle = 0;
+    unsigned int thumbnail = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&|$pI", keywords, PyUnicode_FSConverter, &path, &rle, &thumbnail)) return NULL;
+    ottd_py_save_t *self = PyObject_New(ottd_py_save_t, &ottd_py_save_type);
+    if (self == NULL) {
+        Py_DECREF(path);
+        return NULL;
+    }
+    self->game = NULL;
+    self->busy = 0;
+    self->exports = 0;
+    self->companies = NULL;
+
+    ottd_options_t opts = { .flags = rle? OTTD_F_RLE_MAP : 0, .thumbnail = thumbnail };
+    ottd_error_t err;
+    ottd_t *game;
+    Py_BEGIN_ALLOW_THREADS
+    game = ottd_open(PyBytes_AS_STRING(path), &opts, &err);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(path);
+    if (game == NULL) {
+        Py_DECREF(self);
+        return ottd_py_raise(&err);
+    }
+    self->game = game;
+    return (PyObject*)self;
+}
+
+static PyMethodDef ottd_py_methods[] = {
+    {"load", (PyCFunction)(void(*)(void))ottd_py_load, METH_VARARGS | METH_KEYWORDS,
+        "load(path, *, rle=False, thumbnail=0) -> Save\n\nload a savegame or scenario without the GIL. rle keeps the map run-length encoded, "
+        "without planes. thumbnail loads maps over that many tiles a side shrunk to fit"},
+    {NULL}
+};
+
+static struct PyModuleDef ottd_py_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "ottd",
+    .m_doc = "OpenTTD savegame loading and map rendering",
+    .m_size = -1,
+    .m_methods = ottd_py_methods,
+};
+
+PyMODINIT_FUNC PyInit_ottd(void)
+{
+    if (PyType_Ready(&ottd_py_save_type) || PyType_Ready(&ottd_py_plane_type) || PyType_Ready(&ottd_py_image_type)) return NULL;
+    PyObject *module = PyModule_Create(&ottd_py_module);
+    if (module == NULL) return NULL;
+    ottd_py_error = PyErr_NewExceptionWithDoc("ottd.Error", "load or render failure, code is the enum ottd_status", NULL, NULL);
+    uint8_t palette[256 * 3];
+    for(int i=0; i < 256; i++) {
+        palette[3 * i] = ottd_color[i].red;
+        palette[3 * i + 1] = ottd_color[i].green;
+        palette[3 * i + 2] = ottd_color[i].blue;
+    }
+    PyObject *palette_bytes = PyBytes_FromStringAndSize((const char*)palette, sizeof palette);
+    int failed = ottd_py_error == NULL || palette_bytes == NULL
+        || PyModule_AddObjectRef(module, "Error", ottd_py_error)
+        || PyModule_AddObjectRef(module, "Save", (PyObject*)&ottd_py_save_type)
+        || PyModule_AddObjectRef(module, "Image", (PyObject*)&ottd_py_image_type)
+        || PyModule_AddObjectRef(module, "palette", palette_bytes)
+        || PyModule_AddIntConstant(module, "API_VERSION", OTTD_API_VERSION);
+    Py_XDECREF(palette_bytes);
+    if (failed) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
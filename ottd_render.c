@@ -0,0 +1,833 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "ottd_internal.h"
+
+const png_color ottd_color[256] = {
+/*   0 */ {0x00, 0x00, 0x00}, {0xd4, 0x00, 0xd4}, {0xd4, 0x00, 0xd4}, {0xd4, 0x00, 0xd4}, 
+/*   4 */ {0xd4, 0x00, 0xd4}, {0xd4, 0x00, 0xd4}, {0xd4, 0x00, 0xd4}, {0xd4, 0x00, 0xd4}, 
+/*   8 */ {0xd4, 0x00, 0xd4}, {0xd4, 0x00, 0xd4}, {0xa8, 0xa8, 0xa8}, {0xb8, 0xb8, 0xb8}, 
+/*  12 */ {0xc8, 0xc8, 0xc8}, {0xd8, 0xd8, 0xd8}, {0xe8, 0xe8, 0xe8}, {0xfc, 0xfc, 0xfc}, 
+/*  16 */ {0x34, 0x3c, 0x48}, {0x44, 0x4c, 0x5c}, {0x58, 0x60, 0x70}, {0x6c, 0x74, 0x84}, 
+/*  20 */ {0x84, 0x8c, 0x98}, {0x9c, 0xa0, 0xac}, {0xb0, 0xb8, 0xc4}, {0xcc, 0xd0, 0xdc}, 
+/*  24 */ {0x30, 0x2c, 0x04}, {0x40, 0x3c, 0x0c}, {0x50, 0x4c, 0x14}, {0x60, 0x5c, 0x1c}, 
+/*  28 */ {0x78, 0x78, 0x40}, {0x94, 0x94, 0x64}, {0xb0, 0xb0, 0x84}, {0xcc, 0xcc, 0xa8}, 
+/*  32 */ {0x64, 0x64, 0x64}, {0x74, 0x74, 0x74}, {0x68, 0x50, 0x2c}, {0x7c, 0x68, 0x48}, 
+/*  36 */ {0x98, 0x84, 0x5c}, {0xb8, 0xa0, 0x78}, {0xd4, 0xbc, 0x94}, {0xf4, 0xdc, 0xb0}, 
+/*  40 */ {0x84, 0x84, 0x84}, {0x58, 0x04, 0x10}, {0x70, 0x10, 0x20}, {0x88, 0x20, 0x34}, 
+/*  44 */ {0xa0, 0x38, 0x4c}, {0xbc, 0x54, 0x6c}, {0xcc, 0x68, 0x7c}, {0xdc, 0x84, 0x90}, 
+/*  48 */ {0xec, 0x9c, 0xa4}, {0xfc, 0xbc, 0xc0}, {0xfc, 0xd4, 0x00}, {0xfc, 0xe8, 0x3c}, 
+/*  52 */ {0xfc, 0xf8, 0x80}, {0x4c, 0x28, 0x00}, {0x60, 0x3c, 0x08}, {0x74, 0x58, 0x1c}, 
+/*  56 */ {0x88, 0x74, 0x38}, {0x9c, 0x88, 0x50}, {0xb0, 0x9c, 0x6c}, {0xc4, 0xb4, 0x88}, 
+/*  60 */ {0x44, 0x18, 0x00}, {0x60, 0x2c, 0x04}, {0x80, 0x44, 0x08}, {0x9c, 0x60, 0x10}, 
+/*  64 */ {0xb8, 0x78, 0x18}, {0xd4, 0x9c, 0x20}, {0xe8, 0xb8, 0x10}, {0xfc, 0xd4, 0x00}, 
+/*  68 */ {0xfc, 0xf8, 0x80}, {0xfc, 0xfc, 0xc0}, {0x20, 0x04, 0x00}, {0x40, 0x14, 0x08}, 
+/*  72 */ {0x54, 0x1c, 0x10}, {0x6c, 0x2c, 0x1c}, {0x80, 0x38, 0x28}, {0x94, 0x48, 0x38}, 
+/*  76 */ {0xa8, 0x5c, 0x4c}, {0xb8, 0x6c, 0x58}, {0xc4, 0x80, 0x6c}, {0xd4, 0x94, 0x80}, 
+/*  80 */ {0x08, 0x34, 0x00}, {0x10, 0x40, 0x00}, {0x20, 0x50, 0x04}, {0x30, 0x60, 0x04}, 
+/*  84 */ {0x40, 0x70, 0x0c}, {0x54, 0x84, 0x14}, {0x68, 0x94, 0x1c}, {0x80, 0xa8, 0x2c}, 
+/*  88 */ {0x40, 0x40, 0x40}, {0x2c, 0x44, 0x20}, {0x3c, 0x58, 0x30}, {0x50, 0x68, 0x3c}, 
+/*  92 */ {0x68, 0x7c, 0x4c}, {0x80, 0x94, 0x5c}, {0x98, 0xb0, 0x6c}, {0xb4, 0xcc, 0x7c}, 
+/*  96 */ {0x10, 0x34, 0x18}, {0x20, 0x48, 0x2c}, {0x38, 0x60, 0x48}, {0x4c, 0x74, 0x58}, 
+/* 100 */ {0x60, 0x88, 0x6c}, {0x78, 0xa4, 0x88}, {0x98, 0xc0, 0xa8}, {0xb8, 0xdc, 0xc8}, 
+/* 104 */ {0x20, 0x18, 0x00}, {0x38, 0x1c, 0x00}, {0x50, 0x50, 0x50}, {0x58, 0x34, 0x0c}, 
+/* 108 */ {0x68, 0x40, 0x18}, {0x7c, 0x54, 0x2c}, {0x8c, 0x6c, 0x40}, {0xa0, 0x80, 0x58}, 
+/* 112 */ {0x4c, 0x28, 0x10}, {0x60, 0x34, 0x18}, {0x74, 0x44, 0x28}, {0x88, 0x54, 0x38}, 
+/* 116 */ {0xa4, 0x60, 0x40}, {0xb8, 0x70, 0x50}, {0xcc, 0x80, 0x60}, {0xd4, 0x94, 0x70}, 
+/* 120 */ {0xe0, 0xa8, 0x80}, {0xec, 0xbc, 0x94}, {0x50, 0x1c, 0x04}, {0x64, 0x28, 0x14}, 
+/* 124 */ {0x78, 0x38, 0x28}, {0x8c, 0x4c, 0x40}, {0xa0, 0x64, 0x60}, {0xb8, 0x88, 0x88}, 
+/* 128 */ {0x24, 0x28, 0x44}, {0x30, 0x34, 0x54}, {0x40, 0x40, 0x64}, {0x50, 0x50, 0x74}, 
+/* 132 */ {0x64, 0x64, 0x88}, {0x84, 0x84, 0xa4}, {0xac, 0xac, 0xc0}, {0xd4, 0xd4, 0xe0}, 
+/* 136 */ {0x30, 0x30, 0x30}, {0x40, 0x2c, 0x90}, {0x58, 0x40, 0xac}, {0x68, 0x4c, 0xc4}, 
+/* 140 */ {0x78, 0x58, 0xe0}, {0x8c, 0x68, 0xfc}, {0xa0, 0x88, 0xfc}, {0xbc, 0xa8, 0xfc}, 
+/* 144 */ {0x00, 0x18, 0x6c}, {0x00, 0x24, 0x84}, {0x00, 0x34, 0xa0}, {0x00, 0x48, 0xb8}, 
+/* 148 */ {0x00, 0x60, 0xd4}, {0x18, 0x78, 0xdc}, {0x38, 0x90, 0xe8}, {0x58, 0xa8, 0xf0}, 
+/* 152 */ {0x80, 0xc4, 0xfc}, {0xbc, 0xe0, 0xfc}, {0x10, 0x40, 0x60}, {0x18, 0x50, 0x6c}, 
+/* 156 */ {0x28, 0x60, 0x78}, {0x34, 0x70, 0x84}, {0x50, 0x8c, 0xa0}, {0x74, 0xac, 0xc0}, 
+/* 160 */ {0x9c, 0xcc, 0xdc}, {0xcc, 0xf0, 0xfc}, {0xac, 0x34, 0x34}, {0xd4, 0x34, 0x34}, 
+/* 164 */ {0xfc, 0x34, 0x34}, {0xfc, 0x64, 0x58}, {0xfc, 0x90, 0x7c}, {0xfc, 0xb8, 0xa0}, 
+/* 168 */ {0xfc, 0xd8, 0xc8}, {0xfc, 0xf4, 0xec}, {0x48, 0x14, 0x70}, {0x5c, 0x2c, 0x8c}, 
+/* 172 */ {0x70, 0x44, 0xa8}, {0x8c, 0x64, 0xc4}, {0xa8, 0x88, 0xe0}, {0xcc, 0xb4, 0xfc}, 
+/* 176 */ {0xcc, 0xb4, 0xfc}, {0xe8, 0xd0, 0xfc}, {0x3c, 0x00, 0x00}, {0x5c, 0x00, 0x00}, 
+/* 180 */ {0x80, 0x00, 0x00}, {0xa0, 0x00, 0x00}, {0xc4, 0x00, 0x00}, {0xe0, 0x00, 0x00}, 
+/* 184 */ {0xfc, 0x00, 0x00}, {0xfc, 0x50, 0x00}, {0xfc, 0x6c, 0x00}, {0xfc, 0x88, 0x00}, 
+/* 188 */ {0xfc, 0xa4, 0x00}, {0xfc, 0xc0, 0x00}, {0xfc, 0xdc, 0x00}, {0xfc, 0xfc, 0x00}, 
+/* 192 */ {0xcc, 0x88, 0x08}, {0xe4, 0x90, 0x04}, {0xfc, 0x9c, 0x00}, {0xfc, 0xb0, 0x30}, 
+/* 196 */ {0xfc, 0xc4, 0x64}, {0xfc, 0xd8, 0x98}, {0x08, 0x18, 0x58}, {0x0c, 0x24, 0x68}, 
+/* 200 */ {0x14, 0x34, 0x7c}, {0x1c, 0x44, 0x8c}, {0x28, 0x5c, 0xa4}, {0x38, 0x78, 0xbc}, 
+/* 204 */ {0x48, 0x98, 0xd8}, {0x64, 0xac, 0xe0}, {0x5c, 0x9c, 0x34}, {0x6c, 0xb0, 0x40}, 
+/* 208 */ {0x7c, 0xc8, 0x4c}, {0x90, 0xe0, 0x5c}, {0xe0, 0xf4, 0xfc}, {0xcc, 0xf0, 0xfc}, 
+/* 212 */ {0xb4, 0xdc, 0xec}, {0x84, 0xbc, 0xd8}, {0x58, 0x98, 0xac}, {0x10, 0x10, 0x10}, 
+/* 216 */ {0x20, 0x20, 0x20}, {0x08, 0x5c, 0x68}, {0x10, 0x64, 0x70}, {0x18, 0x6c, 0x78}, 
+/* 220 */ {0x20, 0x74, 0x80}, {0x2c, 0x7c, 0x8c}, {0x5c, 0xa4, 0xb8}, {0x74, 0xb4, 0xc4}, 
+/* 224 */ {0x94, 0xc8, 0xd8}, {0xb4, 0xdc, 0xe8}, {0xd8, 0xf4, 0xfc}, {0x00, 0x00, 0x00}, 
+/* 228 */ {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00}, 
+/* 232 */ {0xfc, 0x3c, 0x00}, {0xfc, 0x50, 0x00}, {0xfc, 0x68, 0x00}, {0xfc, 0x80, 0x00}, 
+/* 236 */ {0xfc, 0x94, 0x00}, {0xfc, 0xac, 0x00}, {0xfc, 0xc4, 0x00}, {0xfc, 0x00, 0x00}, 
+/* 240 */ {0xfc, 0x00, 0x00}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00}, 
+/* 244 */ {0xfc, 0xe4, 0x00}, {0x94, 0x94, 0x94}, {0xd4, 0x00, 0xd4}, {0xd4, 0x00, 0xd4}, 
+/* 248 */ {0xd4, 0x00, 0xd4}, {0xd4, 0x00, 0xd4}, {0xd4, 0x00, 0xd4}, {0xd4, 0x00, 0xd4}, 
+/* 252 */ {0xd4, 0x00, 0xd4}, {0xd4, 0x00, 0xd4}, {0xd4, 0x00, 0xd4}, {0xfc, 0xfc, 0xfc}
+};
+
+// indexes of company colors in the palette
+static const int company_color_idx[] = {202, 100, 46, 66, 183, 158, 206, 92, 150, 118, 132, 140, 195, 36, 40, 12};
+
+int ottd_company_color(int c)
+{
+    if (c < 0 || c > 15) return 0;
+    return company_color_idx[c];
+}
+
+uint8_t ottd_plane_color(const ottd_t *game, uint8_t mapt, uint8_t mapo)
+{
+    uint8_t owner;
+    switch(mapt >> 4) {
+    case MP_CLEAR:          ///< A tile without any structures, i.e. grass, rocks, farm fields etc.
+    case MP_TREES:          ///< Tile got trees
+        return SM_COLOUR_NOT_OWNED;
+    case MP_RAILWAY:        ///< A railway
+    case MP_STATION:        ///< A tile of a station
+    case MP_ROAD:           ///< A tile with road (or tram tracks) : tracks(tracks) : tracks(tracks)
+    case MP_TUNNELBRIDGE:   ///< Tunnel entry/exit and bridge heads
+        // owner color
+        owner = ((mapt >> 4) != MP_ROAD)?mapo&0x1F:mapo;
+        if (owner < OWNER_TOWN && game->company[owner].active) {
+            // owned by a company
+            return ottd_company_color(game->company[owner].color);
+        } else if (owner == OWNER_TOWN) {
+            // owned by a town
+            return SM_COLOUR_TOWN;
+        }
+        // not owned?
+        return SM_COLOUR_ROAD;
+    case MP_HOUSE:          ///< A house by a town
+        return SM_COLOUR_TOWN;
+    case MP_WATER:          ///< Water tile
+        return SM_COLOUR_WATER;
+    case MP_VOID:           ///< Invisible tiles at the SW and SE border
+        return SM_COLOUR_BLACK;
+    case MP_INDUSTRY:       ///< Part of an industry
+        return SM_COLOUR_INDUSTRY;
+    case MP_OBJECT:         ///< Contains objects such as transmitters and owned land
+        owner = mapo&0x1F;
+        if (owner < OWNER_TOWN && game->company[owner].active) {
+            // owned by a company
+            return ottd_company_color(game->company[owner].color);
+        } else if (owner == OWNER_TOWN) {
+            // owned by a town
+            return SM_COLOUR_TOWN;
+        }
+        // default object
+        return SM_COLOUR_OBJECT;
+    }
+	return SM_COLOUR_BLACK;
+}
+
+uint8_t ottd_tile_color(const ottd_t *game, const ottd_tile_t *tile)
+{
+    if (tile == NULL || game == NULL) return 0;
+    return ottd_plane_color(game, (tile->type << 4) | (tile->height & 0x0F), tile->owner);
+}
+
+int ottd_image_size(const ottd_t *game, int mode, int *width, int *height)
+{
+    if (game == NULL || ((game->mapt == NULL || game->mapo == NULL) && game->rle == NULL)) return -1;
+    switch(mode) {
+        case OTTD_MAP_ISO:
+            *width = (game->mapSize.x + game->mapSize.y);
+            *height = (game->mapSize.x + game->mapSize.y)/2;
+            break;
+        case OTTD_MAP_NE:
+            *width = game->mapSize.y-2;
+            *height = game->mapSize.x-2;
+            break;
+        case OTTD_MAP_NW:
+            *width = game->mapSize.x-2;
+            *height = game->mapSize.y-2;
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+static inline uint8_t ottd_map_color(const ottd_t *game, uint32_t x, uint32_t y)
+{
+    size_t i = (size_t)y * game->mapSize.x + x;
+    if (game->color) return game->color[i];
+    if (game->rle) return ottd_plane_color(game, ottd_rle_at(&game->rle->plane[0], x, y), ottd_rle_at(&game->rle->plane[1], x, y));
+    return ottd_plane_color(game, game->mapt[i], game->mapo[i]);
+}
+
+// the tile pixel (px, py) of an image in mode shows, 0 for the black margins of iso images
+static inline int ottd_pixel_tile(const ottd_t *game, int mode, int width, int px, int py, uint32_t *x, uint32_t *y)
+{
+    if (mode == OTTD_MAP_ISO) {
+        int jpx = width-px-game->mapSize.y;
+        int ry = (py) - (jpx/2);
+        int rx = (py) + (jpx/2);
+        if (rx < 0 || ry < 0 || rx >= game->mapSize.x || ry >= game->mapSize.y) return 0;
+        *x = rx;
+        *y = ry;
+    } else if (mode == OTTD_MAP_NE) {
+        *x = py+1;
+        *y = px+1;
+    } else {
+        *x = width-px; // default OTTD_MAP_NW
+        *y = py+1;
+    }
+    return 1;
+}
+
+static inline uint8_t ottd_pixel_color(const ottd_t *game, int mode, int width, int px, int py)
+{
+    uint32_t x, y;
+    return ottd_pixel_tile(game, mode, width, px, py, &x, &y)? ottd_map_color(game, x, y) : 0;
+}
+
+// colour of tile x, y at index i of the planes
+static inline uint8_t ottd_iso_color(const ottd_t *game, int64_t x, int64_t y, size_t i)
+{
+    if (game->color) return game->color[i];
+    if (game->rle) return ottd_map_color(game, (uint32_t)x, (uint32_t)y);
+    return ottd_plane_color(game, game->mapt[i], game->mapo[i]);
+}
+
+// an iso row is a diagonal through the map: pixel px shows tile (py + t, py - t) with
+// t = (mapSize.x - px) / 2 rounded towards zero, so tiles are two pixels wide, and three
+// where t is 0. only the span of t inside the map is looked up, the margins are black
+static void ottd_render_iso_row(const ottd_t *game, int width, int py, uint8_t *row)
+{
+    const int64_t X = game->mapSize.x, Y = game->mapSize.y;
+    int64_t tlo = (py - Y + 1 > -py)? py - Y + 1 : -py;
+    int64_t thi = (X - py - 1 < py)? X - py - 1 : py;
+    if (tlo > thi) {
+        memset(row, 0, width);
+        return;
+    }
+    
+    // span of the row covered by the map
+    int64_t start = (thi > 0)? X - 2*thi - 1 : (thi == 0)? X - 1 : X - 2*thi;
+    int64_t end = (tlo > 0)? X - 2*tlo + 1 : (tlo == 0)? X + 2 : X - 2*tlo + 2;
+    if (start > 0) memset(row, 0, start);
+    if (end < width) memset(row + end, 0, width - end);
+    
+    // t goes down by one per tile, which moves the tile index by X - 1
+    size_t i = (size_t)((py - thi) * X + py + thi);
+    int64_t px = start;
+    for(int64_t t=thi; t >= tlo; ) {
+        // four two pixel tiles inside the row, clear of t == 0, are gathered in a register
+        // and go out in one 8 byte store, the first tile at the lowest address
+        if (t - 3 >= tlo && (t > 3 || t < 0) && px >= 0 && px + 8 <= width) {
+            uint64_t quad = 0;
+            for(int k=0; k < 4; k++, t--, i += X - 1) {
+                uint64_t pair = ottd_iso_color(game, py + t, py - t, i) * 0x0101u;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                quad = quad << 16 | pair;
+#else
+                quad = quad >> 16 | pair << 48;
+#endif
+            }
+            memcpy(row + px, &quad, 8);
+            px += 8;
+            continue;
+        }
+        uint8_t c = ottd_iso_color(game, py + t, py - t, i);
+        int n = (t == 0)? 3 : 2;
+        for(int k=0; k < n; k++) if (px + k >= 0 && px + k < width) row[px + k] = c;
+        px += n;
+        t--;
+        i += X - 1;
+    }
+}
+
+// a flat row from the runs of map row py + 1, a colour lookup and a memset per span.
+// pixel px shows tile x = width - px, so tiles 1 to width fill the row right to left
+static void ottd_render_rle_row(const ottd_t *game, int width, int py, uint8_t *row)
+{
+    ottd_rle_row_t r;
+    ottd_rle_row_begin(&r, game->rle, py + 1);
+    while(r.x < game->mapSize.x) {
+        uint32_t first = r.x, last;
+        uint8_t mapt, mapo;
+        last = ottd_rle_row_next(&r, &mapt, &mapo);
+        if (first < 1) first = 1;
+        if (last > (uint32_t)width) last = width;
+        if (first > last) continue;
+        memset(row + width - last, ottd_plane_color(game, mapt, mapo), last - first + 1);
+    }
+}
+
+int ottd_render_rows(const ottd_t *game, int mode, int y, int rows, uint8_t *buf, size_t stride)
+{
+    int width, height;
+    if (ottd_image_size(game, mode, &width, &height)) return -1;
+    if (y < 0 || rows < 0 || y + rows > height) return -1;
+    
+    for(int py=y; py < y + rows; py++, buf += stride) {
+        if (mode == OTTD_MAP_ISO) {
+            ottd_render_iso_row(game, width, py, buf);
+            continue;
+        }
+        if (mode == OTTD_MAP_NW && game->rle && game->color == NULL) {
+            ottd_render_rle_row(game, width, py, buf);
+            continue;
+        }
+        for(int px=0; px < width; px++) {
+            buf[px] = ottd_pixel_color(game, mode, width, px, py);
+        }
+    }
+    return 0;
+}
+
+static void ottd_shade_prepare(void);
+static uint8_t ottd_shade_tile(const ottd_t *game, uint32_t x, uint32_t y);
+
+// a pixel of a hillshaded render without a colour plane, shaded on its own
+static inline uint8_t ottd_pixel_shade(const ottd_t *game, int mode, int width, int px, int py)
+{
+    uint32_t x, y;
+    return ottd_pixel_tile(game, mode, width, px, py, &x, &y)? ottd_shade_tile(game, x, y) : 0;
+}
+
+// one sample per OTTD_COARSE_STEP square, rows in between repeat the one above
+static void ottd_render_coarse_row(const ottd_t *game, int mode, int width, int py, uint8_t *row, const uint8_t *prev, int shade)
+{
+    if (prev && py % OTTD_COARSE_STEP) {
+        memcpy(row, prev, width);
+        return;
+    }
+    py -= py % OTTD_COARSE_STEP;
+    for(int px=0; px < width; px += OTTD_COARSE_STEP) {
+        int n = (width - px < OTTD_COARSE_STEP)? width - px : OTTD_COARSE_STEP;
+        memset(row + px, shade? ottd_pixel_shade(game, mode, width, px, py) : ottd_pixel_color(game, mode, width, px, py), n);
+    }
+}
+
+// renders rows y to y + rows on the calling thread. hillshaded maps without a colour
+// plane, run-length or over the memory budget, are shaded tile by tile
+int ottd_render_strip(ottd_ctx_t *ctx, const ottd_t *game, int mode, int y, int rows, uint8_t *buf, size_t stride)
+{
+    int width, height;
+    if (ottd_image_size(game, mode, &width, &height)) return ottd_error(ctx, OTTD_E_ARG, "no map to render");
+    if (y < 0 || rows < 0 || y + rows > height) return ottd_error(ctx, OTTD_E_ARG, "rows out of range");
+    int shade = ctx->opts && (ctx->opts->flags & OTTD_F_HILLSHADE) && game->color == NULL;
+    if (shade) ottd_shade_prepare();
+    
+    uint64_t trace_begin = ottd_trace_begin(ctx);
+    const uint8_t *prev = NULL;
+    for(int py=y; py < y + rows; py++, prev = buf, buf += stride) {
+        if (!ctx->coarse) {
+            int code = ottd_interrupted(ctx, OTTD_STAGE_RENDER, py, height);
+            if (code == OTTD_E_TIMEOUT && ctx->opts && (ctx->opts->flags & OTTD_F_COARSE_FALLBACK)) {
+                Vprintf("deadline expired at row %d, finishing coarse\n", py);
+                ctx->coarse = 1;
+                prev = NULL;
+            } else if (code != OTTD_OK) {
+                return ottd_error(ctx, code, "%s", ottd_strerror(code));
+            }
+        } else if (ctx->opts->cancel && *ctx->opts->cancel) {
+            return ottd_error(ctx, OTTD_E_CANCELLED, "%s", ottd_strerror(OTTD_E_CANCELLED));
+        }
+        
+        if (ctx->coarse) {
+            ottd_render_coarse_row(game, mode, width, py, buf, prev, shade);
+        } else if (shade) {
+            for(int px=0; px < width; px++) buf[px] = ottd_pixel_shade(game, mode, width, px, py);
+        } else {
+            ottd_render_rows(game, mode, py, 1, buf, stride);
+        }
+    }
+    ottd_trace_end(ctx, OTTD_SPAN_STRIP, trace_begin, 0, y);
+    return 0;
+}
+
+#pragma mark - Hillshade
+
+// the hillshaded style colours clear land and trees by height, like the contour smallmap,
+// and lightens or darkens every tile by its slope. the light comes from the x+1, y-1 corner:
+// a tile's slope is the height of its x-1 and y+1 neighbours less that of its x+1 and y-1
+// ones, clamped to OTTD_SHADE_STEPS either way. heights are the low nibble of MAPT
+
+#define OTTD_SHADE_LEVELS (2 * OTTD_SHADE_STEPS + 1)
+
+// low green to high grey
+static const uint8_t ottd_height_color[16] = {89, 90, 91, 92, 93, 94, 95, 28, 29, 30, 31, 11, 12, 13, 14, 15};
+
+// ottd_shade[level][c] is the palette entry closest to c darkened or lightened by level
+static uint8_t ottd_shade[OTTD_SHADE_LEVELS][256];
+static pthread_once_t ottd_shade_once = PTHREAD_ONCE_INIT;
+
+static void ottd_shade_init(void)
+{
+    static const int scale[OTTD_SHADE_LEVELS] = {160, 208, 256, 296, 336}; // 1/256ths
+    for(int level=0; level < OTTD_SHADE_LEVELS; level++) {
+        for(int c=0; c < 256; c++) {
+            if (scale[level] == 256) {
+                ottd_shade[level][c] = c;
+                continue;
+            }
+            int r = ottd_color[c].red * scale[level] >> 8, g = ottd_color[c].green * scale[level] >> 8, b = ottd_color[c].blue * scale[level] >> 8;
+            int best = c, best_dist = INT32_MAX;
+            for(int i=0; i < 256; i++) {
+                const png_color *p = &ottd_color[i];
+                if (p->red == 0xd4 && p->green == 0x00 && p->blue == 0xd4) continue; // unused entries
+                int dist = (p->red - r) * (p->red - r) + (p->green - g) * (p->green - g) + (p->blue - b) * (p->blue - b);
+                if (dist < best_dist) {
+                    best = i;
+                    best_dist = dist;
+                }
+            }
+            ottd_shade[level][c] = best;
+        }
+    }
+}
+
+static void ottd_shade_prepare(void)
+{
+    pthread_once(&ottd_shade_once, ottd_shade_init);
+}
+
+static inline uint8_t ottd_shade_base(const ottd_t *game, uint8_t mapt, uint8_t mapo)
+{
+    uint8_t type = mapt >> 4;
+    if (type == MP_CLEAR || type == MP_TREES) return ottd_height_color[mapt & 0x0F];
+    return ottd_plane_color(game, mapt, mapo);
+}
+
+static inline uint8_t ottd_map_type(const ottd_t *game, uint32_t x, uint32_t y)
+{
+    if (game->rle) return ottd_rle_at(&game->rle->plane[0], x, y);
+    return game->mapt[(size_t)y * game->mapSize.x + x];
+}
+
+// one hillshaded tile, for viewports. tiles on the edge of the map are their own neighbours
+static uint8_t ottd_shade_tile(const ottd_t *game, uint32_t x, uint32_t y)
+{
+    uint32_t w = game->mapSize.x, h = game->mapSize.y;
+    uint8_t mapt = ottd_map_type(game, x, y);
+    uint8_t mapo = game->rle? ottd_rle_at(&game->rle->plane[1], x, y) : game->mapo[(size_t)y * w + x];
+    int level = ottd_shade_level(
+        (x > 0)? ottd_map_type(game, x - 1, y) : mapt,
+        (y + 1 < h)? ottd_map_type(game, x, y + 1) : mapt,
+        (x + 1 < w)? ottd_map_type(game, x + 1, y) : mapt,
+        (y > 0)? ottd_map_type(game, x, y - 1) : mapt);
+    return ottd_shade[level][ottd_shade_base(game, mapt, mapo)];
+}
+
+// shade levels of a row of the flat type plane, sixteen tiles at a time where SSE2 is there
+void ottd_shade_row(const uint8_t *mapt, uint32_t width, uint32_t height, uint32_t y, uint8_t *level)
+{
+    const uint8_t *row = mapt + (size_t)y * width;
+    const uint8_t *up = (y > 0)? row - width : row, *down = (y + 1 < height)? row + width : row;
+    uint32_t x = 0;
+    if (width > 1) {
+        level[0] = ottd_shade_level(row[0], down[0], row[1], up[0]);
+        x = 1;
+    }
+#ifdef __SSE2__
+    // the sum is biased by 32 to stay unsigned, where SSE2 has min and max
+    const __m128i nibble = _mm_set1_epi8(0x0F), bias = _mm_set1_epi8(32);
+    const __m128i lo = _mm_set1_epi8(32 - OTTD_SHADE_STEPS), hi = _mm_set1_epi8(32 + OTTD_SHADE_STEPS);
+    for(; x + 17 <= width; x += 16) {
+        __m128i l = _mm_and_si128(_mm_loadu_si128((const __m128i*)(row + x - 1)), nibble);
+        __m128i r = _mm_and_si128(_mm_loadu_si128((const __m128i*)(row + x + 1)), nibble);
+        __m128i u = _mm_and_si128(_mm_loadu_si128((const __m128i*)(up + x)), nibble);
+        __m128i d = _mm_and_si128(_mm_loadu_si128((const __m128i*)(down + x)), nibble);
+        __m128i v = _mm_sub_epi8(_mm_add_epi8(_mm_add_epi8(l, d), bias), _mm_add_epi8(r, u));
+        v = _mm_sub_epi8(_mm_min_epu8(_mm_max_epu8(v, lo), hi), lo);
+        _mm_storeu_si128((__m128i*)(level + x), v);
+    }
+#endif
+    for(; x < width; x++) {
+        level[x] = ottd_shade_level(row[x - (x > 0)], down[x], row[x + (x + 1 < width)], up[x]);
+    }
+}
+
+#pragma mark - Colour plane
+
+// the colour of every tile, hillshaded or not, for renders that share one map. returns NULL
+// without an error when the map is run-length encoded, the plane doesn't fit the memory
+// budget, or the deadline passes while it's filled
+uint8_t* ottd_color_plane(ottd_ctx_t *ctx, const ottd_t *game, int shade)
+{
+    if (game->mapt == NULL || game->mapo == NULL) return NULL;
+    uint32_t width = game->mapSize.x, height = game->mapSize.y;
+    uint64_t tiles = (uint64_t)width * height, size = tiles + width;
+    if (size > ottd_mem_available(ctx->memory) || ottd_mem_reserve(ctx, OTTD_MEM_RENDER, size, "colour plane")) return NULL;
+    uint8_t *color = malloc(tiles), *level = malloc(width);
+    if (color == NULL || level == NULL) goto fail;
+    if (shade) ottd_shade_prepare();
+    
+    uint64_t trace_begin = ottd_trace_begin(ctx);
+    for(uint32_t y=0; y < height; y++) {
+        if (y % 256 == 0 && ottd_interrupted(ctx, OTTD_STAGE_RENDER, y, height)) goto fail;
+        const uint8_t *mapt = game->mapt + (size_t)y * width, *mapo = game->mapo + (size_t)y * width;
+        uint8_t *row = color + (size_t)y * width;
+        if (shade) {
+            ottd_shade_row(game->mapt, width, height, y, level);
+            for(uint32_t x=0; x < width; x++) row[x] = ottd_shade[level[x]][ottd_shade_base(game, mapt[x], mapo[x])];
+        } else {
+            for(uint32_t x=0; x < width; x++) row[x] = ottd_plane_color(game, mapt[x], mapo[x]);
+        }
+    }
+    ottd_trace_end(ctx, OTTD_SPAN_COLOR, trace_begin, 0, height);
+    free(level);
+    ottd_mem_release(ctx->memory, OTTD_MEM_RENDER, width);
+    return color;
+fail:
+    free(color);
+    free(level);
+    ottd_mem_release(ctx->memory, OTTD_MEM_RENDER, size);
+    return NULL;
+}
+
+void ottd_color_plane_free(ottd_ctx_t *ctx, const ottd_t *game, uint8_t *color)
+{
+    if (color == NULL) return;
+    free(color);
+    ottd_mem_release(ctx->memory, OTTD_MEM_RENDER, (uint64_t)game->mapSize.x * game->mapSize.y);
+}
+
+// the map renders read: game, or a copy of it with a colour plane when several images
+// share one or opts ask for hillshading. maps without a plane are hillshaded tile by tile
+// by ottd_render_strip
+const ottd_t* ottd_render_map(ottd_ctx_t *ctx, const ottd_t *game, ottd_t *copy, int shared)
+{
+    int shade = ctx->opts && (ctx->opts->flags & OTTD_F_HILLSHADE);
+    if (game == NULL || game->color || (!shade && !shared)) return game;
+    *copy = *game;
+    copy->color = ottd_color_plane(ctx, game, shade);
+    if (copy->color) return copy;
+    if (shade) Vprintf("Hillshade: no colour plane for this map, shading tile by tile\n");
+    return game;
+}
+
+void ottd_render_map_free(ottd_ctx_t *ctx, const ottd_t *game, const ottd_t *map)
+{
+    if (map != game) ottd_color_plane_free(ctx, game, map->color);
+}
+
+#pragma mark - Parallel bands
+
+// rows are split in bands of OTTD_STRIP_ROWS, which the calling thread and the
+// workers take in turn until none are left. each band is written by one thread only.
+// workers get a copy of the context: no progress callback, no hardware counters,
+// and their own error, the first of which is passed back.
+// RGBA bands are rendered as indexes at the start of each row, then widened in place
+
+typedef struct ottd_render_job {
+    const ottd_t *game;
+    int      mode, format;
+    int      y, rows;
+    uint8_t  *buf;
+    size_t   stride;
+    int      next;          // next band, taken atomically
+    int      failed;        // stop taking bands
+    int      coarse;        // some thread switched to coarse rendering
+    pthread_mutex_t lock;
+    ottd_error_t err;       // first error
+} ottd_render_job_t;
+
+typedef struct ottd_render_worker {
+    ottd_render_job_t *job;
+    ottd_ctx_t ctx;
+    ottd_options_t opts;
+    pthread_t thread;
+} ottd_render_worker_t;
+
+// right to left, so every index is read before its pixel overwrites it
+static void ottd_render_widen(uint8_t *row, int width)
+{
+    for(int px=width-1; px >= 0; px--) {
+        png_color c = ottd_color[row[px]];
+        uint8_t *p = row + (size_t)px * 4;
+        p[0] = c.red;
+        p[1] = c.green;
+        p[2] = c.blue;
+        p[3] = 0xFF;
+    }
+}
+
+static int ottd_render_band(ottd_ctx_t *ctx, const ottd_render_job_t *job, int y, int rows, uint8_t *buf)
+{
+    if (ottd_render_strip(ctx, job->game, job->mode, y, rows, buf, job->stride)) return -1;
+    if (job->format == OTTD_PIXEL_RGBA) {
+        int width, height;
+        ottd_image_size(job->game, job->mode, &width, &height);
+        for(int i=0; i < rows; i++) ottd_render_widen(buf + (size_t)i * job->stride, width);
+    }
+    return 0;
+}
+
+static void* ottd_render_work(void *arg)
+{
+    ottd_render_worker_t *w = arg;
+    ottd_render_job_t *job = w->job;
+    int bands = (job->rows + OTTD_STRIP_ROWS - 1) / OTTD_STRIP_ROWS;
+    for(;;) {
+        if (__atomic_load_n(&job->failed, __ATOMIC_RELAXED)) break;
+        int band = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (band >= bands) break;
+        int y = band * OTTD_STRIP_ROWS;
+        int rows = (job->rows - y < OTTD_STRIP_ROWS)? job->rows - y : OTTD_STRIP_ROWS;
+        if (ottd_render_band(&w->ctx, job, job->y + y, rows, job->buf + (size_t)y * job->stride)) {
+            pthread_mutex_lock(&job->lock);
+            if (!job->failed) job->err = *w->ctx.err;
+            job->failed = 1;
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+    }
+    if (w->ctx.coarse) __atomic_store_n(&job->coarse, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// the threads of opts, one per core by default, at most one per band
+int ottd_render_threads(const ottd_ctx_t *ctx, int bands)
+{
+    int threads = ctx->opts? ctx->opts->threads : 0;
+    if (threads <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (n > 0)? (int)n : 1;
+    }
+    if (threads > OTTD_MAX_THREADS) threads = OTTD_MAX_THREADS;
+    if (threads > bands) threads = bands;
+    return (threads > 0)? threads : 1;
+}
+
+// renders rows y to y + rows of the image into buf, in parallel bands
+int ottd_render_bands(ottd_ctx_t *ctx, const ottd_t *game, int mode, int format, int y, int rows, uint8_t *buf, size_t stride)
+{
+    ottd_render_job_t job = { .game = game, .mode = mode, .format = format, .y = y, .rows = rows, .buf = buf, .stride = stride };
+    ottd_map_advise(game, mode);
+    int bands = (rows + OTTD_STRIP_ROWS - 1) / OTTD_STRIP_ROWS;
+    int threads = ottd_render_threads(ctx, bands);
+    if (threads == 1) return ottd_render_band(ctx, &job, y, rows, buf);
+
+    if (pthread_mutex_init(&job.lock, NULL)) return ottd_error(ctx, OTTD_E_NOMEM, "cannot create lock");
+    ottd_render_worker_t workers[OTTD_MAX_THREADS];
+    int started = 0;
+    for(int i=0; i < threads; i++) {
+        ottd_render_worker_t *w = &workers[i];
+        w->job = &job;
+        w->ctx = *ctx;
+        w->ctx.err = &w->ctx.local_err;
+        w->ctx.err->code = OTTD_OK;
+        w->ctx.perf = NULL;
+        if (ctx->opts) {
+            w->opts = *ctx->opts;
+            w->opts.progress = NULL;
+            w->ctx.opts = &w->opts;
+        }
+        // the calling thread is worker 0, keeping its own context
+        if (i > 0) {
+            if (pthread_create(&w->thread, NULL, ottd_render_work, w)) break;
+            started = i;
+        }
+    }
+    workers[0].ctx.perf = ctx->perf;
+    ottd_render_work(&workers[0]);
+    for(int i=1; i <= started; i++) pthread_join(workers[i].thread, NULL);
+    pthread_mutex_destroy(&job.lock);
+
+    if (job.coarse) ctx->coarse = 1;
+    if (job.failed) return ottd_error(ctx, job.err.code, "%s", job.err.message);
+    // the workers had no progress callback, report the block done. past the
+    // deadline in coarse mode only cancelling counts, as in ottd_render_strip
+    if (ctx->coarse) return 0;
+    int width, height;
+    ottd_image_size(game, mode, &width, &height);
+    return ottd_check(ctx, OTTD_STAGE_RENDER, y + rows, height);
+}
+
+#pragma mark - Images
+
+int ottd_pixel_size(int format)
+{
+    switch(format) {
+        case OTTD_PIXEL_INDEXED: return 1;
+        case OTTD_PIXEL_RGBA: return 4;
+        default: return 0;
+    }
+}
+
+int ottd_render_pixels(const ottd_t *game, int mode, int format, uint8_t *buf, size_t stride, const ottd_options_t *opts, ottd_error_t *err)
+{
+    ottd_ctx_t ctx;
+    int width, height;
+    ottd_ctx_init(&ctx, opts, err);
+    if (ottd_image_size(game, mode, &width, &height)) return ottd_error(&ctx, OTTD_E_ARG, "no map to render");
+    if (ottd_pixel_size(format) == 0) return ottd_error(&ctx, OTTD_E_ARG, "unknown pixel format %d", format);
+    if (stride < (size_t)width * ottd_pixel_size(format)) return ottd_error(&ctx, OTTD_E_ARG, "stride too small");
+    ottd_t copy;
+    int stage = ottd_perf_enter(&ctx, OTTD_PERF_COLOR);
+    const ottd_t *map = ottd_render_map(&ctx, game, &copy, 0);
+    int ret = ottd_render_bands(&ctx, map, mode, format, 0, height, buf, stride);
+    ottd_render_map_free(&ctx, game, map);
+    ottd_perf_enter(&ctx, stage);
+    return ret;
+}
+
+int ottd_render_image(const ottd_t *game, int mode, uint8_t *buf, size_t stride, const ottd_options_t *opts, ottd_error_t *err)
+{
+    return ottd_render_pixels(game, mode, OTTD_PIXEL_INDEXED, buf, stride, opts, err);
+}
+
+int ottd_render(const ottd_t *game, int mode, int format, ottd_view_t *view, const ottd_options_t *opts, ottd_error_t *err)
+{
+    ottd_ctx_t ctx_, *ctx = &ctx_;
+    ottd_ctx_init(ctx, opts, err);
+    memset(view, 0, sizeof *view);
+    int width, height;
+    if (ottd_image_size(game, mode, &width, &height)) return ottd_error(ctx, OTTD_E_ARG, "no map to render");
+    if (ottd_pixel_size(format) == 0) return ottd_error(ctx, OTTD_E_ARG, "unknown pixel format %d", format);
+
+    size_t stride = (size_t)width * ottd_pixel_size(format);
+    uint64_t size = (uint64_t)stride * height;
+    if (ottd_mem_reserve(ctx, OTTD_MEM_RENDER, size, "framebuffer")) return -1;
+    view->pixels = malloc(size? size : 1);
+    if (view->pixels == NULL) {
+        ottd_mem_release(ctx->memory, OTTD_MEM_RENDER, size);
+        return ottd_error(ctx, OTTD_E_NOMEM, "cannot allocate %dx%d image", width, height);
+    }
+    view->mode = mode;
+    view->format = format;
+    view->width = width;
+    view->height = height;
+    view->stride = stride;
+    view->memory = ctx->memory;
+
+    ottd_t copy;
+    int stage = ottd_perf_enter(ctx, OTTD_PERF_COLOR);
+    const ottd_t *map = ottd_render_map(ctx, game, &copy, 0);
+    int ret = ottd_render_bands(ctx, map, mode, format, 0, height, view->pixels, view->stride);
+    ottd_render_map_free(ctx, game, map);
+    ottd_perf_enter(ctx, stage);
+    if (ret) ottd_view_free(view);
+    return ret;
+}
+
+void ottd_view_free(ottd_view_t *view)
+{
+    if (view->pixels) ottd_mem_release(view->memory, OTTD_MEM_RENDER, (uint64_t)view->stride * view->height);
+    free(view->pixels);
+    memset(view, 0, sizeof *view);
+}
+
+#pragma mark - Viewports
+
+// the pixels of the whole image that show the viewport's tiles. iso tiles are spread over
+// a diamond, which is bounded by the rows and columns of its corners
+static int ottd_viewport_window(const ottd_t *game, const ottd_viewport_t *vp, int *wx, int *wy, int *ww, int *wh)
+{
+    int width, height;
+    if (ottd_image_size(game, vp->mode, &width, &height)) return -1;
+    int64_t x0 = vp->x, y0 = vp->y, x1 = (int64_t)vp->x + vp->w - 1, y1 = (int64_t)vp->y + vp->h - 1;
+    int64_t left, top, right, bottom;
+    switch(vp->mode) {
+        case OTTD_MAP_ISO:
+            left = (int64_t)game->mapSize.x + y0 - x1 - 1;
+            right = (int64_t)game->mapSize.x + y1 - x0 + 1;
+            top = (x0 + y0) / 2;
+            bottom = (x1 + y1) / 2;
+            break;
+        case OTTD_MAP_NE:
+            left = y0 - 1;
+            right = y1 - 1;
+            top = x0 - 1;
+            bottom = x1 - 1;
+            break;
+        default:
+            left = width - x1;
+            right = width - x0;
+            top = y0 - 1;
+            bottom = y1 - 1;
+    }
+    if (left < 0) left = 0;
+    if (top < 0) top = 0;
+    if (right >= width) right = width - 1;
+    if (bottom >= height) bottom = height - 1;
+    if (vp->w == 0 || vp->h == 0 || left > right || top > bottom) return -1;
+    *wx = (int)left;
+    *wy = (int)top;
+    *ww = (int)(right - left + 1);
+    *wh = (int)(bottom - top + 1);
+    return 0;
+}
+
+int ottd_viewport_size(const ottd_t *game, const ottd_viewport_t *vp, int *width, int *height)
+{
+    int wx, wy, ww, wh;
+    if (ottd_viewport_window(game, vp, &wx, &wy, &ww, &wh)) return -1;
+    if (vp->zoom > 1) {
+        if (ww > INT32_MAX / vp->zoom || wh > INT32_MAX / vp->zoom) return -1;
+        *width = ww * vp->zoom;
+        *height = wh * vp->zoom;
+    } else if (vp->zoom < -1) {
+        *width = (ww - vp->zoom - 1) / -vp->zoom;
+        *height = (wh - vp->zoom - 1) / -vp->zoom;
+    } else {
+        *width = ww;
+        *height = wh;
+    }
+    return 0;
+}
+
+// rows y to y + rows of a viewport, looking up only the pixels it shows. magnified
+// pixels are looked up once and repeated, shrunk viewports keep every -zoom-th pixel.
+// hillshaded tiles are shaded one by one, rather than filling a plane for the whole map
+int ottd_viewport_rows(ottd_ctx_t *ctx, const ottd_t *game, const ottd_viewport_t *vp, int format, int y, int rows, uint8_t *buf, size_t stride)
+{
+    int wx, wy, ww, wh, width, height, full_width, full_height;
+    if (ottd_viewport_size(game, vp, &width, &height) || ottd_viewport_window(game, vp, &wx, &wy, &ww, &wh)) {
+        return ottd_error(ctx, OTTD_E_ARG, "viewport outside the map");
+    }
+    if (y < 0 || rows < 0 || y + rows > height) return ottd_error(ctx, OTTD_E_ARG, "rows out of range");
+    ottd_image_size(game, vp->mode, &full_width, &full_height);
+    int zoom = (vp->zoom > 1)? vp->zoom : 1, step = (vp->zoom < -1)? -vp->zoom : 1;
+    int shade = ctx->opts && (ctx->opts->flags & OTTD_F_HILLSHADE) && game->color == NULL;
+    if (shade) ottd_shade_prepare();
+    
+    uint64_t trace_begin = ottd_trace_begin(ctx);
+    for(int r=y; r < y + rows; r++, buf += stride) {
+        if (ottd_check(ctx, OTTD_STAGE_RENDER, r, height)) return -1;
+        if (r % zoom && r > y) {
+            memcpy(buf, buf - stride, (size_t)width * ottd_pixel_size(format));
+            continue;
+        }
+        int py = wy + r / zoom * step;
+        for(int c=0; c < ww; c += step) {
+            uint32_t tx, ty;
+            uint8_t color = 0;
+            if (ottd_pixel_tile(game, vp->mode, full_width, wx + c, py, &tx, &ty)) {
+                color = shade? ottd_shade_tile(game, tx, ty) : ottd_map_color(game, tx, ty);
+            }
+            if (zoom == 1) buf[c / step] = color;
+            else memset(buf + (size_t)c * zoom, color, zoom);
+        }
+        if (format == OTTD_PIXEL_RGBA) ottd_render_widen(buf, width);
+    }
+    ottd_trace_end(ctx, OTTD_SPAN_STRIP, trace_begin, 0, y);
+    return 0;
+}
+
+int ottd_render_viewport(const ottd_t *game, const ottd_viewport_t *vp, int format, uint8_t *buf, size_t stride, const ottd_options_t *opts, ottd_error_t *err)
+{
+    ottd_ctx_t ctx;
+    int width, height;
+    ottd_ctx_init(&ctx, opts, err);
+    if (ottd_viewport_size(game, vp, &width, &height)) return ottd_error(&ctx, OTTD_E_ARG, "viewport outside the map");
+    if (ottd_pixel_size(format) == 0) return ottd_error(&ctx, OTTD_E_ARG, "unknown pixel format %d", format);
+    if (stride < (size_t)width * ottd_pixel_size(format)) return ottd_error(&ctx, OTTD_E_ARG, "stride too small");
+    int stage = ottd_perf_enter(&ctx, OTTD_PERF_COLOR);
+    int ret = ottd_viewport_rows(&ctx, game, vp, format, 0, height, buf, stride);
+    ottd_perf_enter(&ctx, stage);
+    return ret;
+}
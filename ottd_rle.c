@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ottd_internal.h"
+
+// run-length planes: each map row of a plane is a list of runs of one byte, kept as the
+// byte and the x of the run's last tile. rows start at an offset into the runs, so a
+// row is walked in order, and a single tile is found by binary search of the run ends.
+// runs are charged to OTTD_MEM_MAP as the arrays grow
+
+static int ottd_rle_grow(ottd_ctx_t *ctx, ottd_rle_t *rle, ottd_rle_plane_t *p, uint64_t need)
+{
+    uint64_t capacity = p->capacity + p->capacity / 2;
+    if (capacity < p->runs + need) capacity = p->runs + need;
+    uint64_t size = (capacity - p->capacity) * OTTD_RLE_RUN_BYTES;
+    if (ottd_mem_reserve(ctx, OTTD_MEM_MAP, size, "run-length map")) return -1;
+    uint16_t *last = realloc(p->last, capacity * sizeof *last);
+    if (last) p->last = last;
+    uint8_t *value = realloc(p->value, capacity);
+    if (value) p->value = value;
+    if (last == NULL || value == NULL) {
+        ottd_mem_release(ctx->memory, OTTD_MEM_MAP, size);
+        return ottd_error(ctx, OTTD_E_NOMEM, "cannot allocate run-length map");
+    }
+    p->capacity = capacity;
+    rle->charged += size;
+    return 0;
+}
+
+// gives back what a plane doesn't use once it has been read
+static void ottd_rle_trim(ottd_ctx_t *ctx, ottd_rle_t *rle, ottd_rle_plane_t *p)
+{
+    uint64_t capacity = p->runs? p->runs : 1;
+    if (capacity >= p->capacity) return;
+    uint16_t *last = realloc(p->last, capacity * sizeof *last);
+    if (last) p->last = last;
+    uint8_t *value = realloc(p->value, capacity);
+    if (value) p->value = value;
+    if (last == NULL || value == NULL) return; // still the old size
+    uint64_t size = (p->capacity - capacity) * OTTD_RLE_RUN_BYTES;
+    ottd_mem_release(ctx->memory, OTTD_MEM_MAP, size);
+    rle->charged -= size;
+    p->capacity = capacity;
+}
+
+ottd_rle_t* ottd_rle_create(ottd_ctx_t *ctx, uint32_t width, uint32_t height)
+{
+    if (width == 0 || width > OTTD_RLE_MAX_WIDTH || height == 0) {
+        ottd_error(ctx, OTTD_E_ARG, "cannot run-length encode a %ux%u map", width, height);
+        return NULL;
+    }
+    uint64_t rows = ((uint64_t)height + 1) * sizeof(uint64_t);
+    if (ottd_mem_reserve(ctx, OTTD_MEM_MAP, 2 * rows, "run-length map")) return NULL;
+    ottd_rle_t *rle = calloc(1, sizeof *rle);
+    if (rle == NULL) {
+        ottd_mem_release(ctx->memory, OTTD_MEM_MAP, 2 * rows);
+        ottd_error(ctx, OTTD_E_NOMEM, "cannot allocate run-length map");
+        return NULL;
+    }
+    rle->width = width;
+    rle->height = height;
+    rle->charged = 2 * rows;
+
+    // a plane that never shows up is all zeros, like the flat planes
+    for(int i=0; i < 2; i++) {
+        ottd_rle_plane_t *p = &rle->plane[i];
+        if ((p->row = malloc(rows)) == NULL || ottd_rle_grow(ctx, rle, p, height)) goto fail;
+        for(uint32_t y=0; y < height; y++) {
+            p->row[y] = y;
+            p->last[y] = width - 1;
+            p->value[y] = 0;
+        }
+        p->row[height] = p->runs = height;
+    }
+    return rle;
+fail:
+    if (ctx->err->code == OTTD_OK) ottd_error(ctx, OTTD_E_NOMEM, "cannot allocate run-length map");
+    ottd_rle_free(rle, ctx->memory);
+    return NULL;
+}
+
+void ottd_rle_free(ottd_rle_t *rle, ottd_memory_t *memory)
+{
+    if (rle == NULL) return;
+    for(int i=0; i < 2; i++) {
+        free(rle->plane[i].row);
+        free(rle->plane[i].last);
+        free(rle->plane[i].value);
+    }
+    ottd_mem_release(memory, OTTD_MEM_MAP, rle->charged);
+    free(rle);
+}
+
+// encodes a plane from the stream a row at a time, plane is 0 for MAPT and 1 for MAPO
+int ottd_rle_read(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_rle_t *rle, int plane)
+{
+    ottd_rle_plane_t *p = &rle->plane[plane];
+    uint32_t width = rle->width;
+    if (ottd_mem_reserve(ctx, OTTD_MEM_MAP, width, "map row")) return -1;
+    uint8_t *row = malloc(width);
+    int ret = -1;
+    if (row == NULL) {
+        ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+        goto end;
+    }
+
+    p->runs = 0;
+    for(uint32_t y=0; y < rle->height; y++) {
+        if (ottd_read_bytes(st, row, width) != width) {
+            ottd_error(ctx, OTTD_E_CORRUPT, "%s truncated", plane? "MAPO" : "MAPT");
+            goto end;
+        }
+        p->row[y] = p->runs;
+        for(uint32_t x=0, end; x < width; x = end) {
+            uint8_t value = row[x];
+            for(end=x+1; end < width && row[end] == value; end++);
+            if (p->runs == p->capacity && ottd_rle_grow(ctx, rle, p, width - x)) goto end;
+            p->last[p->runs] = end - 1;
+            p->value[p->runs] = value;
+            p->runs++;
+        }
+    }
+    p->row[rle->height] = p->runs;
+    ottd_rle_trim(ctx, rle, p);
+    Vprintf("%s: %llu runs, %.1f tiles each\n", plane? "MAPO" : "MAPT", (unsigned long long)p->runs,
+        (double)width * rle->height / p->runs);
+    ret = 0;
+end:
+    free(row);
+    ottd_mem_release(ctx->memory, OTTD_MEM_MAP, width);
+    return ret;
+}
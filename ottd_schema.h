@@ -0,0 +1,274 @@
+// savegame field layouts, expanded at compile time into per-version offset tables
+#ifndef OTTD_SCHEMA_H
+#define OTTD_SCHEMA_H
+
+// versions past this use its layout
+#define SL_MAX_VERSION 255
+#define OTTD_SCHEMA_VERSION(v) (((v) > SL_MAX_VERSION)? SL_MAX_VERSION : (v))
+
+// field lists are F(v, X, field, bytes, from, to) rows in savegame order, a field
+// can span several rows. a field's offset at version v is the size of the rows of
+// earlier fields present in that version, its size is the next field's offset minus its own.
+#define OTTD_FIELD_BYTES(v, X, field, bytes, from, to) + (((field) < (X) && (v) >= (from) && (v) <= (to))? (bytes) : 0)
+#define OTTD_FIELD_OFFSET(list, v, X) (0 list(OTTD_FIELD_BYTES, v, X))
+#define OTTD_FIELD_ENUM(v, name) name,
+
+// one entry per version
+#define OTTD_V4(f, v)   f(v) f((v)+1) f((v)+2) f((v)+3)
+#define OTTD_V16(f, v)  OTTD_V4(f, v) OTTD_V4(f, (v)+4) OTTD_V4(f, (v)+8) OTTD_V4(f, (v)+12)
+#define OTTD_V64(f, v)  OTTD_V16(f, v) OTTD_V16(f, (v)+16) OTTD_V16(f, (v)+32) OTTD_V16(f, (v)+48)
+#define OTTD_V256(f, v) OTTD_V64(f, v) OTTD_V64(f, (v)+64) OTTD_V64(f, (v)+128) OTTD_V64(f, (v)+192)
+
+#pragma mark - PATS
+
+// settings stored before game_creation.starting_year, rows generated with util/gen_PATS_skip.rb
+#define OTTD_PATS_FIELD_NAMES(N, v) \
+    N(v, PATS_SETTINGS) \
+    N(v, PATS_STARTING_YEAR)
+
+#define OTTD_PATS_FIELDS(F, v, X) \
+    F(v, X, PATS_SETTINGS, 28, 0, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 22, 97, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 2, 97, 110) \
+    F(v, X, PATS_SETTINGS, 1, 97, 178) \
+    F(v, X, PATS_SETTINGS, 1, 97, 164) \
+    F(v, X, PATS_SETTINGS, 2, 194, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 154, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 12, 156, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 6, 175, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 75, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 5, 159, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 5, 0, 159) \
+    F(v, X, PATS_SETTINGS, 1, 59, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 113, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 128, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 143, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 208, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 12, 183, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 2, 139, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 133, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 145, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 0, 87) \
+    F(v, X, PATS_SETTINGS, 3, 28, 87) \
+    F(v, X, PATS_SETTINGS, 3, 87, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 9, 0, 120) \
+    F(v, X, PATS_SETTINGS, 1, 38, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 39, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 67, 159) \
+    F(v, X, PATS_SETTINGS, 1, 90, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 95, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 138, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 2, 22, 93) \
+    F(v, X, PATS_SETTINGS, 1, 210, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 40, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 47, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 114, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 62, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 96, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 106, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 148, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 0, 141) \
+    F(v, X, PATS_SETTINGS, 2, 79, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 165, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 1, 160, SL_MAX_VERSION) \
+    F(v, X, PATS_SETTINGS, 4, 0, 144) \
+    F(v, X, PATS_STARTING_YEAR, 4, 0, SL_MAX_VERSION)
+
+enum { OTTD_PATS_FIELD_NAMES(OTTD_FIELD_ENUM, 0) PATS_END };
+
+#pragma mark - PLYR
+
+// company fields between the manager name and the old ai data
+#define OTTD_PLYR_FIELD_NAMES(N, v) \
+    N(v, PLYR_FACE) \
+    N(v, PLYR_MONEY) \
+    N(v, PLYR_LOAN) \
+    N(v, PLYR_COLOUR) \
+    N(v, PLYR_MONEY_FRACTION) \
+    N(v, PLYR_AVAIL_RAILTYPES) \
+    N(v, PLYR_BLOCK_PREVIEW) \
+    N(v, PLYR_CARGO_TYPES) \
+    N(v, PLYR_LOCATION_OF_HQ) \
+    N(v, PLYR_LAST_BUILD_COORDINATE) \
+    N(v, PLYR_INAUGURATED_YEAR) \
+    N(v, PLYR_SHARE_OWNERS) \
+    N(v, PLYR_NUM_VALID_STAT_ENT) \
+    N(v, PLYR_BANKRUPTCY) \
+    N(v, PLYR_YEARLY_EXPENSES) \
+    N(v, PLYR_IS_AI) \
+    N(v, PLYR_AI_UNUSED) \
+    N(v, PLYR_LIMITS) \
+    N(v, PLYR_SETTINGS)
+
+#define OTTD_PLYR_FIELDS(F, v, X) \
+    F(v, X, PLYR_FACE, 4, 0, SL_MAX_VERSION) \
+    F(v, X, PLYR_MONEY, 4, 0, 0) \
+    F(v, X, PLYR_MONEY, 8, 1, SL_MAX_VERSION) \
+    F(v, X, PLYR_LOAN, 4, 0, 64) \
+    F(v, X, PLYR_LOAN, 8, 65, SL_MAX_VERSION) \
+    F(v, X, PLYR_COLOUR, 1, 0, SL_MAX_VERSION) \
+    F(v, X, PLYR_MONEY_FRACTION, 1, 0, SL_MAX_VERSION) \
+    F(v, X, PLYR_AVAIL_RAILTYPES, 1, 0, 57) \
+    F(v, X, PLYR_BLOCK_PREVIEW, 1, 0, SL_MAX_VERSION) \
+    F(v, X, PLYR_CARGO_TYPES, 2, 0, 93) \
+    F(v, X, PLYR_CARGO_TYPES, 4, 94, SL_MAX_VERSION) \
+    F(v, X, PLYR_LOCATION_OF_HQ, 2, 0, 5) \
+    F(v, X, PLYR_LOCATION_OF_HQ, 4, 6, SL_MAX_VERSION) \
+    F(v, X, PLYR_LAST_BUILD_COORDINATE, 2, 0, 5) \
+    F(v, X, PLYR_LAST_BUILD_COORDINATE, 4, 6, SL_MAX_VERSION) \
+    F(v, X, PLYR_INAUGURATED_YEAR, 1, 0, 30) \
+    F(v, X, PLYR_INAUGURATED_YEAR, 4, 31, SL_MAX_VERSION) \
+    F(v, X, PLYR_SHARE_OWNERS, 4, 0, SL_MAX_VERSION) \
+    F(v, X, PLYR_NUM_VALID_STAT_ENT, 1, 0, SL_MAX_VERSION) \
+    F(v, X, PLYR_BANKRUPTCY, 1, 0, SL_MAX_VERSION) \
+    F(v, X, PLYR_BANKRUPTCY, 1, 0, 103) \
+    F(v, X, PLYR_BANKRUPTCY, 2, 104, SL_MAX_VERSION) \
+    F(v, X, PLYR_BANKRUPTCY, 2, 0, SL_MAX_VERSION) \
+    F(v, X, PLYR_BANKRUPTCY, 4, 0, 64) \
+    F(v, X, PLYR_BANKRUPTCY, 8, 65, SL_MAX_VERSION) \
+    F(v, X, PLYR_YEARLY_EXPENSES, 3 * EXPENSES_END * 4, 0, 1) \
+    F(v, X, PLYR_YEARLY_EXPENSES, 3 * EXPENSES_END * 8, 2, SL_MAX_VERSION) \
+    F(v, X, PLYR_IS_AI, 1, 2, SL_MAX_VERSION) \
+    F(v, X, PLYR_AI_UNUSED, 1, 107, 111) \
+    F(v, X, PLYR_AI_UNUSED, 1, 4, 99) \
+    F(v, X, PLYR_LIMITS, 8, 156, SL_MAX_VERSION) \
+    F(v, X, PLYR_SETTINGS, 512, 16, 18) \
+    F(v, X, PLYR_SETTINGS, 2, 19, 68) \
+    F(v, X, PLYR_SETTINGS, 4, 69, SL_MAX_VERSION) \
+    F(v, X, PLYR_SETTINGS, 7, 16, SL_MAX_VERSION) \
+    F(v, X, PLYR_SETTINGS, 1, 2, SL_MAX_VERSION) \
+    F(v, X, PLYR_SETTINGS, 9, 120, SL_MAX_VERSION) \
+    F(v, X, PLYR_SETTINGS, 63, 2, 143)
+
+enum { OTTD_PLYR_FIELD_NAMES(OTTD_FIELD_ENUM, 0) PLYR_END };
+
+// one CompanyEconomyEntry, delivered cargo is per cargo type since 170
+#define OTTD_ECON_FIELD_NAMES(N, v) \
+    N(v, ECON_INCOME) \
+    N(v, ECON_EXPENSES) \
+    N(v, ECON_COMPANY_VALUE) \
+    N(v, ECON_DELIVERED_CARGO) \
+    N(v, ECON_PERFORMANCE_HISTORY)
+
+#define OTTD_ECON_FIELDS(F, v, X) \
+    F(v, X, ECON_INCOME, 4, 0, 1) \
+    F(v, X, ECON_INCOME, 8, 2, SL_MAX_VERSION) \
+    F(v, X, ECON_EXPENSES, 4, 0, 1) \
+    F(v, X, ECON_EXPENSES, 8, 2, SL_MAX_VERSION) \
+    F(v, X, ECON_COMPANY_VALUE, 4, 0, 1) \
+    F(v, X, ECON_COMPANY_VALUE, 8, 2, SL_MAX_VERSION) \
+    F(v, X, ECON_DELIVERED_CARGO, 4, 0, 169) \
+    F(v, X, ECON_DELIVERED_CARGO, 32 * 4, 170, 198) \
+    F(v, X, ECON_DELIVERED_CARGO, 64 * 4, 199, SL_MAX_VERSION) \
+    F(v, X, ECON_PERFORMANCE_HISTORY, 4, 0, SL_MAX_VERSION)
+
+enum { OTTD_ECON_FIELD_NAMES(OTTD_FIELD_ENUM, 0) ECON_END };
+
+#pragma mark - Chunks
+
+// chunk types, the low nibble of the byte after the tag
+enum {
+    CH_RIFF         = 0,
+    CH_ARRAY        = 1,
+    CH_SPARSE_ARRAY = 2,
+    CH_TABLE        = 3,
+    CH_SPARSE_TABLE = 4,
+    CH_TYPE_MASK    = 0xF,
+};
+
+// load modes a chunk is read in
+#define OTTD_NEED_LOAD  1
+#define OTTD_NEED_PROBE 2
+#define OTTD_NEED_ALL   (OTTD_NEED_LOAD | OTTD_NEED_PROBE)
+
+// C(id, tag, kind, needed) for every known chunk, kind is its type before table chunks.
+// the id is also the chunk's slot in per-call statistics, unknown tags share the last one
+#define OTTD_CHUNKS(C) \
+    C(AIPL, 'AIPL', CH_ARRAY, 0) \
+    C(ANIT, 'ANIT', CH_RIFF, 0) \
+    C(APID, 'APID', CH_ARRAY, 0) \
+    C(ATID, 'ATID', CH_ARRAY, 0) \
+    C(BKOR, 'BKOR', CH_ARRAY, 0) \
+    C(CAPA, 'CAPA', CH_ARRAY, 0) \
+    C(CAPR, 'CAPR', CH_RIFF, 0) \
+    C(CAPY, 'CAPY', CH_ARRAY, 0) \
+    C(CHKP, 'CHKP', CH_ARRAY, 0) \
+    C(CHTS, 'CHTS', CH_RIFF, 0) \
+    C(CITY, 'CITY', CH_ARRAY, 0) \
+    C(CMDL, 'CMDL', CH_ARRAY, 0) \
+    C(CMPU, 'CMPU', CH_ARRAY, 0) \
+    C(DATE, 'DATE', CH_RIFF, OTTD_NEED_ALL) \
+    C(DEPT, 'DEPT', CH_ARRAY, 0) \
+    C(ECMY, 'ECMY', CH_RIFF, 0) \
+    C(EIDS, 'EIDS', CH_ARRAY, 0) \
+    C(ENGN, 'ENGN', CH_ARRAY, 0) \
+    C(ENGS, 'ENGS', CH_RIFF, 0) \
+    C(ERNW, 'ERNW', CH_ARRAY, 0) \
+    C(GLOG, 'GLOG', CH_RIFF, 0) \
+    C(GOAL, 'GOAL', CH_ARRAY, 0) \
+    C(GRPS, 'GRPS', CH_ARRAY, 0) \
+    C(GSDT, 'GSDT', CH_ARRAY, 0) \
+    C(GSTR, 'GSTR', CH_ARRAY, 0) \
+    C(HIDS, 'HIDS', CH_ARRAY, 0) \
+    C(IBLD, 'IBLD', CH_RIFF, 0) \
+    C(IIDS, 'IIDS', CH_ARRAY, 0) \
+    C(INDY, 'INDY', CH_ARRAY, 0) \
+    C(ITBL, 'ITBL', CH_ARRAY, 0) \
+    C(LGRJ, 'LGRJ', CH_ARRAY, 0) \
+    C(LGRP, 'LGRP', CH_ARRAY, 0) \
+    C(LGRS, 'LGRS', CH_RIFF, 0) \
+    C(M3HI, 'M3HI', CH_RIFF, 0) \
+    C(M3LO, 'M3LO', CH_RIFF, 0) \
+    C(MAP2, 'MAP2', CH_RIFF, 0) \
+    C(MAP5, 'MAP5', CH_RIFF, 0) \
+    C(MAP7, 'MAP7', CH_RIFF, 0) \
+    C(MAPE, 'MAPE', CH_RIFF, 0) \
+    C(MAPH, 'MAPH', CH_RIFF, 0) \
+    C(MAPO, 'MAPO', CH_RIFF, OTTD_NEED_LOAD) \
+    C(MAPS, 'MAPS', CH_RIFF, OTTD_NEED_ALL) \
+    C(MAPT, 'MAPT', CH_RIFF, OTTD_NEED_LOAD) \
+    C(NAME, 'NAME', CH_ARRAY, 0) \
+    C(NGRF, 'NGRF', CH_ARRAY, 0) \
+    C(OBID, 'OBID', CH_ARRAY, 0) \
+    C(OBJS, 'OBJS', CH_ARRAY, 0) \
+    C(OPTS, 'OPTS', CH_RIFF, 0) \
+    C(ORDL, 'ORDL', CH_ARRAY, 0) \
+    C(ORDR, 'ORDR', CH_ARRAY, 0) \
+    C(PATS, 'PATS', CH_RIFF, OTTD_NEED_ALL) \
+    C(PLYR, 'PLYR', CH_ARRAY, OTTD_NEED_ALL) \
+    C(PRIC, 'PRIC', CH_RIFF, 0) \
+    C(PSAC, 'PSAC', CH_ARRAY, 0) \
+    C(RAIL, 'RAIL', CH_ARRAY, 0) \
+    C(ROAD, 'ROAD', CH_ARRAY, 0) \
+    C(SIGN, 'SIGN', CH_ARRAY, 0) \
+    C(STNN, 'STNN', CH_ARRAY, 0) \
+    C(STNS, 'STNS', CH_ARRAY, 0) \
+    C(STPA, 'STPA', CH_ARRAY, 0) \
+    C(STPE, 'STPE', CH_ARRAY, 0) \
+    C(SUBS, 'SUBS', CH_ARRAY, 0) \
+    C(TIDS, 'TIDS', CH_ARRAY, 0) \
+    C(VEHS, 'VEHS', CH_SPARSE_ARRAY, 0) \
+    C(VIEW, 'VIEW', CH_RIFF, 0)
+
+#define OTTD_CHUNK_ENUM(id, tag, kind, needed) OTTD_CHUNK_##id,
+enum { OTTD_CHUNKS(OTTD_CHUNK_ENUM) OTTD_CHUNK_UNKNOWN, OTTD_CHUNK_COUNT };
+
+#pragma mark - Tables
+
+// offsets of every field and of the end, per version
+#define OTTD_PATS_OFFSET(v, name) OTTD_FIELD_OFFSET(OTTD_PATS_FIELDS, v, name),
+#define OTTD_PATS_ROW(v) { OTTD_PATS_FIELD_NAMES(OTTD_PATS_OFFSET, v) OTTD_FIELD_OFFSET(OTTD_PATS_FIELDS, v, PATS_END) },
+#define OTTD_PLYR_OFFSET(v, name) OTTD_FIELD_OFFSET(OTTD_PLYR_FIELDS, v, name),
+#define OTTD_PLYR_ROW(v) { OTTD_PLYR_FIELD_NAMES(OTTD_PLYR_OFFSET, v) OTTD_FIELD_OFFSET(OTTD_PLYR_FIELDS, v, PLYR_END) },
+#define OTTD_ECON_OFFSET(v, name) OTTD_FIELD_OFFSET(OTTD_ECON_FIELDS, v, name),
+#define OTTD_ECON_ROW(v) { OTTD_ECON_FIELD_NAMES(OTTD_ECON_OFFSET, v) OTTD_FIELD_OFFSET(OTTD_ECON_FIELDS, v, ECON_END) },
+
+// big-endian field of a record read into memory, 0 if the field isn't in this version
+static inline uint64_t ottd_schema_get(const uint8_t *rec, const uint16_t *offsets, int field)
+{
+    uint64_t val = 0;
+    for(int i=offsets[field]; i < offsets[field+1]; i++) val = (val << 8) | rec[i];
+    return val;
+}
+
+#endif
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "ottd_internal.h"
+
+// territory: tiles by owner and type, counted as MAPO is decoded when MAPT is already
+// there, or from the planes when it isn't. the decode loop only counts (type, owner byte)
+// pairs, which are folded into owners once per block of rows. with SSE2, sixteen tiles
+// of one pair, as on open water or bare land of any height, are counted at once. other
+// tiles go to four tables in turn so that repeats of a pair don't wait on each other's
+// stores. company tiles are few, so their bounding boxes are kept in the loop behind a
+// predictable branch
+
+#define OTTD_TERRITORY_BLOCK (1 << 20)  // tiles read and counted between folds
+#define OTTD_TERRITORY_PAIRS (16 * 256) // type << 8 | owner byte
+
+typedef struct ottd_territory_acc {
+    uint32_t count[4][OTTD_TERRITORY_PAIRS];
+    uint8_t owner[OTTD_TERRITORY_PAIRS];    // whose each pair is, as ottd_plane_color sees it
+    ottd_territory_t *out;
+} ottd_territory_acc_t;
+
+static int ottd_territory_owner(int type, int mapo)
+{
+    int owner;
+    switch(type) {
+        case MP_HOUSE:
+            return OWNER_TOWN;
+        case MP_INDUSTRY:
+        case MP_VOID:
+            return OWNER_NOBODY;
+        case MP_ROAD:
+            owner = mapo;
+            break;
+        default:
+            owner = mapo & 0x1F;
+    }
+    return (owner <= OWNER_WATER)? owner : OWNER_NOBODY;
+}
+
+static ottd_territory_acc_t* ottd_territory_begin(ottd_ctx_t *ctx)
+{
+    ottd_territory_acc_t *acc = calloc(1, sizeof *acc);
+    ottd_territory_t *out = calloc(1, sizeof *out);
+    if (acc == NULL || out == NULL) {
+        free(acc);
+        free(out);
+        ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+        return NULL;
+    }
+    for(int i=0; i < OTTD_TERRITORY_PAIRS; i++) acc->owner[i] = ottd_territory_owner(i >> 8, i & 0xFF);
+    for(int c=0; c < lengthof(out->bounds); c++) {
+        out->bounds[c].x0 = out->bounds[c].y0 = UINT32_MAX;
+    }
+    acc->out = out;
+    return acc;
+}
+
+static void ottd_territory_bounds(ottd_territory_t *out, int owner, uint32_t x0, uint32_t x1, uint32_t y)
+{
+    if (x0 < out->bounds[owner].x0) out->bounds[owner].x0 = x0;
+    if (x1 > out->bounds[owner].x1) out->bounds[owner].x1 = x1;
+    if (y < out->bounds[owner].y0) out->bounds[owner].y0 = y;
+    out->bounds[owner].y1 = y; // rows come in order
+}
+
+// counts rows y to y + rows of the flat planes
+static void ottd_territory_rows(ottd_territory_acc_t *acc, const ottd_t *save, uint32_t y, uint32_t rows)
+{
+    uint32_t width = save->mapSize.x;
+    for(uint32_t r=y; r < y + rows; r++) {
+        const uint8_t *mapt = save->mapt + (size_t)r * width, *mapo = save->mapo + (size_t)r * width;
+        uint32_t x = 0;
+#ifdef __SSE2__
+        for(; x + 16 <= width; x += 16) {
+            // heights don't matter, only the type nibble of MAPT is compared
+            __m128i t = _mm_and_si128(_mm_loadu_si128((const __m128i*)(mapt + x)), _mm_set1_epi8((char)0xF0));
+            __m128i o = _mm_loadu_si128((const __m128i*)(mapo + x));
+            __m128i same = _mm_and_si128(_mm_cmpeq_epi8(t, _mm_set1_epi8(mapt[x] & 0xF0)), _mm_cmpeq_epi8(o, _mm_set1_epi8(mapo[x])));
+            int pair = (mapt[x] >> 4) << 8 | mapo[x];
+            if (_mm_movemask_epi8(same) == 0xFFFF) {
+                acc->count[0][pair] += 16;
+                if (acc->owner[pair] < OWNER_TOWN) ottd_territory_bounds(acc->out, acc->owner[pair], x, x + 15, r);
+                continue;
+            }
+            for(int k=0; k < 16; k++) {
+                pair = (mapt[x + k] >> 4) << 8 | mapo[x + k];
+                acc->count[k & 3][pair]++;
+                if (acc->owner[pair] < OWNER_TOWN) ottd_territory_bounds(acc->out, acc->owner[pair], x + k, x + k, r);
+            }
+        }
+#endif
+        for(; x + 4 <= width; x += 4) {
+            for(int k=0; k < 4; k++) {
+                int pair = (mapt[x + k] >> 4) << 8 | mapo[x + k];
+                acc->count[k][pair]++;
+                if (acc->owner[pair] < OWNER_TOWN) ottd_territory_bounds(acc->out, acc->owner[pair], x + k, x + k, r);
+            }
+        }
+        for(; x < width; x++) {
+            int pair = (mapt[x] >> 4) << 8 | mapo[x];
+            acc->count[0][pair]++;
+            if (acc->owner[pair] < OWNER_TOWN) ottd_territory_bounds(acc->out, acc->owner[pair], x, x, r);
+        }
+    }
+}
+
+static void ottd_territory_fold(ottd_territory_acc_t *acc)
+{
+    for(int i=0; i < OTTD_TERRITORY_PAIRS; i++) {
+        uint64_t n = (uint64_t)acc->count[0][i] + acc->count[1][i] + acc->count[2][i] + acc->count[3][i];
+        if (n) acc->out->tiles[acc->owner[i]][i >> 8] += n;
+    }
+    memset(acc->count, 0, sizeof acc->count);
+}
+
+static void ottd_territory_end(ottd_territory_acc_t *acc, ottd_t *save)
+{
+    ottd_territory_fold(acc);
+    free(save->territory);
+    save->territory = acc->out;
+    free(acc);
+}
+
+// reads a flat MAPO of len bytes, counting each block of rows as it lands. returns len
+int ottd_territory_read(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, uint32_t len)
+{
+    ottd_territory_acc_t *acc = ottd_territory_begin(ctx);
+    if (acc == NULL) return -1;
+    uint32_t width = save->mapSize.x, height = save->mapSize.y;
+    uint32_t block = OTTD_TERRITORY_BLOCK / width;
+    if (block == 0) block = 1;
+    for(uint32_t y=0; y < height; y += block) {
+        uint32_t rows = (height - y < block)? height - y : block;
+        size_t size = (size_t)rows * width;
+        if (ottd_read_bytes(st, save->mapo + (size_t)y * width, size) != size) {
+            free(acc->out);
+            free(acc);
+            return ottd_error(ctx, OTTD_E_CORRUPT, "MAPO truncated");
+        }
+        ottd_territory_rows(acc, save, y, rows);
+        ottd_territory_fold(acc);
+    }
+    ottd_territory_end(acc, save);
+    return len;
+}
+
+// counts a map whose planes are both loaded: run by run when they're run-length encoded
+int ottd_territory_count(ottd_ctx_t *ctx, ottd_t *save)
+{
+    ottd_territory_acc_t *acc = ottd_territory_begin(ctx);
+    if (acc == NULL) return -1;
+    uint32_t width = save->mapSize.x, height = save->mapSize.y;
+    if (save->rle) {
+        ottd_territory_t *out = acc->out;
+        for(uint32_t y=0; y < height; y++) {
+            ottd_rle_row_t r;
+            ottd_rle_row_begin(&r, save->rle, y);
+            while(r.x < width) {
+                uint32_t first = r.x, last;
+                uint8_t mapt, mapo;
+                last = ottd_rle_row_next(&r, &mapt, &mapo);
+                int owner = acc->owner[(mapt >> 4) << 8 | mapo];
+                out->tiles[owner][mapt >> 4] += last - first + 1;
+                if (owner < OWNER_TOWN) ottd_territory_bounds(out, owner, first, last, y);
+            }
+        }
+    } else if (save->mapt && save->mapo) {
+        uint32_t block = OTTD_TERRITORY_BLOCK / width;
+        if (block == 0) block = 1;
+        for(uint32_t y=0; y < height; y += block) {
+            ottd_territory_rows(acc, save, y, (height - y < block)? height - y : block);
+            ottd_territory_fold(acc);
+        }
+    }
+    ottd_territory_end(acc, save);
+    return 0;
+}
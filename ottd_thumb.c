@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ottd_internal.h"
+
+// thumbnail loads: the map is split in cells of scale x scale tiles, and the planes hold
+// one tile per cell. while MAPT streams past, each cell keeps the tile of the type that
+// shows best on a small map, and where in the cell it was. MAPO then only fills in the
+// owner of that tile. the full-size planes are never allocated, memory is the thumbnail
+// planes, the pick of each cell and one row of the save
+
+#define OTTD_THUMB_MIN 16           // smallest thumbnail side, in tiles
+#define OTTD_THUMB_MAX_SCALE 256    // a pick is a byte per axis
+
+struct ottd_thumb {
+    uint32_t width, height;         // of the full map
+    uint32_t scale;
+    uint16_t *pick;                 // row << 8 | column of the chosen tile in each cell
+    uint64_t charged;
+};
+
+// features over land over water, as rails and towns are what tell maps apart
+static const uint8_t ottd_thumb_rank[16] = {
+    [MP_VOID]           = 0,
+    [MP_CLEAR]          = 1,
+    [MP_TREES]          = 2,
+    [MP_WATER]          = 3,
+    [MP_OBJECT]         = 4,
+    [MP_HOUSE]          = 5,
+    [MP_INDUSTRY]       = 6,
+    [MP_ROAD]           = 7,
+    [MP_TUNNELBRIDGE]   = 8,
+    [MP_RAILWAY]        = 9,
+    [MP_STATION]        = 10,
+};
+
+// shrinks save to at most size tiles a side, returns 0 without a thumbnail when it already fits
+int ottd_thumb_create(ottd_ctx_t *ctx, ottd_t *save, uint32_t size)
+{
+    uint32_t width = save->mapSize.x, height = save->mapSize.y;
+    uint32_t side = (width > height)? width : height;
+    if (size < OTTD_THUMB_MIN) size = OTTD_THUMB_MIN;
+    uint32_t scale = (side + size - 1) / size;
+    if (scale <= 1) return 0;
+    if (scale > OTTD_THUMB_MAX_SCALE) scale = OTTD_THUMB_MAX_SCALE;
+
+    ottd_thumb_t *thumb = calloc(1, sizeof *thumb);
+    if (thumb == NULL) return ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+    thumb->width = width;
+    thumb->height = height;
+    thumb->scale = scale;
+    ctx->thumb = thumb;
+
+    save->mapSize.x = (width + scale - 1) / scale;
+    save->mapSize.y = (height + scale - 1) / scale;
+    save->scale = scale;
+    uint64_t cells = (uint64_t)save->mapSize.x * save->mapSize.y;
+    Vprintf("Thumbnail: %ux%u, %u tiles a side each\n", save->mapSize.x, save->mapSize.y, scale);
+    if (ottd_mem_reserve(ctx, OTTD_MEM_MAP, 2 * cells, "thumbnail map")) return -1;
+    save->memory = ctx->memory;
+    save->mapt = calloc(cells, 1);
+    save->mapo = calloc(cells, 1);
+    if (ottd_mem_reserve(ctx, OTTD_MEM_MAP, cells * sizeof *thumb->pick, "thumbnail picks")) return -1;
+    thumb->charged = cells * sizeof *thumb->pick;
+    thumb->pick = calloc(cells, sizeof *thumb->pick);
+    if (save->mapt == NULL || save->mapo == NULL || thumb->pick == NULL) {
+        return ottd_error(ctx, OTTD_E_NOMEM, "cannot allocate %ux%u thumbnail", save->mapSize.x, save->mapSize.y);
+    }
+    return 0;
+}
+
+void ottd_thumb_free(ottd_ctx_t *ctx)
+{
+    ottd_thumb_t *thumb = ctx->thumb;
+    if (thumb == NULL) return;
+    free(thumb->pick);
+    ottd_mem_release(ctx->memory, OTTD_MEM_MAP, thumb->charged);
+    free(thumb);
+    ctx->thumb = NULL;
+}
+
+static void ottd_thumb_mapt(ottd_thumb_t *thumb, ottd_t *save, uint32_t y, const uint8_t *row)
+{
+    uint32_t scale = thumb->scale, dy = y % scale;
+    uint8_t *mapt = save->mapt + (size_t)(y / scale) * save->mapSize.x;
+    uint16_t *pick = thumb->pick + (size_t)(y / scale) * save->mapSize.x;
+    for(uint32_t cx=0, x0=0; x0 < thumb->width; cx++, x0 += scale) {
+        uint32_t x1 = (thumb->width - x0 < scale)? thumb->width : x0 + scale;
+        uint32_t x = x0;
+        if (dy == 0) {
+            // first row of the cell
+            mapt[cx] = row[x++];
+            pick[cx] = 0;
+        }
+        uint8_t best = ottd_thumb_rank[mapt[cx] >> 4];
+        for(; x < x1; x++) {
+            uint8_t rank = ottd_thumb_rank[row[x] >> 4];
+            if (rank > best) {
+                best = rank;
+                mapt[cx] = row[x];
+                pick[cx] = (uint16_t)(dy << 8 | (x - x0));
+            }
+        }
+    }
+}
+
+static void ottd_thumb_mapo(ottd_thumb_t *thumb, ottd_t *save, uint32_t y, const uint8_t *row)
+{
+    uint32_t scale = thumb->scale, dy = y % scale;
+    uint8_t *mapo = save->mapo + (size_t)(y / scale) * save->mapSize.x;
+    const uint16_t *pick = thumb->pick + (size_t)(y / scale) * save->mapSize.x;
+    for(uint32_t cx=0, x0=0; x0 < thumb->width; cx++, x0 += scale) {
+        if ((pick[cx] >> 8) == dy) mapo[cx] = row[x0 + (pick[cx] & 0xFF)];
+    }
+}
+
+// reads a full-size plane of len bytes a row at a time into the thumbnail, plane is 0 for
+// MAPT and 1 for MAPO. returns len
+int ottd_thumb_read(ottd_stream_t *st, ottd_ctx_t *ctx, ottd_t *save, int plane, uint32_t len)
+{
+    ottd_thumb_t *thumb = ctx->thumb;
+    uint32_t width = thumb->width;
+    if (len != (uint64_t)width * thumb->height) return ottd_error(ctx, OTTD_E_CORRUPT, "%s size doesn't match map size", plane? "MAPO" : "MAPT");
+    if (ottd_mem_reserve(ctx, OTTD_MEM_MAP, width, "map row")) return -1;
+    uint8_t *row = malloc(width);
+    int ret = -1;
+    if (row == NULL) {
+        ottd_error(ctx, OTTD_E_NOMEM, "out of memory");
+        goto end;
+    }
+    for(uint32_t y=0; y < thumb->height; y++) {
+        if (ottd_read_bytes(st, row, width) != width) {
+            ottd_error(ctx, OTTD_E_CORRUPT, "%s truncated", plane? "MAPO" : "MAPT");
+            goto end;
+        }
+        if (plane) ottd_thumb_mapo(thumb, save, y, row);
+        else ottd_thumb_mapt(thumb, save, y, row);
+    }
+    ret = len;
+end:
+    free(row);
+    ottd_mem_release(ctx->memory, OTTD_MEM_MAP, width);
+    return ret;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "ottd_internal.h"
+
+// spans go into a ring buffer owned by the recording thread, without locking.
+// the lock is only taken to register a thread or a file name
+
+#define OTTD_TRACE_EVENTS 65536     // per thread, by default
+
+typedef struct ottd_trace_event {
+    uint64_t ts, dur;       // ns since the trace was created
+    uint64_t arg;
+    uint32_t tag;
+    int16_t  kind;
+    int16_t  file;          // index into files, or -1
+} ottd_trace_event_t;
+
+typedef struct ottd_trace_buf {
+    struct ottd_trace_buf *next;
+    int      tid;
+    uint64_t count;         // events recorded, the last size of them are kept
+    ottd_trace_event_t events[];
+} ottd_trace_buf_t;
+
+struct ottd_trace {
+    uint64_t serial;        // tells a new trace from a freed one at the same address
+    uint64_t start;
+    size_t   size;
+    pthread_mutex_t lock;
+    ottd_trace_buf_t *bufs;
+    int      nbufs;
+    char     **files;
+    int      nfiles;
+};
+
+static const struct {
+    const char *name, *cat, *arg;
+} ottd_trace_kinds[OTTD_SPAN_COUNT] = {
+    [OTTD_SPAN_OPEN]        = { "open", "load", NULL },
+    [OTTD_SPAN_BLOCK]       = { "decompress", "load", "bytes" },
+    [OTTD_SPAN_CHUNK]       = { NULL, "chunk", "bytes" }, // named by tag
+    [OTTD_SPAN_STRIP]       = { "render strip", "render", "row" },
+    [OTTD_SPAN_PNG_ROWS]    = { "png rows", "png", "row" },
+    [OTTD_SPAN_PNG]         = { "write png", "png", NULL },
+    [OTTD_SPAN_COLOR]       = { "colour plane", "render", "rows" },
+};
+
+static pthread_mutex_t ottd_trace_serial_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t ottd_trace_serial;
+
+static __thread struct {
+    const ottd_trace_t *trace;
+    uint64_t serial;
+    ottd_trace_buf_t *buf;
+} ottd_trace_tls;
+
+ottd_trace_t* ottd_trace_create(size_t events_per_thread)
+{
+    ottd_trace_t *trace = calloc(1, sizeof *trace);
+    if (trace == NULL) return NULL;
+    if (pthread_mutex_init(&trace->lock, NULL)) {
+        free(trace);
+        return NULL;
+    }
+    pthread_mutex_lock(&ottd_trace_serial_lock);
+    trace->serial = ++ottd_trace_serial;
+    pthread_mutex_unlock(&ottd_trace_serial_lock);
+    trace->size = events_per_thread? events_per_thread : OTTD_TRACE_EVENTS;
+    trace->start = ottd_clock_ns();
+    return trace;
+}
+
+void ottd_trace_free(ottd_trace_t *trace)
+{
+    if (trace == NULL) return;
+    for(ottd_trace_buf_t *buf = trace->bufs, *next; buf; buf = next) {
+        next = buf->next;
+        free(buf);
+    }
+    for(int i=0; i < trace->nfiles; i++) free(trace->files[i]);
+    free(trace->files);
+    pthread_mutex_destroy(&trace->lock);
+    free(trace);
+}
+
+// buffer of the calling thread, created on its first span
+static ottd_trace_buf_t* ottd_trace_buf(ottd_trace_t *trace)
+{
+    if (ottd_trace_tls.trace == trace && ottd_trace_tls.serial == trace->serial) return ottd_trace_tls.buf;
+    ottd_trace_buf_t *buf = malloc(sizeof *buf + trace->size * sizeof buf->events[0]);
+    if (buf == NULL) return NULL;
+    buf->count = 0;
+    pthread_mutex_lock(&trace->lock);
+    buf->tid = ++trace->nbufs;
+    buf->next = trace->bufs;
+    trace->bufs = buf;
+    pthread_mutex_unlock(&trace->lock);
+    ottd_trace_tls.trace = trace;
+    ottd_trace_tls.serial = trace->serial;
+    ottd_trace_tls.buf = buf;
+    return buf;
+}
+
+// index of a file name, spans keep the index rather than the caller's string
+int ottd_trace_file(ottd_trace_t *trace, const char *path)
+{
+    if (trace == NULL || path == NULL) return -1;
+    int file = -1;
+    pthread_mutex_lock(&trace->lock);
+    for(int i=trace->nfiles-1; i >= 0; i--) {
+        if (strcmp(trace->files[i], path) == 0) {
+            file = i;
+            goto end;
+        }
+    }
+    if (trace->nfiles == INT16_MAX) goto end;
+    char **files = realloc(trace->files, (trace->nfiles + 1) * sizeof *files);
+    if (files == NULL) goto end;
+    trace->files = files;
+    if ((files[trace->nfiles] = strdup(path)) == NULL) goto end;
+    file = trace->nfiles++;
+end:
+    pthread_mutex_unlock(&trace->lock);
+    return file;
+}
+
+void ottd_trace_span(ottd_ctx_t *ctx, int kind, uint64_t begin, uint32_t tag, uint64_t arg)
+{
+    uint64_t now = ottd_clock_ns();
+    ottd_trace_buf_t *buf = ottd_trace_buf(ctx->trace);
+    if (buf == NULL) return;
+    ottd_trace_event_t *ev = &buf->events[buf->count++ % ctx->trace->size];
+    ev->ts = begin - ctx->trace->start;
+    ev->dur = now - begin;
+    ev->arg = arg;
+    ev->tag = tag;
+    ev->kind = kind;
+    ev->file = ctx->trace_file;
+}
+
+#pragma mark - Output
+
+static void ottd_trace_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for(; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') fprintf(fp, "\\%c", c);
+        else if (c < 0x20) fprintf(fp, "\\u%04x", c);
+        else fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+int ottd_trace_write(ottd_trace_t *trace, const char *path, ottd_error_t *err)
+{
+    ottd_ctx_t ctx_, *ctx = &ctx_;
+    ottd_ctx_init(ctx, NULL, err);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) return ottd_error(ctx, OTTD_E_IO, "%s: %s", path, strerror(errno));
+
+    pthread_mutex_lock(&trace->lock);
+    int pid = (int)getpid();
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"ph\":\"M\",\"pid\":%d,\"name\":\"process_name\",\"args\":{\"name\":\"ottd_preview\"}}", pid);
+    for(const ottd_trace_buf_t *buf = trace->bufs; buf; buf = buf->next) {
+        fprintf(fp, ",\n{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"thread %d\"}}", pid, buf->tid, buf->tid);
+        uint64_t first = (buf->count > trace->size)? buf->count - trace->size : 0;
+        for(uint64_t n=first; n < buf->count; n++) {
+            const ottd_trace_event_t *ev = &buf->events[n % trace->size];
+            char tag[5];
+            const char *name = ottd_trace_kinds[ev->kind].name;
+            if (name == NULL) {
+                for(int i=0; i < 4; i++) {
+                    char c = (ev->tag >> (24 - 8 * i)) & 0xFF;
+                    tag[i] = (c >= 0x20 && c < 0x7F)? c : '?';
+                }
+                tag[4] = '\0';
+                name = tag;
+            }
+            fprintf(fp, ",\n{\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"name\":", pid, buf->tid,
+                (unsigned long long)(ev->ts / 1000), (unsigned)(ev->ts % 1000), (unsigned long long)(ev->dur / 1000), (unsigned)(ev->dur % 1000));
+            ottd_trace_string(fp, name);
+            fprintf(fp, ",\"cat\":\"%s\",\"args\":{", ottd_trace_kinds[ev->kind].cat);
+            const char *sep = "";
+            if (ev->file >= 0) {
+                fprintf(fp, "\"file\":");
+                ottd_trace_string(fp, trace->files[ev->file]);
+                sep = ",";
+            }
+            if (ottd_trace_kinds[ev->kind].arg) fprintf(fp, "%s\"%s\":%llu", sep, ottd_trace_kinds[ev->kind].arg, (unsigned long long)ev->arg);
+            fprintf(fp, "}}");
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    pthread_mutex_unlock(&trace->lock);
+    if (ferror(fp) | fclose(fp)) return ottd_error(ctx, OTTD_E_IO, "%s: %s", path, strerror(errno));
+    return 0;
+}
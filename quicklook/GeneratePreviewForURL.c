@@ -6,7 +6,7 @@
 
 OSStatus GeneratePreviewForURL(void *thisInterface, QLPreviewRequestRef preview, CFURLRef url, CFStringRef contentTypeUTI, CFDictionaryRef options);
 void CancelPreviewGeneration(void *thisInterface, QLPreviewRequestRef preview);
-CGImageRef ottd_get_cgimage(const ottd_t *game, int mode);
+CGImageRef ottd_get_cgimage(const ottd_t *game, int mode, const ottd_options_t *opts);
 
 #define kTextLeft 16.0f
 #define kTextFont "Helvetica-Bold"
@@ -53,6 +53,11 @@ void DrawCompanyName(CGContextRef ctx, const char *name, int color, CGFloat y)
     CFRelease(frame);
 }
 
+static int PreviewCancelled(void *ctx, int stage, uint64_t done, uint64_t total)
+{
+    return QLPreviewRequestIsCancelled((QLPreviewRequestRef)ctx);
+}
+
 OSStatus GeneratePreviewForURL(void *thisInterface, QLPreviewRequestRef preview, CFURLRef url, CFStringRef contentTypeUTI, CFDictionaryRef options)
 {
     ottd_t *game = NULL;
@@ -61,12 +66,14 @@ OSStatus GeneratePreviewForURL(void *thisInterface, QLPreviewRequestRef preview,
     // get path from URL
     if (!CFURLGetFileSystemRepresentation(url, true, (UInt8*)path, MAXPATHLEN)) goto fail;
     
-    // load savegame
-    game = ottd_load(path, 0);
+    // load savegame, polling for cancellation, the render below polls too
+    ottd_options_t opts = { .progress = PreviewCancelled, .progress_ctx = (void*)preview };
+    game = ottd_open(path, &opts, NULL);
     if (game == NULL) goto fail;
     
     // get map image
-    CGImageRef img = ottd_get_cgimage(game, OTTD_MAP_ISO);
+    CGImageRef img = ottd_get_cgimage(game, OTTD_MAP_ISO, &opts);
+    if (img == NULL) goto fail;
     CGRect imgRect = CGRectMake(0, 0, CGImageGetWidth(img), CGImageGetHeight(img));
     CGRect tableRect = CGRectMake(kTextLeft, 0, 240, 200);
     CGSize size = imgRect.size;
@@ -89,11 +96,11 @@ OSStatus GeneratePreviewForURL(void *thisInterface, QLPreviewRequestRef preview,
     
     // draw text
     char yearsText[32];
-    snprintf(yearsText, sizeof yearsText, "%d-%d", game->startYear, game->curDate.year);
+    snprintf(yearsText, sizeof yearsText, "%d-%d", ottd_start_year(game), ottd_current_date(game).year);
     DrawCompanyName(ctx, yearsText, 14, tableRect.origin.y + tableRect.size.height - kTextLineHeight*1);
     int companyLine = 2;
     for(int i=0; i < 15; i++) {
-        ottd_company_t *cmp= &game->company[i];
+        const ottd_company_t *cmp= ottd_company(game, i);
         if (!cmp->active) continue;
         DrawCompanyName(ctx, cmp->name, cmp->color, tableRect.origin.y + tableRect.size.height - kTextLineHeight*companyLine++);
     }
@@ -112,5 +119,5 @@ fail:
 
 void CancelPreviewGeneration(void *thisInterface, QLPreviewRequestRef preview)
 {
-    // Implement only if supported
+    // nothing to do, the loader and the renderer poll QLPreviewRequestIsCancelled
 }
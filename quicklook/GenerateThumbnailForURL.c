@@ -6,7 +6,7 @@
 
 OSStatus GenerateThumbnailForURL(void *thisInterface, QLThumbnailRequestRef thumbnail, CFURLRef url, CFStringRef contentTypeUTI, CFDictionaryRef options, CGSize maxSize);
 void CancelThumbnailGeneration(void *thisInterface, QLThumbnailRequestRef thumbnail);
-CGImageRef ottd_get_cgimage(const ottd_t *game, int mode);
+CGImageRef ottd_get_cgimage(const ottd_t *game, int mode, const ottd_options_t *opts);
 
 /* -----------------------------------------------------------------------------
     Generate a thumbnail for file
@@ -37,6 +37,11 @@ CGImageRef CGimageResize(CGImageRef image, CGSize maxSize)
     return imgRef;
 }
 
+static int ThumbnailCancelled(void *ctx, int stage, uint64_t done, uint64_t total)
+{
+    return QLThumbnailRequestIsCancelled((QLThumbnailRequestRef)ctx);
+}
+
 OSStatus GenerateThumbnailForURL(void *thisInterface, QLThumbnailRequestRef thumbnail, CFURLRef url, CFStringRef contentTypeUTI, CFDictionaryRef options, CGSize maxSize)
 {
     ottd_t *game = NULL;
@@ -45,12 +50,14 @@ OSStatus GenerateThumbnailForURL(void *thisInterface, QLThumbnailRequestRef thum
     // get path from URL
     if (!CFURLGetFileSystemRepresentation(url, true, (UInt8*)path, MAXPATHLEN)) goto fail;
     
-    // load savegame
-    game = ottd_load(path, 0);
+    // load savegame, polling for cancellation, the render below polls too
+    ottd_options_t opts = { .progress = ThumbnailCancelled, .progress_ctx = (void*)thumbnail };
+    game = ottd_open(path, &opts, NULL);
     if (game == NULL) goto fail;
     
     // make map picture
-    CGImageRef img = ottd_get_cgimage(game, OTTD_MAP_NW);
+    CGImageRef img = ottd_get_cgimage(game, OTTD_MAP_NW, &opts);
+    if (img == NULL) goto fail;
     
     // set thumbnail
     CGImageRef thumbnailImg = CGimageResize(img, maxSize);
@@ -68,5 +75,5 @@ fail:
 
 void CancelThumbnailGeneration(void *thisInterface, QLThumbnailRequestRef thumbnail)
 {
-    // Implement only if supported
+    // nothing to do, the loader and the renderer poll QLThumbnailRequestIsCancelled
 }
@@ -9,134 +9,28 @@
 #include <ApplicationServices/ApplicationServices.h>
 #include "ottd.h"
 
-static unsigned char ottdColorTable[] = {
-    0x00, 0x00, 0x00, 0xd4, 0x00, 0xd4, 0xd4, 0x00, 0xd4, 0xd4, 0x00, 0xd4, 
-    0xd4, 0x00, 0xd4, 0xd4, 0x00, 0xd4, 0xd4, 0x00, 0xd4, 0xd4, 0x00, 0xd4, 
-    0xd4, 0x00, 0xd4, 0xd4, 0x00, 0xd4, 0xa8, 0xa8, 0xa8, 0xb8, 0xb8, 0xb8, 
-    0xc8, 0xc8, 0xc8, 0xd8, 0xd8, 0xd8, 0xe8, 0xe8, 0xe8, 0xfc, 0xfc, 0xfc, 
-    0x34, 0x3c, 0x48, 0x44, 0x4c, 0x5c, 0x58, 0x60, 0x70, 0x6c, 0x74, 0x84, 
-    0x84, 0x8c, 0x98, 0x9c, 0xa0, 0xac, 0xb0, 0xb8, 0xc4, 0xcc, 0xd0, 0xdc, 
-    0x30, 0x2c, 0x04, 0x40, 0x3c, 0x0c, 0x50, 0x4c, 0x14, 0x60, 0x5c, 0x1c, 
-    0x78, 0x78, 0x40, 0x94, 0x94, 0x64, 0xb0, 0xb0, 0x84, 0xcc, 0xcc, 0xa8, 
-    0x64, 0x64, 0x64, 0x74, 0x74, 0x74, 0x68, 0x50, 0x2c, 0x7c, 0x68, 0x48, 
-    0x98, 0x84, 0x5c, 0xb8, 0xa0, 0x78, 0xd4, 0xbc, 0x94, 0xf4, 0xdc, 0xb0, 
-    0x84, 0x84, 0x84, 0x58, 0x04, 0x10, 0x70, 0x10, 0x20, 0x88, 0x20, 0x34, 
-    0xa0, 0x38, 0x4c, 0xbc, 0x54, 0x6c, 0xcc, 0x68, 0x7c, 0xdc, 0x84, 0x90, 
-    0xec, 0x9c, 0xa4, 0xfc, 0xbc, 0xc0, 0xfc, 0xd4, 0x00, 0xfc, 0xe8, 0x3c, 
-    0xfc, 0xf8, 0x80, 0x4c, 0x28, 0x00, 0x60, 0x3c, 0x08, 0x74, 0x58, 0x1c, 
-    0x88, 0x74, 0x38, 0x9c, 0x88, 0x50, 0xb0, 0x9c, 0x6c, 0xc4, 0xb4, 0x88, 
-    0x44, 0x18, 0x00, 0x60, 0x2c, 0x04, 0x80, 0x44, 0x08, 0x9c, 0x60, 0x10, 
-    0xb8, 0x78, 0x18, 0xd4, 0x9c, 0x20, 0xe8, 0xb8, 0x10, 0xfc, 0xd4, 0x00, 
-    0xfc, 0xf8, 0x80, 0xfc, 0xfc, 0xc0, 0x20, 0x04, 0x00, 0x40, 0x14, 0x08, 
-    0x54, 0x1c, 0x10, 0x6c, 0x2c, 0x1c, 0x80, 0x38, 0x28, 0x94, 0x48, 0x38, 
-    0xa8, 0x5c, 0x4c, 0xb8, 0x6c, 0x58, 0xc4, 0x80, 0x6c, 0xd4, 0x94, 0x80, 
-    0x08, 0x34, 0x00, 0x10, 0x40, 0x00, 0x20, 0x50, 0x04, 0x30, 0x60, 0x04, 
-    0x40, 0x70, 0x0c, 0x54, 0x84, 0x14, 0x68, 0x94, 0x1c, 0x80, 0xa8, 0x2c, 
-    0x40, 0x40, 0x40, 0x2c, 0x44, 0x20, 0x3c, 0x58, 0x30, 0x50, 0x68, 0x3c, 
-    0x68, 0x7c, 0x4c, 0x80, 0x94, 0x5c, 0x98, 0xb0, 0x6c, 0xb4, 0xcc, 0x7c, 
-    0x10, 0x34, 0x18, 0x20, 0x48, 0x2c, 0x38, 0x60, 0x48, 0x4c, 0x74, 0x58, 
-    0x60, 0x88, 0x6c, 0x78, 0xa4, 0x88, 0x98, 0xc0, 0xa8, 0xb8, 0xdc, 0xc8, 
-    0x20, 0x18, 0x00, 0x38, 0x1c, 0x00, 0x50, 0x50, 0x50, 0x58, 0x34, 0x0c, 
-    0x68, 0x40, 0x18, 0x7c, 0x54, 0x2c, 0x8c, 0x6c, 0x40, 0xa0, 0x80, 0x58, 
-    0x4c, 0x28, 0x10, 0x60, 0x34, 0x18, 0x74, 0x44, 0x28, 0x88, 0x54, 0x38, 
-    0xa4, 0x60, 0x40, 0xb8, 0x70, 0x50, 0xcc, 0x80, 0x60, 0xd4, 0x94, 0x70, 
-    0xe0, 0xa8, 0x80, 0xec, 0xbc, 0x94, 0x50, 0x1c, 0x04, 0x64, 0x28, 0x14, 
-    0x78, 0x38, 0x28, 0x8c, 0x4c, 0x40, 0xa0, 0x64, 0x60, 0xb8, 0x88, 0x88, 
-    0x24, 0x28, 0x44, 0x30, 0x34, 0x54, 0x40, 0x40, 0x64, 0x50, 0x50, 0x74, 
-    0x64, 0x64, 0x88, 0x84, 0x84, 0xa4, 0xac, 0xac, 0xc0, 0xd4, 0xd4, 0xe0, 
-    0x30, 0x30, 0x30, 0x40, 0x2c, 0x90, 0x58, 0x40, 0xac, 0x68, 0x4c, 0xc4, 
-    0x78, 0x58, 0xe0, 0x8c, 0x68, 0xfc, 0xa0, 0x88, 0xfc, 0xbc, 0xa8, 0xfc, 
-    0x00, 0x18, 0x6c, 0x00, 0x24, 0x84, 0x00, 0x34, 0xa0, 0x00, 0x48, 0xb8, 
-    0x00, 0x60, 0xd4, 0x18, 0x78, 0xdc, 0x38, 0x90, 0xe8, 0x58, 0xa8, 0xf0, 
-    0x80, 0xc4, 0xfc, 0xbc, 0xe0, 0xfc, 0x10, 0x40, 0x60, 0x18, 0x50, 0x6c, 
-    0x28, 0x60, 0x78, 0x34, 0x70, 0x84, 0x50, 0x8c, 0xa0, 0x74, 0xac, 0xc0, 
-    0x9c, 0xcc, 0xdc, 0xcc, 0xf0, 0xfc, 0xac, 0x34, 0x34, 0xd4, 0x34, 0x34, 
-    0xfc, 0x34, 0x34, 0xfc, 0x64, 0x58, 0xfc, 0x90, 0x7c, 0xfc, 0xb8, 0xa0, 
-    0xfc, 0xd8, 0xc8, 0xfc, 0xf4, 0xec, 0x48, 0x14, 0x70, 0x5c, 0x2c, 0x8c, 
-    0x70, 0x44, 0xa8, 0x8c, 0x64, 0xc4, 0xa8, 0x88, 0xe0, 0xcc, 0xb4, 0xfc, 
-    0xcc, 0xb4, 0xfc, 0xe8, 0xd0, 0xfc, 0x3c, 0x00, 0x00, 0x5c, 0x00, 0x00, 
-    0x80, 0x00, 0x00, 0xa0, 0x00, 0x00, 0xc4, 0x00, 0x00, 0xe0, 0x00, 0x00, 
-    0xfc, 0x00, 0x00, 0xfc, 0x50, 0x00, 0xfc, 0x6c, 0x00, 0xfc, 0x88, 0x00, 
-    0xfc, 0xa4, 0x00, 0xfc, 0xc0, 0x00, 0xfc, 0xdc, 0x00, 0xfc, 0xfc, 0x00, 
-    0xcc, 0x88, 0x08, 0xe4, 0x90, 0x04, 0xfc, 0x9c, 0x00, 0xfc, 0xb0, 0x30, 
-    0xfc, 0xc4, 0x64, 0xfc, 0xd8, 0x98, 0x08, 0x18, 0x58, 0x0c, 0x24, 0x68, 
-    0x14, 0x34, 0x7c, 0x1c, 0x44, 0x8c, 0x28, 0x5c, 0xa4, 0x38, 0x78, 0xbc, 
-    0x48, 0x98, 0xd8, 0x64, 0xac, 0xe0, 0x5c, 0x9c, 0x34, 0x6c, 0xb0, 0x40, 
-    0x7c, 0xc8, 0x4c, 0x90, 0xe0, 0x5c, 0xe0, 0xf4, 0xfc, 0xcc, 0xf0, 0xfc, 
-    0xb4, 0xdc, 0xec, 0x84, 0xbc, 0xd8, 0x58, 0x98, 0xac, 0x10, 0x10, 0x10, 
-    0x20, 0x20, 0x20, 0x08, 0x5c, 0x68, 0x10, 0x64, 0x70, 0x18, 0x6c, 0x78, 
-    0x20, 0x74, 0x80, 0x2c, 0x7c, 0x8c, 0x5c, 0xa4, 0xb8, 0x74, 0xb4, 0xc4, 
-    0x94, 0xc8, 0xd8, 0xb4, 0xdc, 0xe8, 0xd8, 0xf4, 0xfc, 0x00, 0x00, 0x00, 
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
-    0xfc, 0x3c, 0x00, 0xfc, 0x50, 0x00, 0xfc, 0x68, 0x00, 0xfc, 0x80, 0x00, 
-    0xfc, 0x94, 0x00, 0xfc, 0xac, 0x00, 0xfc, 0xc4, 0x00, 0xfc, 0x00, 0x00, 
-    0xfc, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
-    0xfc, 0xe4, 0x00, 0x94, 0x94, 0x94, 0xd4, 0x00, 0xd4, 0xd4, 0x00, 0xd4, 
-    0xd4, 0x00, 0xd4, 0xd4, 0x00, 0xd4, 0xd4, 0x00, 0xd4, 0xd4, 0x00, 0xd4, 
-    0xd4, 0x00, 0xd4, 0xd4, 0x00, 0xd4, 0xd4, 0x00, 0xd4, 0xfc, 0xfc, 0xfc
-};
-
-CGImageRef ottd_get_cgimage(const ottd_t *game, int mode)
+// renders game with opts, so its progress callback can cancel the render, NULL on failure
+CGImageRef ottd_get_cgimage(const ottd_t *game, int mode, const ottd_options_t *opts)
 {
-    size_t width, height;
-    switch(mode) {
-        case OTTD_MAP_ISO:
-            width = (game->mapSize.x + game->mapSize.y);
-            height = (game->mapSize.x + game->mapSize.y)/2;
-            break;
-        case OTTD_MAP_NE:
-            width = game->mapSize.y-2;
-            height = game->mapSize.x-2;
-            break;
-        case OTTD_MAP_NW:
-        default:
-            mode = OTTD_MAP_NW;
-            width = game->mapSize.x-2;
-            height = game->mapSize.y-2;
-    }
-    
-    // create data
-    CFMutableDataRef data = CFDataCreateMutable(kCFAllocatorDefault, width*height);
+    if (mode != OTTD_MAP_ISO && mode != OTTD_MAP_NE) mode = OTTD_MAP_NW;
     
-    // image data
-    uint8_t *row = malloc(width);
-    for(int py=0; py < height; py++) {
-        for(int px=0; px < width; px++) {
-            ottd_tile_t *tile = &game->tile[py+1][width-px]; // default OTTD_MAP_NW
-            if (mode == OTTD_MAP_ISO) {
-                int jpx = (int)width-px-game->mapSize.y;
-                int ry = (py) - (jpx/2);
-                int rx = (py) + (jpx/2);
-                if (rx < 0 || ry < 0 || rx >= game->mapSize.x || ry >= game->mapSize.y) {
-                    tile = NULL;
-                } else {
-                    tile = &game->tile[ry][rx];
-                }
-            } else if (mode == OTTD_MAP_NE) {
-                tile = &game->tile[px+1][py+1];
-            }
-            row[px] = ottd_tile_color(game, tile);
-        }
-        CFDataAppendBytes(data, row, width);
-    }
-    free(row);
+    // image data, rendered in parallel bands by the shared renderer
+    ottd_view_t view;
+    if (ottd_render(game, mode, OTTD_PIXEL_INDEXED, &view, opts, NULL)) return NULL;
+    CFDataRef data = CFDataCreate(kCFAllocatorDefault, view.pixels, view.stride * view.height);
+    size_t width = view.width, height = view.height, stride = view.stride;
+    ottd_view_free(&view);
+    if (data == NULL) return NULL;
     
-    // create CGImage
+    // create CGImage, png_color is packed rgb like the table CoreGraphics wants
     CGColorSpaceRef baseSpace = CGColorSpaceCreateDeviceRGB();
-    CGColorSpaceRef indexSpace = CGColorSpaceCreateIndexed(baseSpace, 255, ottdColorTable);
+    CGColorSpaceRef indexSpace = CGColorSpaceCreateIndexed(baseSpace, 255, (const unsigned char*)ottd_color);
     CGDataProviderRef dataProvider = CGDataProviderCreateWithCFData(data);
-    CGImageRef img = CGImageCreate(width, height, 8, 8, width, indexSpace, kCGBitmapByteOrderDefault, dataProvider, NULL, true, kCGRenderingIntentDefault);
+    CGImageRef img = CGImageCreate(width, height, 8, 8, stride, indexSpace, kCGBitmapByteOrderDefault, dataProvider, NULL, true, kCGRenderingIntentDefault);
     CGColorSpaceRelease(indexSpace);
     CGColorSpaceRelease(baseSpace);
     CGDataProviderRelease(dataProvider); 
     CFRelease(data);
     
     return img;
-fail:
-    if (img) CGImageRelease(img);
-    if (baseSpace) CGColorSpaceRelease(baseSpace);
-    if (indexSpace) CGColorSpaceRelease(indexSpace);
-    if (dataProvider) CGDataProviderRelease(dataProvider);
-    if (data) CFRelease(data);
-    return NULL;
-}
\ No newline at end of file
+}
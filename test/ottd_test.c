@@ -0,0 +1,776 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "ottd_internal.h"
+
+// library tests: synthetic maps built in memory, rendered and analysed through the public
+// api, and compared against simple per-pixel or per-tile reference implementations.
+// run by `make test`, exits non-zero when any check fails
+
+static int checks, failures;
+
+#define CHECK(cond, ...) do { \
+    checks++; \
+    if (!(cond)) { \
+        failures++; \
+        fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+    } \
+} while(0)
+
+static const char *mode_name[] = {"nw", "ne", "iso"};
+
+static uint32_t test_random(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 16;
+}
+
+// a map of every tile type, owned by companies, towns and nobody, with a ridge of heights
+static ottd_t* test_map(uint32_t width, uint32_t height, uint32_t seed)
+{
+    ottd_t *game = calloc(1, sizeof *game);
+    game->mapSize.x = width;
+    game->mapSize.y = height;
+    game->mapt = malloc((size_t)width * height);
+    game->mapo = malloc((size_t)width * height);
+    for(int c=0; c < 15; c++) {
+        game->company[c].active = c % 3 != 2;
+        game->company[c].color = (c * 5) % 16;
+    }
+    for(uint32_t y=0; y < height; y++) {
+        for(uint32_t x=0; x < width; x++) {
+            size_t i = (size_t)y * width + x;
+            uint32_t r = test_random(&seed);
+            uint32_t type = r % 11, owner = (r >> 4) % 0x12;
+            if (x == width - 1 || y == height - 1) type = MP_VOID;
+            int h = (x + y) / 8 % 16;
+            game->mapt[i] = type << 4 | h;
+            game->mapo[i] = (type == MP_ROAD && r & 0x400)? owner : (r >> 8 & 0xE0) | owner;
+        }
+    }
+    return game;
+}
+
+static void test_map_free(ottd_t *game)
+{
+    free(game->mapt);
+    free(game->mapo);
+    free(game);
+}
+
+// a synthetic map and a temporary directory for the files written from it
+typedef struct test_fixture {
+    ottd_t *map;
+    char dir[32];
+} test_fixture_t;
+
+// takes map, which is freed by test_fixture_end or here when there's no directory
+static int test_fixture_begin(test_fixture_t *f, ottd_t *map)
+{
+    f->map = map;
+    strcpy(f->dir, "/tmp/ottd_test.XXXXXX");
+    if (mkdtemp(f->dir)) return 0;
+    CHECK(0, "cannot create a temporary directory");
+    test_map_free(map);
+    return -1;
+}
+
+static void test_fixture_end(test_fixture_t *f)
+{
+    rmdir(f->dir);
+    test_map_free(f->map);
+}
+
+static char* test_fixture_path(const test_fixture_t *f, char *path, size_t size, const char *name)
+{
+    snprintf(path, size, "%s/%s", f->dir, name);
+    return path;
+}
+
+static uint8_t* test_read_file(const char *path, size_t *size)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return NULL;
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    rewind(fp);
+    uint8_t *data = malloc(*size? *size : 1);
+    if (fread(data, 1, *size, fp) != *size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    return data;
+}
+
+static void test_put32(FILE *fp, uint32_t v)
+{
+    uint8_t b[4] = { v >> 24, v >> 16, v >> 8, v };
+    fwrite(b, 1, 4, fp);
+}
+
+static void test_chunk(FILE *fp, const char *tag, const uint8_t *data, uint32_t size)
+{
+    fwrite(tag, 1, 4, fp);
+    test_put32(fp, (size >> 24) << 28 | (size & 0xFFFFFF));
+    fwrite(data, 1, size, fp);
+}
+
+// an uncompressed savegame holding only the map planes of game
+static int test_write_save(const ottd_t *game, const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) return -1;
+    uint32_t tiles = game->mapSize.x * game->mapSize.y;
+    uint8_t maps[8], header[8] = { 'O', 'T', 'T', 'N', 0, 200, 0, 0 };
+    for(int i=0; i < 4; i++) {
+        maps[i] = game->mapSize.x >> (24 - 8 * i);
+        maps[4 + i] = game->mapSize.y >> (24 - 8 * i);
+    }
+    fwrite(header, 1, sizeof header, fp);
+    test_chunk(fp, "MAPS", maps, sizeof maps);
+    test_chunk(fp, "MAPT", game->mapt, tiles);
+    test_chunk(fp, "MAPO", game->mapo, tiles);
+    test_put32(fp, 0);
+    return fclose(fp);
+}
+
+// the fixture's map written to a save and loaded back with flags, or through a map cache
+static ottd_t* test_fixture_load(const test_fixture_t *f, int flags, int cache)
+{
+    char path[64], map_cache[64];
+    test_fixture_path(f, path, sizeof path, "test.sav");
+    test_fixture_path(f, map_cache, sizeof map_cache, "test.ottdmap");
+    if (test_write_save(f->map, path)) {
+        CHECK(0, "cannot write %s", path);
+        return NULL;
+    }
+    ottd_options_t opts = { .flags = flags, .map_cache = cache? map_cache : NULL };
+    ottd_error_t err;
+    ottd_t *loaded = ottd_open(path, &opts, &err);
+    // the first open writes the cache, the second maps it
+    if (loaded && cache) {
+        ottd_free(loaded);
+        loaded = ottd_open(path, &opts, &err);
+    }
+    CHECK(loaded, "%s%s: %s", (flags & OTTD_F_RLE_MAP)? "run-length " : "", cache? "cached " : "", err.message);
+    remove(path);
+    remove(map_cache);
+    return loaded;
+}
+
+#pragma mark - Render core
+
+// the colour of pixel px, py as the original renderer found it, one tile at a time
+static uint8_t test_pixel(const ottd_t *game, int mode, int width, int px, int py)
+{
+    int x = width - px, y = py + 1;
+    if (mode == OTTD_MAP_ISO) {
+        int jpx = width - px - (int)game->mapSize.y;
+        y = py - jpx / 2;
+        x = py + jpx / 2;
+        if (x < 0 || y < 0 || x >= (int)game->mapSize.x || y >= (int)game->mapSize.y) return ottd_tile_color(game, NULL);
+    } else if (mode == OTTD_MAP_NE) {
+        x = py + 1;
+        y = px + 1;
+    }
+    ottd_tile_t tile;
+    ottd_get_tile(game, x, y, &tile);
+    return ottd_tile_color(game, &tile);
+}
+
+// the rows renderer, and indexed and RGBA renders on one thread or several into padded
+// rows, all match a tile lookup per pixel
+static void test_render(void)
+{
+    static const uint32_t sizes[][2] = {{65, 40}, {40, 70}, {300, 130}};
+    for(int s=0; s < 3; s++) {
+        ottd_t *game = test_map(sizes[s][0], sizes[s][1], s + 1);
+        for(int mode=OTTD_MAP_NW; mode <= OTTD_MAP_ISO; mode++) {
+            int width, height;
+            CHECK(ottd_image_size(game, mode, &width, &height) == 0, "image size");
+            uint8_t *ref = malloc((size_t)width * height), *rows = malloc((size_t)width * height);
+            for(int y=0; y < height; y++) {
+                for(int x=0; x < width; x++) ref[(size_t)y * width + x] = test_pixel(game, mode, width, x, y);
+            }
+            CHECK(ottd_render_rows(game, mode, 0, height, rows, width) == 0, "render rows");
+            CHECK(memcmp(ref, rows, (size_t)width * height) == 0, "%ux%u %s: rows differ from a lookup per pixel", game->mapSize.x, game->mapSize.y, mode_name[mode]);
+            free(rows);
+            for(int threads=1; threads <= 4; threads += 3) {
+                ottd_options_t opts = { .threads = threads };
+                ottd_error_t err;
+                size_t istride = width + 13, rstride = 4 * (size_t)width + 7;
+                uint8_t *indexed = malloc(istride * height), *rgba = malloc(rstride * height);
+                memset(indexed, 0xA5, istride * height);
+                memset(rgba, 0xA5, rstride * height);
+                CHECK(ottd_render_pixels(game, mode, OTTD_PIXEL_INDEXED, indexed, istride, &opts, &err) == 0, "indexed: %s", err.message);
+                CHECK(ottd_render_pixels(game, mode, OTTD_PIXEL_RGBA, rgba, rstride, &opts, &err) == 0, "rgba: %s", err.message);
+                ottd_view_t iview, rview;
+                CHECK(ottd_render(game, mode, OTTD_PIXEL_INDEXED, &iview, &opts, &err) == 0, "indexed view: %s", err.message);
+                CHECK(ottd_render(game, mode, OTTD_PIXEL_RGBA, &rview, &opts, &err) == 0, "rgba view: %s", err.message);
+                int bad = 0, padding = 0;
+                for(int y=0; y < height; y++) {
+                    const uint8_t *row = ref + (size_t)y * width;
+                    bad += memcmp(row, indexed + y * istride, width) != 0;
+                    bad += memcmp(row, iview.pixels + y * iview.stride, width) != 0;
+                    for(int x=0; x < width; x++) {
+                        const uint8_t *p = rgba + y * rstride + 4 * x, *v = rview.pixels + y * rview.stride + 4 * x;
+                        png_color c = ottd_color[row[x]];
+                        bad += p[0] != c.red || p[1] != c.green || p[2] != c.blue || p[3] != 0xFF;
+                        bad += memcmp(p, v, 4) != 0;
+                    }
+                    for(size_t x=width; x < istride; x++) padding += indexed[y * istride + x] != 0xA5;
+                    for(size_t x=4 * (size_t)width; x < rstride; x++) padding += rgba[y * rstride + x] != 0xA5;
+                }
+                CHECK(bad == 0, "%ux%u %s, %d threads: %d rows or pixels differ", game->mapSize.x, game->mapSize.y, mode_name[mode], threads, bad);
+                CHECK(padding == 0, "%ux%u %s, %d threads: %d padding bytes written", game->mapSize.x, game->mapSize.y, mode_name[mode], threads, padding);
+                ottd_view_free(&iview);
+                ottd_view_free(&rview);
+                free(indexed);
+                free(rgba);
+            }
+            free(ref);
+        }
+        test_map_free(game);
+    }
+}
+
+#pragma mark - Viewports
+
+static uint8_t* test_viewport(const ottd_t *game, const ottd_viewport_t *vp, int *width, int *height)
+{
+    ottd_error_t err;
+    if (ottd_viewport_size(game, vp, width, height)) {
+        CHECK(0, "%s viewport %u,%u %ux%u zoom %d has no size", mode_name[vp->mode], vp->x, vp->y, vp->w, vp->h, vp->zoom);
+        return NULL;
+    }
+    uint8_t *buf = malloc((size_t)*width * *height);
+    if (ottd_render_viewport(game, vp, OTTD_PIXEL_INDEXED, buf, *width, NULL, &err)) {
+        CHECK(0, "%s viewport: %s", mode_name[vp->mode], err.message);
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+// whether the w x h image is found somewhere in the full one
+static int test_contains(const uint8_t *full, int width, int height, const uint8_t *crop, int w, int h)
+{
+    for(int oy=0; oy + h <= height; oy++) {
+        for(int ox=0; ox + w <= width; ox++) {
+            int y = 0;
+            while(y < h && memcmp(full + (size_t)(oy + y) * width + ox, crop + (size_t)y * w, w) == 0) y++;
+            if (y == h) return 1;
+        }
+    }
+    return 0;
+}
+
+// a crop of the whole map is the full image, a smaller one is a piece of it, and zoomed
+// crops repeat or skip the pixels of the zoom 1 crop
+static void test_viewports(void)
+{
+    ottd_t *game = test_map(90, 60, 7);
+    for(int mode=OTTD_MAP_NW; mode <= OTTD_MAP_ISO; mode++) {
+        int width, height, w, h;
+        ottd_image_size(game, mode, &width, &height);
+        uint8_t *full = malloc((size_t)width * height);
+        ottd_render_rows(game, mode, 0, height, full, width);
+
+        ottd_viewport_t vp = { .mode = mode, .x = 0, .y = 0, .w = 90, .h = 60 };
+        uint8_t *crop = test_viewport(game, &vp, &w, &h);
+        CHECK(crop && w == width && h == height && memcmp(crop, full, (size_t)width * height) == 0, "%s whole map crop differs from the full image", mode_name[mode]);
+        free(crop);
+
+        vp = (ottd_viewport_t){ .mode = mode, .x = 17, .y = 9, .w = 31, .h = 23 };
+        uint8_t *base = test_viewport(game, &vp, &w, &h);
+        if (base == NULL) {
+            free(full);
+            continue;
+        }
+        CHECK(test_contains(full, width, height, base, w, h), "%s crop isn't part of the full image", mode_name[mode]);
+        for(int zoom=-3; zoom <= 3; zoom++) {
+            if (zoom >= -1 && zoom <= 1) continue;
+            int zw, zh, bad = 0;
+            vp.zoom = zoom;
+            uint8_t *zoomed = test_viewport(game, &vp, &zw, &zh);
+            if (zoomed == NULL) continue;
+            int step = (zoom < -1)? -zoom : 1, mag = (zoom > 1)? zoom : 1;
+            CHECK(zw == (w + step - 1) / step * mag && zh == (h + step - 1) / step * mag, "%s zoom %d is %dx%d", mode_name[mode], zoom, zw, zh);
+            for(int y=0; y < zh && zw == (w + step - 1) / step * mag; y++) {
+                for(int x=0; x < zw; x++) {
+                    bad += zoomed[(size_t)y * zw + x] != base[(size_t)(y / mag * step) * w + x / mag * step];
+                }
+            }
+            CHECK(bad == 0, "%s zoom %d: %d pixels differ from zoom 1", mode_name[mode], zoom, bad);
+            free(zoomed);
+        }
+        free(base);
+        free(full);
+    }
+    test_map_free(game);
+}
+
+#pragma mark - Several images
+
+static int test_same_file(const char *a, const char *b)
+{
+    size_t a_size = 0, b_size = 0;
+    uint8_t *a_data = test_read_file(a, &a_size), *b_data = test_read_file(b, &b_size);
+    int same = a_data && b_data && a_size == b_size && memcmp(a_data, b_data, a_size) == 0;
+    free(a_data);
+    free(b_data);
+    return same;
+}
+
+// the images of one ottd_write_pngs call are byte-identical to writing each on its own,
+// and full-size ones to ottd_write_png
+static void test_write_pngs(int flags)
+{
+    test_fixture_t f;
+    if (test_fixture_begin(&f, test_map(120, 80, 11))) return;
+    static const int modes[] = {OTTD_MAP_NW, OTTD_MAP_NE, OTTD_MAP_ISO, OTTD_MAP_NW}, sizes[] = {0, 50, 0, 33};
+    ottd_options_t opts = { .flags = flags };
+    ottd_output_t outputs[4], single;
+    char paths[4][64], path[64], name[16];
+    ottd_error_t err;
+    for(int i=0; i < 4; i++) {
+        snprintf(name, sizeof name, "multi%d.png", i);
+        outputs[i] = (ottd_output_t){ .mode = modes[i], .path = test_fixture_path(&f, paths[i], sizeof paths[i], name), .size = sizes[i] };
+    }
+    CHECK(ottd_write_pngs(f.map, outputs, 4, &opts, &err) == 0, "write pngs: %s", err.message);
+    for(int i=0; i < 4; i++) {
+        single = (ottd_output_t){ .mode = modes[i], .path = test_fixture_path(&f, path, sizeof path, "single.png"), .size = sizes[i] };
+        CHECK(ottd_write_pngs(f.map, &single, 1, &opts, &err) == 0, "write png: %s", err.message);
+        CHECK(test_same_file(paths[i], path), "%s image %d of several differs from writing it alone, flags %x", mode_name[modes[i]], sizes[i], flags);
+        remove(path);
+    }
+    for(int i=0; i < 3; i += 2) {
+        CHECK(ottd_write_png(f.map, test_fixture_path(&f, path, sizeof path, "single.png"), modes[i], &opts, &err) == 0, "write png: %s", err.message);
+        CHECK(test_same_file(paths[i], path), "%s image of several differs from ottd_write_png, flags %x", mode_name[modes[i]], flags);
+        remove(path);
+    }
+    for(int i=0; i < 4; i++) remove(paths[i]);
+    test_fixture_end(&f);
+}
+
+#pragma mark - Hillshade
+
+// the SSE2 shade levels of a row match the scalar ones, at every width around the 16 tiles
+// it takes at once, on the edges of the map and in between
+static void test_shade_row(void)
+{
+    static const uint32_t widths[] = {1, 2, 16, 17, 33};
+    uint32_t seed = 5;
+    for(int w=0; w < 5; w++) {
+        uint32_t width = widths[w], height = 4;
+        uint8_t *mapt = malloc(width * height), level[33];
+        for(uint32_t i=0; i < width * height; i++) mapt[i] = test_random(&seed) & 0xFF;
+        for(uint32_t y=0; y < height; y++) {
+            ottd_shade_row(mapt, width, height, y, level);
+            int bad = 0;
+            for(uint32_t x=0; x < width; x++) {
+                const uint8_t *t = mapt + y * width + x;
+                int left = (x > 0)? t[-1] : t[0], right = (x + 1 < width)? t[1] : t[0];
+                int up = (y > 0)? t[-(int)width] : t[0], down = (y + 1 < height)? t[width] : t[0];
+                bad += level[x] != ottd_shade_level(left, down, right, up);
+            }
+            CHECK(bad == 0, "width %u row %u: %d shade levels differ", width, y, bad);
+        }
+        free(mapt);
+    }
+}
+
+// hillshaded renders agree whether they read a colour plane, shade tile by tile because
+// the map is run-length or the plane is over the memory budget, or are a whole map viewport
+static void test_hillshade(void)
+{
+    test_fixture_t f;
+    if (test_fixture_begin(&f, test_map(70, 45, 13))) return;
+    ottd_t *game = test_fixture_load(&f, 0, 0), *rle = test_fixture_load(&f, OTTD_F_RLE_MAP, 0);
+    for(int mode=OTTD_MAP_NW; mode <= OTTD_MAP_ISO && game && rle; mode++) {
+        int width, height;
+        ottd_image_size(game, mode, &width, &height);
+        size_t size = (size_t)width * height;
+        uint8_t *plane = malloc(size), *flat = malloc(size), *tiles = malloc(size), *budget = malloc(size), *view = malloc(size);
+        ottd_memory_t memory = { .budget = (uint64_t)game->mapSize.x * game->mapSize.y - 1 };
+        ottd_options_t opts = { .flags = OTTD_F_HILLSHADE }, small = { .flags = OTTD_F_HILLSHADE, .memory = &memory };
+        ottd_viewport_t vp = { .mode = mode, .x = 0, .y = 0, .w = game->mapSize.x, .h = game->mapSize.y };
+        ottd_error_t err;
+        CHECK(ottd_render_pixels(game, mode, OTTD_PIXEL_INDEXED, plane, width, &opts, &err) == 0, "hillshade: %s", err.message);
+        CHECK(ottd_render_pixels(game, mode, OTTD_PIXEL_INDEXED, flat, width, NULL, &err) == 0, "render: %s", err.message);
+        CHECK(memcmp(plane, flat, size) != 0, "%s hillshade changes nothing", mode_name[mode]);
+        CHECK(ottd_render_pixels(rle, mode, OTTD_PIXEL_INDEXED, tiles, width, &opts, &err) == 0, "run-length hillshade: %s", err.message);
+        CHECK(memcmp(plane, tiles, size) == 0, "%s run-length hillshade differs from the colour plane", mode_name[mode]);
+        CHECK(ottd_render_pixels(game, mode, OTTD_PIXEL_INDEXED, budget, width, &small, &err) == 0, "hillshade over budget: %s", err.message);
+        CHECK(memcmp(plane, budget, size) == 0, "%s hillshade over the memory budget differs from the colour plane", mode_name[mode]);
+        CHECK(ottd_render_viewport(rle, &vp, OTTD_PIXEL_INDEXED, view, width, &opts, &err) == 0, "viewport: %s", err.message);
+        CHECK(memcmp(plane, view, size) == 0, "%s hillshaded viewport differs from the colour plane", mode_name[mode]);
+        free(plane);
+        free(flat);
+        free(tiles);
+        free(budget);
+        free(view);
+    }
+    if (game) ottd_free(game);
+    if (rle) ottd_free(rle);
+    test_fixture_end(&f);
+}
+
+#pragma mark - Territory
+
+// the owner ottd_territory_t counts a tile under, from its raw planes
+static int test_territory_owner(const ottd_tile_t *tile)
+{
+    if (tile->type == MP_HOUSE) return OWNER_TOWN;
+    if (tile->type == MP_INDUSTRY || tile->type == MP_VOID) return OWNER_NOBODY;
+    int owner = (tile->type == MP_ROAD)? tile->owner : tile->owner & 0x1F;
+    return (owner <= OWNER_WATER)? owner : OWNER_NOBODY;
+}
+
+// random tiles with rows of long runs of one tile, which are counted sixteen at a time
+static ottd_t* test_runs(uint32_t width, uint32_t height, uint32_t seed)
+{
+    ottd_t *game = test_map(width, height, seed);
+    for(uint32_t y=1; y + 1 < height; y += 3) {
+        uint32_t r = test_random(&seed), first = r % 7, last = width - 1 - (r >> 3) % 5;
+        uint8_t mapt = ((y % 2)? MP_RAILWAY : MP_WATER) << 4 | (r >> 6 & 0x0F);
+        uint8_t mapo = (y % 2)? (r >> 10) % 15 : OWNER_WATER;
+        for(uint32_t x=first; x < last; x++) {
+            game->mapt[(size_t)y * width + x] = mapt;
+            game->mapo[(size_t)y * width + x] = mapo;
+        }
+    }
+    return game;
+}
+
+// territory counts and company bounds of flat, run-length and map cache loads all match a
+// count of ottd_get_tile over every tile
+static void test_territory(void)
+{
+    static const uint32_t sizes[][2] = {{70, 45}, {33, 20}, {257, 31}, {15, 12}};
+    static const char *load_name[] = {"flat", "run-length", "map cache"};
+    for(int s=0; s < 4; s++) {
+        test_fixture_t f;
+        if (test_fixture_begin(&f, test_runs(sizes[s][0], sizes[s][1], s + 21))) return;
+        const ottd_t *map = f.map;
+        for(int load=0; load < 3; load++) {
+            ottd_t *game = test_fixture_load(&f, (load == 1)? OTTD_F_RLE_MAP : 0, load == 2);
+            if (game == NULL) continue;
+            ottd_territory_t ref;
+            memset(&ref, 0, sizeof ref);
+            for(int c=0; c < 15; c++) ref.bounds[c].x0 = ref.bounds[c].y0 = UINT32_MAX;
+            for(uint32_t y=0; y < game->mapSize.y; y++) {
+                for(uint32_t x=0; x < game->mapSize.x; x++) {
+                    ottd_tile_t tile;
+                    ottd_get_tile(game, x, y, &tile);
+                    int owner = test_territory_owner(&tile);
+                    ref.tiles[owner][tile.type]++;
+                    if (owner >= OWNER_TOWN) continue;
+                    if (x < ref.bounds[owner].x0) ref.bounds[owner].x0 = x;
+                    if (x > ref.bounds[owner].x1) ref.bounds[owner].x1 = x;
+                    if (y < ref.bounds[owner].y0) ref.bounds[owner].y0 = y;
+                    ref.bounds[owner].y1 = y;
+                }
+            }
+            const ottd_territory_t *t = game->territory;
+            CHECK(t, "%ux%u %s load has no territory", map->mapSize.x, map->mapSize.y, load_name[load]);
+            int bad = 0;
+            for(int o=0; t && o < OTTD_TERRITORY_OWNERS; o++) {
+                for(int type=0; type < 16; type++) bad += t->tiles[o][type] != ref.tiles[o][type];
+            }
+            CHECK(bad == 0, "%ux%u %s load: %d territory counts differ", map->mapSize.x, map->mapSize.y, load_name[load], bad);
+            for(int c=0; t && c < 15; c++) {
+                int none = ref.bounds[c].x0 > ref.bounds[c].x1;
+                CHECK(none? t->bounds[c].x0 > t->bounds[c].x1 : memcmp(&t->bounds[c], &ref.bounds[c], sizeof ref.bounds[c]) == 0,
+                    "%ux%u %s load: company %d bounds %u,%u-%u,%u, not %u,%u-%u,%u", map->mapSize.x, map->mapSize.y, load_name[load], c,
+                    t->bounds[c].x0, t->bounds[c].y0, t->bounds[c].x1, t->bounds[c].y1, ref.bounds[c].x0, ref.bounds[c].y0, ref.bounds[c].x1, ref.bounds[c].y1);
+            }
+            ottd_free(game);
+        }
+        test_fixture_end(&f);
+    }
+}
+
+#pragma mark - Networks
+
+// the company whose network a tile is on, or -1
+static int test_network_owner(const ottd_t *game, uint32_t x, uint32_t y)
+{
+    ottd_tile_t tile;
+    ottd_get_tile(game, x, y, &tile);
+    int owner;
+    if (tile.type == MP_RAILWAY || tile.type == MP_STATION || tile.type == MP_TUNNELBRIDGE) owner = tile.owner & 0x1F;
+    else if (tile.type == MP_ROAD) owner = tile.owner;
+    else return -1;
+    return (owner < OWNER_TOWN)? owner : -1;
+}
+
+// random tiles, a rail line from top to bottom across every band, and two lines that only
+// meet at their bottom, two bands below where they start
+static ottd_t* test_network_map(uint32_t width, uint32_t height, uint32_t seed)
+{
+    ottd_t *game = test_map(width, height, seed);
+    for(uint32_t y=0; y + 1 < height; y++) {
+        for(uint32_t x=0; x + 1 < width; x++) {
+            size_t i = (size_t)y * width + x;
+            int line = x == 40 || ((x == 10 || x == 20) && y >= 5 && y <= 140) || (y == 140 && x >= 10 && x <= 20);
+            int beside = x == 39 || x == 41 || ((x == 9 || x == 11 || x == 19 || x == 21) && y >= 4 && y <= 141) || ((y == 139 || y == 141) && x >= 9 && x <= 21);
+            if (line) {
+                game->mapt[i] = MP_RAILWAY << 4;
+                game->mapo[i] = (x == 40)? 3 : 7;
+            } else if (beside) {
+                game->mapt[i] = MP_CLEAR << 4;
+            }
+        }
+    }
+    return game;
+}
+
+// networks of flat and run-length maps taller than a band, on one thread or several, match
+// a breadth-first search from every tile: tiles, bounds, labels, and the sort order
+static void test_networks(void)
+{
+    test_fixture_t f;
+    if (test_fixture_begin(&f, test_network_map(90, 150, 31))) return;
+    const ottd_t *map = f.map;
+    uint32_t width = map->mapSize.x, height = map->mapSize.y, tiles = width * height;
+    int *owner = malloc(tiles * sizeof *owner);
+    uint32_t *comp = calloc(tiles, sizeof *comp), *queue = malloc(tiles * sizeof *queue), count = 0;
+    ottd_network_t *ref = calloc(tiles, sizeof *ref);
+    for(uint32_t i=0; i < tiles; i++) owner[i] = test_network_owner(map, i % width, i / width);
+    for(uint32_t i=0; i < tiles; i++) {
+        if (owner[i] < 0 || comp[i]) continue;
+        ottd_network_t *n = &ref[count++];
+        *n = (ottd_network_t){ .owner = owner[i], .x0 = i % width, .y0 = i / width, .x1 = i % width, .y1 = i / width };
+        uint32_t head = 0, tail = 0;
+        comp[i] = count;
+        queue[tail++] = i;
+        while(head < tail) {
+            uint32_t t = queue[head++], x = t % width, y = t / width;
+            n->tiles++;
+            if (x < n->x0) n->x0 = x;
+            if (x > n->x1) n->x1 = x;
+            if (y < n->y0) n->y0 = y;
+            if (y > n->y1) n->y1 = y;
+            uint32_t next[4] = { t - 1, t + 1, t - width, t + width };
+            int ok[4] = { x > 0, x + 1 < width, y > 0, y + 1 < height };
+            for(int k=0; k < 4; k++) {
+                if (ok[k] && owner[next[k]] == n->owner && comp[next[k]] == 0) {
+                    comp[next[k]] = count;
+                    queue[tail++] = next[k];
+                }
+            }
+        }
+    }
+
+    ottd_t *rle = test_fixture_load(&f, OTTD_F_RLE_MAP, 0);
+    for(int load=0; load < 2; load++) {
+        const ottd_t *game = load? rle : map;
+        for(int threads=1; threads <= 4 && game; threads += 3) {
+            ottd_options_t opts = { .threads = threads };
+            ottd_networks_t nets;
+            ottd_error_t err;
+            if (ottd_find_networks(game, &nets, 1, &opts, &err)) {
+                CHECK(0, "find networks: %s", err.message);
+                continue;
+            }
+            const char *name = load? "run-length" : "flat";
+            CHECK(nets.count == count, "%s, %d threads: %u networks, not %u", name, threads, nets.count, count);
+            // each search's tiles carry one label, of a network with its owner, size and bounds
+            uint32_t *seen = calloc((size_t)nets.count + 1, sizeof *seen);
+            int bad = 0, companies[15] = {0};
+            for(uint32_t i=0; i < tiles; i++) bad += (owner[i] < 0) != (nets.labels[i] == 0);
+            CHECK(bad == 0, "%s, %d threads: %d tiles labelled wrong", name, threads, bad);
+            for(uint32_t i=0; i < tiles && nets.count == count; i++) {
+                if (owner[i] < 0) continue;
+                uint32_t label = nets.labels[i], c = comp[i];
+                if (label == 0 || label > nets.count || (seen[label] && seen[label] != c)) {
+                    bad++;
+                    continue;
+                }
+                if (seen[label]) continue;
+                seen[label] = c;
+                const ottd_network_t *n = &nets.network[label - 1], *r = &ref[c - 1];
+                bad += n->id != label || n->owner != r->owner || n->tiles != r->tiles;
+                bad += n->x0 != r->x0 || n->y0 != r->y0 || n->x1 != r->x1 || n->y1 != r->y1;
+                companies[r->owner]++;
+            }
+            CHECK(bad == 0, "%s, %d threads: %d networks differ from the search", name, threads, bad);
+            for(int c=0; c < 15; c++) bad += nets.companies[c] != (uint32_t)companies[c];
+            for(uint32_t n=1; n < nets.count; n++) {
+                const ottd_network_t *a = &nets.network[n - 1], *b = &nets.network[n];
+                bad += a->owner > b->owner || (a->owner == b->owner && a->tiles < b->tiles);
+            }
+            CHECK(bad == 0, "%s, %d threads: networks out of order or miscounted by company", name, threads);
+            // the line across every band is one network, as are the two lines joined at the bottom
+            uint32_t line = nets.labels[40], left = nets.labels[5 * width + 10], right = nets.labels[5 * width + 20];
+            CHECK(line && nets.network[line - 1].y0 == 0 && nets.network[line - 1].y1 == height - 2, "%s, %d threads: line split", name, threads);
+            CHECK(left && left == right, "%s, %d threads: lines joined below not one network", name, threads);
+            free(seen);
+            ottd_networks_free(&nets);
+        }
+    }
+    if (rle) ottd_free(rle);
+    free(owner);
+    free(comp);
+    free(queue);
+    free(ref);
+    test_fixture_end(&f);
+}
+
+typedef struct test_progress {
+    int calls, other, cancel_at;    // calls, calls outside OTTD_STAGE_ANALYSIS, call to cancel on or 0
+    uint64_t bands, rows;           // largest total seen per pass
+} test_progress_t;
+
+static int test_progress(void *ctx, int stage, uint64_t done, uint64_t total)
+{
+    test_progress_t *p = ctx;
+    p->calls++;
+    if (stage != OTTD_STAGE_ANALYSIS || done >= total) p->other++;
+    if (total < 64 && total > p->bands) p->bands = total;
+    if (total >= 64 && total > p->rows) p->rows = total;
+    return p->calls == p->cancel_at;
+}
+
+// finding networks reports its bands and rows as OTTD_STAGE_ANALYSIS, can be cancelled from
+// the progress callback, and charges its labels to OTTD_MEM_ANALYSIS until they're freed
+static void test_network_progress(void)
+{
+    ottd_t *map = test_network_map(90, 150, 31);
+    uint64_t labels = 90 * 150 * sizeof(uint32_t);
+    for(int threads=1; threads <= 4; threads += 3) {
+        test_progress_t progress = {0};
+        ottd_memory_t memory = {0};
+        ottd_options_t opts = { .threads = threads, .progress = test_progress, .progress_ctx = &progress, .memory = &memory };
+        ottd_networks_t nets;
+        ottd_error_t err;
+        int ret = ottd_find_networks(map, &nets, 1, &opts, &err);
+        CHECK(ret == 0, "%d threads: find networks: %s", threads, err.message);
+        CHECK(progress.calls && progress.other == 0 && progress.rows == 150, "%d threads: %d calls, %d outside analysis, %llu rows",
+            threads, progress.calls, progress.other, (unsigned long long)progress.rows);
+        CHECK(threads > 1 || progress.bands == 3, "one thread: %llu bands, not 3", (unsigned long long)progress.bands);
+        CHECK(memory.stage[OTTD_MEM_ANALYSIS].current == labels && memory.stage[OTTD_MEM_RENDER].peak == 0,
+            "%d threads: labels charged to the wrong stage", threads);
+        if (ret == 0) ottd_networks_free(&nets);
+        CHECK(memory.current == 0, "%d threads: %llu bytes still charged", threads, (unsigned long long)memory.current);
+
+        progress = (test_progress_t){ .cancel_at = 1 };
+        ret = ottd_find_networks(map, &nets, 1, &opts, &err);
+        CHECK(ret && err.code == OTTD_E_CANCELLED && memory.current == 0, "%d threads: cancelled search returned %d", threads, ret);
+        if (ret == 0) ottd_networks_free(&nets);
+    }
+    test_map_free(map);
+}
+
+#pragma mark - Map cache
+
+// writes a changed copy of a map cache back with its header checksum fixed up, and opens it
+static ottd_t* test_patched_cache(const char *cache, const uint8_t *data, size_t size, uint64_t offset, uint64_t value, int flags)
+{
+    uint8_t *copy = malloc(size);
+    memcpy(copy, data, size);
+    ottd_map_header_t h;
+    if (offset < sizeof h) {
+        memcpy(copy + offset, &value, sizeof value);
+    } else {
+        copy[offset] ^= (uint8_t)value;
+    }
+    memcpy(&h, copy, sizeof h);
+    h.crc = 0;
+    h.crc = (uint32_t)crc32(crc32(0, Z_NULL, 0), (const Bytef*)&h, sizeof h);
+    memcpy(copy, &h, sizeof h);
+    FILE *fp = fopen(cache, "wb");
+    int written = fp && fwrite(copy, 1, size, fp) == size;
+    if (fp) fclose(fp);
+    free(copy);
+    CHECK(written, "cannot write %s", cache);
+    ottd_options_t opts = { .flags = flags };
+    ottd_error_t err;
+    return written? ottd_open_map_cache(cache, NULL, &opts, &err) : NULL;
+}
+
+// a map cache whose plane offsets wrap around past the end of the file is refused, even
+// with a valid checksum. damaged planes are only noticed with OTTD_F_VERIFY_CACHE, and the
+// company table comes back whole
+static void test_map_cache(void)
+{
+    test_fixture_t f;
+    char path[64], cache[64];
+    if (test_fixture_begin(&f, test_map(40, 30, 41))) return;
+    test_fixture_path(&f, path, sizeof path, "test.sav");
+    test_fixture_path(&f, cache, sizeof cache, "test.ottdmap");
+    ottd_options_t opts = { .map_cache = cache };
+    ottd_error_t err;
+    ottd_t *game = NULL;
+    if (test_write_save(f.map, path) == 0) game = ottd_open(path, &opts, &err);
+    CHECK(game, "cannot write a map cache: %s", game? "" : err.message);
+    if (game) ottd_free(game);
+    size_t size = 0;
+    uint8_t *data = test_read_file(cache, &size);
+    uint64_t tiles = 40 * 30;
+    ottd_map_header_t h;
+    if (data) memcpy(&h, data, sizeof h);
+    for(int plane=0; data && plane < 2; plane++) {
+        uint64_t field = plane? offsetof(ottd_map_header_t, mapo_offset) : offsetof(ottd_map_header_t, mapt_offset);
+        game = test_patched_cache(cache, data, size, field, UINT64_MAX - tiles + 2, 0);
+        CHECK(game == NULL, "map cache with a wrapping %s offset opened", plane? "MAPO" : "MAPT");
+        if (game) ottd_free(game);
+
+        uint64_t tile = (plane? h.mapo_offset : h.mapt_offset) + tiles / 2;
+        game = test_patched_cache(cache, data, size, tile, 0xFF, 0);
+        CHECK(game, "map cache with a damaged %s didn't open", plane? "MAPO" : "MAPT");
+        if (game) ottd_free(game);
+        game = test_patched_cache(cache, data, size, tile, 0xFF, OTTD_F_VERIFY_CACHE);
+        CHECK(game == NULL, "map cache with a damaged %s verified", plane? "MAPO" : "MAPT");
+        if (game) ottd_free(game);
+    }
+    free(data);
+
+    ottd_company_t *cmp = &f.map->company[1];
+    cmp->ai = true;
+    cmp->face = 0x12345678;
+    cmp->inaugurated_year = 1950;
+    cmp->money = -123456789012LL;
+    cmp->loan = 300000;
+    cmp->yearly_expenses[2][EXPENSES_END - 1] = -42;
+    cmp->cur_economy.company_value = 987654321;
+    cmp->old_economy[MAX_HISTORY_MONTHS - 1].performance_history = 999;
+    cmp->num_valid_stat_ent = MAX_HISTORY_MONTHS;
+    game = NULL;
+    if (ottd_write_map_cache(f.map, cache, NULL, NULL, &err) == 0) game = ottd_open_map_cache(cache, NULL, NULL, &err);
+    CHECK(game, "cannot reopen a map cache: %s", err.message);
+    const ottd_company_t *cached = game? ottd_company(game, 1) : NULL;
+    CHECK(cached && cached->active && cached->ai && cached->face == cmp->face &&
+        cached->inaugurated_year == cmp->inaugurated_year && cached->money == cmp->money && cached->loan == cmp->loan &&
+        memcmp(cached->yearly_expenses, cmp->yearly_expenses, sizeof cmp->yearly_expenses) == 0 &&
+        memcmp(&cached->cur_economy, &cmp->cur_economy, sizeof cmp->cur_economy) == 0 &&
+        memcmp(cached->old_economy, cmp->old_economy, sizeof cmp->old_economy) == 0 &&
+        cached->num_valid_stat_ent == cmp->num_valid_stat_ent, "map cache lost company data");
+    if (game) ottd_free(game);
+    remove(path);
+    remove(cache);
+    test_fixture_end(&f);
+}
+
+int main(int argc, char **argv)
+{
+    test_render();
+    test_viewports();
+    test_write_pngs(0);
+    test_write_pngs(OTTD_F_HILLSHADE);
+    test_shade_row();
+    test_hillshade();
+    test_territory();
+    test_networks();
+    test_network_progress();
+    test_map_cache();
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures != 0;
+}
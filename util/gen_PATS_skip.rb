@@ -94,16 +94,15 @@ settings_struct.lines.each do |line|
   end
 end
 
-puts "// skip generated with gen_PATS_skip.rb"
-puts "ottd_skip(fp, #{@skip[0..SL_MAX_VERSION]});"
+# rows for OTTD_PATS_FIELDS in ottd_schema.h
+def version_name v
+  (v == SL_MAX_VERSION)? "SL_MAX_VERSION" : v.to_s
+end
+
+puts "#define OTTD_PATS_FIELDS(F, v, X) \\"
+puts "    F(v, X, PATS_SETTINGS, #{@skip[0..SL_MAX_VERSION]}, 0, SL_MAX_VERSION) \\"
 @skip.delete(0..SL_MAX_VERSION)
 @skip.each_pair { |range, nbytes|
-  if range.min == 0 then
-    puts "if (version <= #{range.max}) ottd_skip(fp, #{nbytes});"
-  elsif range.max == SL_MAX_VERSION then
-    puts "if (version >= #{range.min}) ottd_skip(fp, #{nbytes});"
-  else
-    puts "if (version >= #{range.min} && version <= #{range.max}) ottd_skip(fp, #{nbytes});"
-  end
-  
+  puts "    F(v, X, PATS_SETTINGS, #{nbytes}, #{range.min}, #{version_name(range.max)}) \\"
 }
+puts "    F(v, X, PATS_STARTING_YEAR, 4, 0, SL_MAX_VERSION)"